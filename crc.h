@@ -3,7 +3,43 @@
 #include <stdint.h>
 
 
+/*crc16 implementation, selected at build time:
+  BITWISE: no tables, smallest and slowest
+  TABLE: one 256 entry table in flash (512 bytes), the default
+  SLICING_BY_4/8: 4 or 8 bytes per round, 2kB/4kB of tables in flash
+  crc32c uses a 1kB table in flash, except in the bitwise build*/
+#define CRC16_METHOD_BITWISE        0
+#define CRC16_METHOD_TABLE          1
+#define CRC16_METHOD_SLICING_BY_4   2
+#define CRC16_METHOD_SLICING_BY_8   3
+
+#ifndef CRC16_METHOD
+#define CRC16_METHOD                CRC16_METHOD_TABLE
+#endif
+
+
+typedef struct
+{
+  uint16_t crc;
+} crc16Context_t;
+
+typedef struct
+{
+  uint32_t crc;
+} crc32cContext_t;
+
+
 uint16_t crc16(const uint8_t *data, uint16_t size);
+uint16_t crc16Bitwise(const uint8_t *data, uint16_t size);
+
+void crc16Init(crc16Context_t *ctx);
+void crc16Update(crc16Context_t *ctx, const uint8_t *data, uint16_t size);
+uint16_t crc16Final(crc16Context_t *ctx);
+
+uint32_t crc32c(const uint8_t *data, uint16_t size);
+void crc32cInit(crc32cContext_t *ctx);
+void crc32cUpdate(crc32cContext_t *ctx, const uint8_t *data, uint16_t size);
+uint32_t crc32cFinal(crc32cContext_t *ctx);
 
 
 #endif      //__CRC_H__
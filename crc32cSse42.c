@@ -0,0 +1,125 @@
+/*
+crc32c using the SSE4.2 crc32 instruction, which implements exactly the
+Castagnoli polynomial. Eight bytes are handled per instruction on 64-bit
+targets and four on 32-bit ones.
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include "crc32cSse42.h"
+#include "crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+static bool supportChecked = false;
+static bool supported = false;
+
+__attribute__((target("sse4.2"))) static uint32_t crc32cHw(const uint8_t *data, uint16_t size)
+{
+  uint32_t crc = 0xFFFFFFFF;
+
+#if defined(__x86_64__)
+  uint64_t crc64 = crc;
+
+  while(size >= 8)
+  {
+    uint64_t word;
+
+    memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    data += 8;
+    size -= 8;
+  }
+  crc = (uint32_t)crc64;
+#else
+  while(size >= 4)
+  {
+    uint32_t word;
+
+    memcpy(&word, data, sizeof(word));
+    crc = _mm_crc32_u32(crc, word);
+    data += 4;
+    size -= 4;
+  }
+#endif
+
+  while(size--)
+  {
+    crc = _mm_crc32_u8(crc, *(data++));
+  }
+
+  return ~crc;
+}
+
+static bool cpuHasSse42(void)
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if(__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+  {
+    return false;
+  }
+  return ((ecx & bit_SSE4_2) != 0);
+}
+
+/*compare against the portable implementation before taking this one into use*/
+static bool crossCheck(void)
+{
+  static uint8_t pattern[256 + 7];
+  uint16_t len, offset;
+  uint32_t seed = 0x87654321;
+
+  for(len = 0; len < sizeof(pattern); len++)
+  {
+    seed = seed * 1103515245 + 12345;
+    pattern[len] = (uint8_t)(seed >> 16);
+  }
+
+  for(len = 0; len <= 256; len++)
+  {
+    for(offset = 0; offset < 8; offset += 3)
+    {
+      if(crc32cHw(&pattern[offset], len) != crc32c(&pattern[offset], len))
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool crc32cSse42IsSupported(void)
+{
+  if(!supportChecked)
+  {
+    supported = cpuHasSse42() && crossCheck();
+    supportChecked = true;
+  }
+  return supported;
+}
+
+uint32_t crc32cSse42(const uint8_t *data, uint16_t size)
+{
+  if((data == NULL) || !crc32cSse42IsSupported())
+  {
+    return crc32c(data, size);
+  }
+  return crc32cHw(data, size);
+}
+
+#else
+
+bool crc32cSse42IsSupported(void)
+{
+  return false;
+}
+
+uint32_t crc32cSse42(const uint8_t *data, uint16_t size)
+{
+  return crc32c(data, size);
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef __CRC32CSSE42_H__
+#define __CRC32CSSE42_H__
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/*true if the CPU supports the SSE4.2 crc32 instruction and the implementation
+  has been cross-checked against the portable crc32c*/
+bool crc32cSse42IsSupported(void);
+
+/*bit-exact with crc32c(). Falls back to crc32c() when not supported.*/
+uint32_t crc32cSse42(const uint8_t *data, uint16_t size);
+
+
+#endif      //__CRC32CSSE42_H__
@@ -0,0 +1,154 @@
+/*
+crcBench: throughput of the crc16 method the library is built with, not part of the library.
+
+The method is selected at build time with CRC16_METHOD, so "make bench" builds
+and runs this once per method. Before measuring, crc16() is checked against the
+bitwise reference for every length up to CRC_BENCH_CHECK_LENGTH at several
+alignments, and the incremental interface against crc16() in two pieces.
+
+When the CPU has carry-less multiplication, crc16Clmul() is checked and measured
+as well. Its tail bytes go through crc16(), so it depends a little on the method.
+
+The throughput is given in MB/s, and in bytes per TSC cycle on x86.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "crc.h"
+#include "crcClmul.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CRC_BENCH_HAVE_TSC      1
+#else
+#define CRC_BENCH_HAVE_TSC      0
+#endif
+
+#define CRC_BENCH_BUFFER_SIZE   65535
+#define CRC_BENCH_CHECK_LENGTH  3000
+#define CRC_BENCH_ALIGNMENTS    8
+#define CRC_BENCH_BYTES         (64UL * 1024 * 1024)   /*bytes checksummed per buffer size*/
+
+typedef uint16_t (*crcBenchFunction_t)(const uint8_t *data, uint16_t size);
+
+static const char *methodName(void)
+{
+  switch(CRC16_METHOD)
+  {
+    case CRC16_METHOD_BITWISE:      return "bitwise";
+    case CRC16_METHOD_TABLE:        return "table";
+    case CRC16_METHOD_SLICING_BY_4: return "slicing-by-4";
+    case CRC16_METHOD_SLICING_BY_8: return "slicing-by-8";
+    default:                        return "unknown";
+  }
+}
+
+static double secondsNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/*number of mismatches against the bitwise reference*/
+static unsigned long crossCheck(crcBenchFunction_t f, const uint8_t *buf)
+{
+  unsigned long bad = 0;
+  uint16_t len;
+  int align;
+
+  for(len = 0; len <= CRC_BENCH_CHECK_LENGTH; len++)
+  {
+    for(align = 0; align < CRC_BENCH_ALIGNMENTS; align++)
+    {
+      uint16_t expected = crc16Bitwise(&buf[align], len);
+      crc16Context_t ctx;
+
+      bad += (f(&buf[align], len) != expected);
+
+      crc16Init(&ctx);
+      crc16Update(&ctx, &buf[align], len / 3);
+      crc16Update(&ctx, &buf[align + len / 3], len - len / 3);
+      bad += (crc16Final(&ctx) != expected);
+    }
+  }
+  bad += (f(buf, CRC_BENCH_BUFFER_SIZE) != crc16Bitwise(buf, CRC_BENCH_BUFFER_SIZE));
+  return bad;
+}
+
+static void measure(const char *name, crcBenchFunction_t f, const uint8_t *buf, uint16_t size)
+{
+  unsigned long rounds = CRC_BENCH_BYTES / size + 1;
+  volatile uint16_t sink = 0;
+  unsigned long i;
+  double start, seconds;
+#if CRC_BENCH_HAVE_TSC
+  unsigned long long cycles = __rdtsc();
+#endif
+
+  start = secondsNow();
+  for(i = 0; i < rounds; i++)
+  {
+    sink ^= f(buf, size);
+  }
+  seconds = secondsNow() - start;
+
+#if CRC_BENCH_HAVE_TSC
+  cycles = __rdtsc() - cycles;
+  printf("  %-12s %5u B: %8.1f MB/s, %.2f bytes/cycle\n", name, size, (double)rounds * size / seconds / 1e6,
+         (double)rounds * size / (double)cycles);
+#else
+  printf("  %-12s %5u B: %8.1f MB/s\n", name, size, (double)rounds * size / seconds / 1e6);
+#endif
+  (void)sink;
+}
+
+int main(void)
+{
+  static const uint16_t sizes[] = {76, 256, 1024, 4096, 65535};
+  uint8_t *buf = malloc(CRC_BENCH_BUFFER_SIZE + CRC_BENCH_ALIGNMENTS);
+  unsigned long bad;
+  unsigned i;
+
+  if(buf == NULL)
+  {
+    printf("out of memory\n");
+    return 1;
+  }
+
+  srand(1);
+  for(i = 0; i < CRC_BENCH_BUFFER_SIZE + CRC_BENCH_ALIGNMENTS; i++)
+  {
+    buf[i] = (uint8_t)rand();
+  }
+
+  bad = crossCheck(crc16, buf);
+  printf("crc16 method %d (%s): %s\n", CRC16_METHOD, methodName(), (bad ? "MISMATCH" : "matches the bitwise reference"));
+
+  for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    measure(methodName(), crc16, buf, sizes[i]);
+  }
+
+  if(crc16ClmulIsSupported())
+  {
+    unsigned long clmulBad = crossCheck(crc16Clmul, buf);
+
+    printf("crc16Clmul: %s\n", (clmulBad ? "MISMATCH" : "matches the bitwise reference"));
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+      measure("clmul", crc16Clmul, buf, sizes[i]);
+    }
+    bad += clmulBad;
+  }
+  else
+  {
+    printf("crc16Clmul: not supported on this CPU\n");
+  }
+
+  free(buf);
+  return (bad ? 1 : 0);
+}
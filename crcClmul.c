@@ -0,0 +1,204 @@
+/*
+crc16 using carry-less multiplication (PCLMULQDQ) for x86 targets.
+
+The data is handled as 128-bit blocks in natural bit order (first byte is the
+most significant). A block X followed by n more bits of data is congruent to
+  X_hi * (x^(n+64) mod P) + X_lo * (x^n mod P)
+modulo P, so each block can be "folded" forward onto the next one with two
+64x64 bit carry-less multiplications. Four blocks are folded in parallel for
+long buffers. The final 128-bit remainder and the tail bytes are reduced with
+the portable incremental crc16, which keeps the result bit-exact with crc16().
+*/
+
+#include <stddef.h>
+#include "crcClmul.h"
+#include "crc.h"
+
+#define CRC16_POLY_FULL           0x18005     /*x^16 + x^15 + x^2 + 1*/
+#define CRC16_CLMUL_MIN_SIZE      32          /*shorter buffers go to the portable crc16*/
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define CLMUL_TARGET __attribute__((target("pclmul,ssse3")))
+
+/*fold constants: lo = x^n mod P, hi = x^(n+64) mod P*/
+static uint32_t foldConstants[4][2];
+static bool constantsReady = false;
+
+static uint32_t xPowModP(uint32_t n)
+{
+  uint32_t r = 1;
+
+  while(n--)
+  {
+    r <<= 1;
+    if(r & 0x10000)
+    {
+      r ^= CRC16_POLY_FULL;
+    }
+  }
+  return r;
+}
+
+static void initializeConstants(void)
+{
+  int i;
+
+  if(!constantsReady)
+  {
+    /*fold distances: 128, 256, 384 and 512 bits*/
+    for(i = 0; i < 4; i++)
+    {
+      foldConstants[i][0] = xPowModP(128 * (i + 1));
+      foldConstants[i][1] = xPowModP(128 * (i + 1) + 64);
+    }
+    constantsReady = true;
+  }
+}
+
+CLMUL_TARGET static inline __m128i fold(__m128i x, __m128i k)
+{
+  return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11));
+}
+
+CLMUL_TARGET static inline __m128i loadBlock(const uint8_t *data, __m128i byteSwap)
+{
+  return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), byteSwap);
+}
+
+CLMUL_TARGET static uint16_t crc16ClmulFold(const uint8_t *data, uint16_t size)
+{
+  const __m128i byteSwap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  __m128i k128 = _mm_set_epi64x(foldConstants[0][1], foldConstants[0][0]);
+  __m128i x;
+  uint8_t remainder[16];
+  crc16Context_t ctx;
+
+  if(size >= 64)
+  {
+    __m128i k256 = _mm_set_epi64x(foldConstants[1][1], foldConstants[1][0]);
+    __m128i k384 = _mm_set_epi64x(foldConstants[2][1], foldConstants[2][0]);
+    __m128i k512 = _mm_set_epi64x(foldConstants[3][1], foldConstants[3][0]);
+    __m128i x0 = loadBlock(data, byteSwap);
+    __m128i x1 = loadBlock(data + 16, byteSwap);
+    __m128i x2 = loadBlock(data + 32, byteSwap);
+    __m128i x3 = loadBlock(data + 48, byteSwap);
+
+    data += 64;
+    size -= 64;
+
+    while(size >= 64)
+    {
+      x0 = _mm_xor_si128(fold(x0, k512), loadBlock(data, byteSwap));
+      x1 = _mm_xor_si128(fold(x1, k512), loadBlock(data + 16, byteSwap));
+      x2 = _mm_xor_si128(fold(x2, k512), loadBlock(data + 32, byteSwap));
+      x3 = _mm_xor_si128(fold(x3, k512), loadBlock(data + 48, byteSwap));
+      data += 64;
+      size -= 64;
+    }
+
+    /*combine the four lanes into one*/
+    x = _mm_xor_si128(_mm_xor_si128(fold(x0, k384), fold(x1, k256)), _mm_xor_si128(fold(x2, k128), x3));
+  }
+  else
+  {
+    x = loadBlock(data, byteSwap);
+    data += 16;
+    size -= 16;
+  }
+
+  while(size >= 16)
+  {
+    x = _mm_xor_si128(fold(x, k128), loadBlock(data, byteSwap));
+    data += 16;
+    size -= 16;
+  }
+
+  /*reduce the 128-bit remainder and continue with the tail*/
+  _mm_storeu_si128((__m128i *)remainder, _mm_shuffle_epi8(x, byteSwap));
+
+  crc16Init(&ctx);
+  crc16Update(&ctx, remainder, sizeof(remainder));
+  crc16Update(&ctx, data, size);
+
+  return crc16Final(&ctx);
+}
+
+static bool cpuHasClmul(void)
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if(__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+  {
+    return false;
+  }
+  return ((ecx & bit_PCLMUL) != 0) && ((ecx & bit_SSSE3) != 0);
+}
+
+/*compare against the bitwise reference before the implementation is taken into use*/
+static bool crossCheck(void)
+{
+  static uint8_t pattern[1024 + 15];
+  uint16_t len, offset;
+  uint32_t seed = 0x12345678;
+
+  for(len = 0; len < sizeof(pattern); len++)
+  {
+    seed = seed * 1103515245 + 12345;
+    pattern[len] = (uint8_t)(seed >> 16);
+  }
+
+  for(len = 0; len <= 1024; len += ((len < 160) ? 1 : 37))
+  {
+    for(offset = 0; offset < 16; offset += 5)
+    {
+      if(crc16Clmul(&pattern[offset], len) != crc16Bitwise(&pattern[offset], len))
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool crc16ClmulIsSupported(void)
+{
+  static int supported = -1;
+
+  if(supported < 0)
+  {
+    supported = 0;
+    if(cpuHasClmul())
+    {
+      initializeConstants();
+      supported = (crossCheck() ? 1 : 0);
+    }
+  }
+  return (supported == 1);
+}
+
+uint16_t crc16Clmul(const uint8_t *data, uint16_t size)
+{
+  if((data == NULL) || (size < CRC16_CLMUL_MIN_SIZE) || !constantsReady)
+  {
+    return crc16(data, size);
+  }
+  return crc16ClmulFold(data, size);
+}
+
+#else
+
+bool crc16ClmulIsSupported(void)
+{
+  return false;
+}
+
+uint16_t crc16Clmul(const uint8_t *data, uint16_t size)
+{
+  return crc16(data, size);
+}
+
+#endif
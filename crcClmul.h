@@ -0,0 +1,16 @@
+#ifndef __CRCCLMUL_H__
+#define __CRCCLMUL_H__
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/*true if the CPU supports carry-less multiplication and the implementation
+  has been cross-checked against the bitwise reference*/
+bool crc16ClmulIsSupported(void);
+
+/*bit-exact with crc16(). Falls back to crc16() for short buffers or when
+  not supported.*/
+uint16_t crc16Clmul(const uint8_t *data, uint16_t size);
+
+
+#endif      //__CRCCLMUL_H__
@@ -0,0 +1,77 @@
+/*
+Checksums of the delta transfer.
+
+The weak checksum is the one of rsync: a is the sum of the bytes and b the sum of
+the running sums, both 16 bits. Moving the window by one byte takes the byte
+leaving it out of both sums, so the receiver can look for a block at every
+offset of its old file without summing the block again.
+
+The weak checksum is easy to fool, each of its matches is confirmed with the
+32 bit FNV-1a of the block before the block is taken.
+*/
+
+#include <stddef.h>
+#include "delta.h"
+
+#define DELTA_FNV_PRIME   16777619UL
+
+void deltaRollingInit(deltaRolling_t *r)
+{
+  r->a = 0;
+  r->b = 0;
+  r->len = 0;
+}
+
+void deltaRollingAdd(deltaRolling_t *r, const uint8_t *data, uint16_t size)
+{
+  uint16_t i;
+
+  for(i = 0; i < size; i++)
+  {
+    r->a += data[i];
+    r->b += r->a;
+  }
+  r->len += size;
+}
+
+void deltaRollingRoll(deltaRolling_t *r, uint8_t out, uint8_t in)
+{
+  r->a += (uint32_t)in - out;
+  r->b += r->a - r->len * out;
+}
+
+uint32_t deltaRollingValue(const deltaRolling_t *r)
+{
+  return (r->a & 0xFFFF) | ((r->b & 0xFFFF) << 16);
+}
+
+uint32_t deltaStrong(uint32_t hash, const uint8_t *data, uint16_t size)
+{
+  uint16_t i;
+
+  for(i = 0; i < size; i++)
+  {
+    hash = (hash ^ data[i]) * DELTA_FNV_PRIME;
+  }
+  return hash;
+}
+
+uint32_t deltaBlockLength(uint32_t fileSize)
+{
+  uint64_t square = (uint64_t)fileSize * 8;
+  uint32_t root = 0;
+  uint32_t bit = (uint32_t)1 << 31;
+
+  /*integer square root, one bit at a time from the top*/
+  while(bit > 0)
+  {
+    uint64_t candidate = (uint64_t)(root | bit);
+
+    if(candidate * candidate <= square)
+    {
+      root |= bit;
+    }
+    bit >>= 1;
+  }
+  return root;
+}
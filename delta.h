@@ -0,0 +1,38 @@
+#ifndef __DELTA_H__
+#define __DELTA_H__
+#include <stdint.h>
+
+
+/*block checksums for the delta transfer, as in rsync: a weak checksum that rolls
+  over the data one byte at a time, and a stronger one to confirm its matches*/
+
+typedef struct
+{
+  uint32_t a;       /*sum of the bytes*/
+  uint32_t b;       /*sum of the running sums*/
+  uint32_t len;     /*bytes in the window*/
+} deltaRolling_t;
+
+void deltaRollingInit(deltaRolling_t *r);
+
+/*append bytes to the window*/
+void deltaRollingAdd(deltaRolling_t *r, const uint8_t *data, uint16_t size);
+
+/*move the window one byte forward: out leaves at the start, in comes at the end*/
+void deltaRollingRoll(deltaRolling_t *r, uint8_t out, uint8_t in);
+
+uint32_t deltaRollingValue(const deltaRolling_t *r);
+
+
+/*strong checksum (FNV-1a), computed in pieces: start with DELTA_STRONG_INIT*/
+#define DELTA_STRONG_INIT   0x811C9DC5UL
+
+uint32_t deltaStrong(uint32_t hash, const uint8_t *data, uint16_t size);
+
+
+/*the block length for a file of this size: the signatures take 8 bytes per block, and
+  an edit costs about one block resent, which are in balance at sqrt(8 * fileSize)*/
+uint32_t deltaBlockLength(uint32_t fileSize);
+
+
+#endif      //__DELTA_H__
@@ -0,0 +1,352 @@
+/*
+dictTrain: builds a compression dictionary for THERMIT_CODEC_LZ_DICT from sample files.
+
+The dictionary is made of segments of the samples. Each byte position of the
+samples gets the number of files containing the k-mer starting there, so that
+the structure shared by many files weighs more than what one file repeats. The
+segment with the highest sum of weights goes into the dictionary, its k-mers
+are not counted again, and the next segment is picked, until the dictionary
+is full.
+
+The best segments are put at the end of the dictionary. The output is the raw
+dictionary, or a C array with -c, and the tool prints the dictionary id that
+the peers compare in SYNC.
+
+With -b the tool trains nothing, but compresses the files in chunks of the
+given size, both alone and against the dictionary, which tells whether the
+dictionary is worth it for files it was not trained with.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "crc.h"
+#include "lz.h"
+
+#define DICT_TRAIN_KMER             6       /*bytes hashed together, a bit over the shortest match*/
+#define DICT_TRAIN_SEGMENT          48      /*bytes taken from the samples at a time*/
+#define DICT_TRAIN_HASH_BITS        20
+#define DICT_TRAIN_HASH_SIZE        (1UL << DICT_TRAIN_HASH_BITS)
+#define DICT_TRAIN_SAMPLES_MAX      (16UL * 1024 * 1024)
+
+#define GET_MIN(a, b)               (((a) < (b)) ? (a) : (b))
+
+typedef struct
+{
+  uint8_t *data;          /*all samples one after the other*/
+  uint32_t len;
+  uint32_t *fileOf;       /*index of the sample file of each byte*/
+  uint32_t fileCount;
+} dictTrainSamples_t;
+
+static uint32_t kmerHash(const uint8_t *p)
+{
+  uint32_t h = 2166136261UL;
+  int i;
+
+  for(i = 0; i < DICT_TRAIN_KMER; i++)
+  {
+    h = (h ^ p[i]) * 16777619UL;
+  }
+  return h >> (32 - DICT_TRAIN_HASH_BITS);
+}
+
+/*a k-mer must not run over the end of its sample file*/
+static bool kmerIsValid(const dictTrainSamples_t *samples, uint32_t pos)
+{
+  return (pos + DICT_TRAIN_KMER <= samples->len) && (samples->fileOf[pos] == samples->fileOf[pos + DICT_TRAIN_KMER - 1]);
+}
+
+static bool readSample(dictTrainSamples_t *samples, const char *fileName)
+{
+  FILE *f = fopen(fileName, "rb");
+  size_t len;
+
+  if(f == NULL)
+  {
+    return false;
+  }
+
+  len = fread(&(samples->data[samples->len]), 1, DICT_TRAIN_SAMPLES_MAX - samples->len, f);
+  fclose(f);
+
+  while(len--)
+  {
+    samples->fileOf[samples->len++] = samples->fileCount;
+  }
+  samples->fileCount++;
+  return true;
+}
+
+/*number of files containing each k-mer*/
+static void countKmers(const dictTrainSamples_t *samples, uint16_t *fileCount, uint32_t *lastFile)
+{
+  uint32_t pos;
+
+  for(pos = 0; pos < samples->len; pos++)
+  {
+    if(kmerIsValid(samples, pos))
+    {
+      uint32_t h = kmerHash(&(samples->data[pos]));
+
+      if(lastFile[h] != samples->fileOf[pos] + 1)
+      {
+        lastFile[h] = samples->fileOf[pos] + 1;
+        if(fileCount[h] < 0xFFFF)
+        {
+          fileCount[h]++;
+        }
+      }
+    }
+  }
+}
+
+/*the segment with the most weight in k-mers not in the dictionary yet. Returns the weight.*/
+static uint64_t bestSegment(const dictTrainSamples_t *samples, const uint16_t *fileCount, uint32_t segmentLen, uint32_t *bestPos)
+{
+  uint64_t best = 0;
+  uint64_t sum = 0;
+  uint32_t kmers = segmentLen - DICT_TRAIN_KMER + 1;
+  uint32_t pos;
+
+  for(pos = 0; pos < samples->len; pos++)
+  {
+    /*a k-mer seen in one file only is nothing to share*/
+    if(kmerIsValid(samples, pos))
+    {
+      uint16_t count = fileCount[kmerHash(&(samples->data[pos]))];
+
+      sum += ((count > 1) ? count : 0);
+    }
+    if(pos >= kmers)
+    {
+      uint32_t old = pos - kmers;
+
+      if(kmerIsValid(samples, old))
+      {
+        uint16_t count = fileCount[kmerHash(&(samples->data[old]))];
+
+        sum -= ((count > 1) ? count : 0);
+      }
+    }
+
+    if((pos + 1 >= kmers) && (sum > best))
+    {
+      uint32_t start = pos + 1 - kmers;
+
+      if((start + segmentLen <= samples->len) && (samples->fileOf[start] == samples->fileOf[start + segmentLen - 1]))
+      {
+        best = sum;
+        *bestPos = start;
+      }
+    }
+  }
+  return best;
+}
+
+/*the id the dictionary is announced with in SYNC*/
+static uint16_t dictionaryId(const uint8_t *dict, uint32_t len)
+{
+  uint16_t id = crc16(dict, (uint16_t)len);
+
+  return (id ? id : 1);
+}
+
+/*compressed bytes of the files cut into chunks, a chunk that does not get shorter is counted raw*/
+static void benchmark(const dictTrainSamples_t *samples, const uint8_t *dict, uint16_t dictLen, uint16_t chunkSize)
+{
+  static lzDictionary_t index;
+  static uint8_t packed[0xFFFF];
+  static uint8_t unpacked[0xFFFF];
+  uint32_t rawTotal = 0, lzTotal = 0, dictTotal = 0;
+  uint32_t chunks = 0;
+  uint32_t pos = 0;
+
+  lzDictionaryInit(&index, dict, dictLen);
+
+  while(pos < samples->len)
+  {
+    uint16_t len = 0;
+    uint16_t packedLen;
+
+    /*chunks do not cross the file borders, as in a transfer*/
+    while((len < chunkSize) && (pos + len < samples->len) && (samples->fileOf[pos + len] == samples->fileOf[pos]))
+    {
+      len++;
+    }
+
+    packedLen = lzCompress(&(samples->data[pos]), len, packed, len - 1);
+    lzTotal += (packedLen ? packedLen : len);
+
+    packedLen = lzCompressDict(&index, &(samples->data[pos]), len, packed, len - 1);
+    if(packedLen && ((lzDecompressDict(&index, packed, packedLen, unpacked, len) != len) || memcmp(unpacked, &(samples->data[pos]), len)))
+    {
+      printf("round trip failed at %lu\n", (unsigned long)pos);
+    }
+    dictTotal += (packedLen ? packedLen : len);
+
+    rawTotal += len;
+    chunks++;
+    pos += len;
+  }
+
+  printf("%lu files, %lu chunks, %lu bytes\n", (unsigned long)samples->fileCount, (unsigned long)chunks, (unsigned long)rawTotal);
+  printf("per chunk:       %lu bytes (%lu%%)\n", (unsigned long)lzTotal, (unsigned long)(100ULL * lzTotal / rawTotal));
+  printf("with dictionary: %lu bytes (%lu%%)\n", (unsigned long)dictTotal, (unsigned long)(100ULL * dictTotal / rawTotal));
+}
+
+static int writeDictionary(const char *fileName, const uint8_t *dict, uint32_t len, bool asC)
+{
+  FILE *f = fopen(fileName, (asC ? "w" : "wb"));
+  uint32_t i;
+
+  if(f == NULL)
+  {
+    return -1;
+  }
+
+  if(asC)
+  {
+    fprintf(f, "/*compression dictionary made with dictTrain, id 0x%04X*/\n", dictionaryId(dict, len));
+    fprintf(f, "#include <stdint.h>\n\nconst uint16_t thermitDictionaryLength = %lu;\n", (unsigned long)len);
+    fprintf(f, "const uint8_t thermitDictionary[%lu] =\n{", (unsigned long)len);
+    for(i = 0; i < len; i++)
+    {
+      fprintf(f, "%s0x%02X%s", ((i % 16) == 0 ? "\n  " : ""), dict[i], ((i + 1 < len) ? ", " : ""));
+    }
+    fprintf(f, "\n};\n");
+  }
+  else
+  {
+    (void)fwrite(dict, 1, len, f);
+  }
+  fclose(f);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  static uint8_t dict[LZ_DICTIONARY_SIZE_MAX];
+  dictTrainSamples_t samples;
+  uint16_t *fileCount;
+  uint32_t *lastFile;
+  uint32_t dictSize = LZ_DICTIONARY_SIZE_MAX;
+  uint32_t chunkSize = 0;
+  uint32_t dictLen = 0;
+  bool asC = false;
+  const char *outName = NULL;
+  int i;
+
+  memset(&samples, 0, sizeof(samples));
+  samples.data = malloc(DICT_TRAIN_SAMPLES_MAX);
+  samples.fileOf = malloc(DICT_TRAIN_SAMPLES_MAX * sizeof(uint32_t));
+  fileCount = calloc(DICT_TRAIN_HASH_SIZE, sizeof(uint16_t));
+  lastFile = calloc(DICT_TRAIN_HASH_SIZE, sizeof(uint32_t));
+
+  if(!samples.data || !samples.fileOf || !fileCount || !lastFile)
+  {
+    printf("out of memory\n");
+    return 1;
+  }
+
+  for(i = 1; i < argc; i++)
+  {
+    if((strcmp(argv[i], "-s") == 0) && (i + 1 < argc))
+    {
+      dictSize = (uint32_t)atoi(argv[++i]);
+      dictSize = ((dictSize > 0) && (dictSize <= LZ_DICTIONARY_SIZE_MAX) ? dictSize : LZ_DICTIONARY_SIZE_MAX);
+    }
+    else if((strcmp(argv[i], "-b") == 0) && (i + 1 < argc))
+    {
+      chunkSize = (uint32_t)atoi(argv[++i]);
+      chunkSize = ((chunkSize > 1) && (chunkSize <= 0xFFFF) ? chunkSize : 0);
+    }
+    else if(strcmp(argv[i], "-c") == 0)
+    {
+      asC = true;
+    }
+    else if(outName == NULL)
+    {
+      outName = argv[i];
+    }
+    else if(!readSample(&samples, argv[i]))
+    {
+      printf("could not read '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+
+  if((outName == NULL) || (samples.fileCount == 0))
+  {
+    printf("syntax: %s [-s size] [-c] dictionary sample...\n"
+           "        %s -b chunk dictionary file...\n"
+           "size = dictionary size, at most %d bytes\n"
+           "-c = write the dictionary as a C array\n"
+           "-b = compress the files with an existing dictionary, in chunks of the given size\n", argv[0], argv[0], LZ_DICTIONARY_SIZE_MAX);
+    return 1;
+  }
+
+  if(chunkSize > 0)
+  {
+    FILE *f = fopen(outName, "rb");
+
+    if(f == NULL)
+    {
+      printf("could not read '%s'\n", outName);
+      return 1;
+    }
+    dictLen = (uint32_t)fread(dict, 1, sizeof(dict), f);
+    fclose(f);
+
+    benchmark(&samples, dict, (uint16_t)dictLen, (uint16_t)chunkSize);
+    return 0;
+  }
+
+  countKmers(&samples, fileCount, lastFile);
+
+  /*the segments are filled in from the end, the best one first, as the
+    nearest offsets are the cheapest to search*/
+  while(dictLen < dictSize)
+  {
+    uint32_t segmentLen = GET_MIN(DICT_TRAIN_SEGMENT, dictSize - dictLen);
+    uint32_t pos = 0;
+    uint32_t k;
+
+    if((segmentLen < DICT_TRAIN_KMER) || (bestSegment(&samples, fileCount, segmentLen, &pos) == 0))
+    {
+      break;
+    }
+
+    dictLen += segmentLen;
+    memcpy(&dict[dictSize - dictLen], &(samples.data[pos]), segmentLen);
+
+    /*the k-mers now in the dictionary give nothing more*/
+    for(k = pos; k + DICT_TRAIN_KMER <= pos + segmentLen; k++)
+    {
+      fileCount[kmerHash(&(samples.data[k]))] = 0;
+    }
+  }
+
+  if(dictLen == 0)
+  {
+    printf("the samples have nothing in common\n");
+    return 1;
+  }
+
+  if(writeDictionary(outName, &dict[dictSize - dictLen], dictLen, asC) != 0)
+  {
+    printf("could not write '%s'\n", outName);
+    return 1;
+  }
+
+  printf("%lu bytes from %lu samples (%lu bytes), dictionary id 0x%04X\n", (unsigned long)dictLen,
+         (unsigned long)samples.fileCount, (unsigned long)samples.len, dictionaryId(&dict[dictSize - dictLen], dictLen));
+
+  free(samples.data);
+  free(samples.fileOf);
+  free(fileCount);
+  free(lastFile);
+  return 0;
+}
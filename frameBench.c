@@ -0,0 +1,262 @@
+/*
+frameBench: deframing cost of the stream framing, not part of the library.
+
+A stream of frames with random headers and payloads is fed to the framer one
+byte at a time with streamFramingFollow(), and in blocks of several sizes with
+streamFramingFeed(), in start/stop and in COBS mode. Every run must deliver
+all the frames with a good check. The result is the deframing speed in MB of
+stream per second.
+
+Then the resynchronisation is measured: the length byte of every 10th frame
+is flipped, and in a second run random bit errors are added on the wire. The
+frames lost beyond the damaged ones are what the framer loses while it is out
+of sync. With only the length bytes flipped COBS must not lose any of them.
+A bit error in a COBS delimiter joins two frames, so the next one is lost
+as well.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "crc.h"
+#include "streamFraming.h"
+
+#define FRAME_BENCH_FRAMES          20000
+#define FRAME_BENCH_PAYLOAD_MAX     200
+#define FRAME_BENCH_STREAM_SIZE     (FRAME_BENCH_FRAMES * (STREAM_FRAMING_HEADER_LENGTH_WIDE + FRAME_BENCH_PAYLOAD_MAX + 6))
+#define FRAME_BENCH_ROUNDS          20
+#define FRAME_BENCH_FRAME_MAX       (STREAM_FRAMING_HEADER_LENGTH_WIDE + FRAME_BENCH_PAYLOAD_MAX + 2)
+#define FRAME_BENCH_FLIP_EVERY      10      /*frames between the ones with a flipped length byte*/
+#define FRAME_BENCH_BIT_ERROR_ODDS  20000   /*one bit error per this many bytes on the wire*/
+
+typedef struct
+{
+  uint32_t good;        /*frames delivered with a good check*/
+  uint32_t bad;         /*frames delivered with a failed check*/
+} frameBenchResult_t;
+
+static double secondsNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static const char *modeName(streamFramingMode_t mode)
+{
+  return ((mode == STREAM_FRAMING_MODE_COBS) ? "COBS" : "start/stop");
+}
+
+/*one frame as ioLinux sends it, with start and stop sequences or COBS encoded.
+  Every fourth frame has the wide header. flipLength damages the length byte
+  after the check is calculated. Returns the bytes written.*/
+static uint32_t makeFrame(uint8_t *out, streamFramingMode_t mode, bool flipLength)
+{
+  uint8_t frame[STREAM_FRAMING_BUFFER_SIZE];
+  uint8_t wide = ((rand() % 4) == 0);
+  uint8_t headerLen = (wide ? STREAM_FRAMING_HEADER_LENGTH_WIDE : STREAM_FRAMING_HEADER_LENGTH);
+  uint8_t payloadLen = (uint8_t)(rand() % FRAME_BENCH_PAYLOAD_MAX);
+  uint16_t len = 0;
+  uint16_t crc;
+  uint32_t ret = 0;
+
+  frame[len++] = (wide ? 0x44 : 0x04);
+  while(len < headerLen - 1)
+  {
+    frame[len++] = (uint8_t)rand();
+  }
+  frame[len++] = payloadLen;
+  while(len < headerLen + payloadLen)
+  {
+    frame[len++] = (uint8_t)rand();
+  }
+  crc = crc16(frame, len);
+  frame[len++] = (uint8_t)(crc & 0xFF);
+  frame[len++] = (uint8_t)(crc >> 8);
+
+  if(flipLength)
+  {
+    frame[headerLen - 1] ^= (uint8_t)(1 << (rand() % 8));
+  }
+
+  if(mode == STREAM_FRAMING_MODE_COBS)
+  {
+    return streamFramingCobsEncode(frame, len, out);
+  }
+
+  out[ret++] = START_CHAR;
+  out[ret++] = START_CHAR;
+  memcpy(&out[ret], frame, len);
+  ret += len;
+  out[ret++] = STOP_CHAR;
+  out[ret++] = STOP_CHAR;
+  return ret;
+}
+
+static void takeFrame(streamFraming_t *frame, frameBenchResult_t *result)
+{
+  if(frame->check != STREAM_FRAMING_CHECK_FAILED)
+  {
+    result->good++;
+  }
+  else
+  {
+    result->bad++;
+  }
+  streamFramingRestart(frame);
+}
+
+/*blockSize 0: one byte at a time with streamFramingFollow()*/
+static frameBenchResult_t deframe(const uint8_t *stream, uint32_t len, streamFramingMode_t mode, uint16_t blockSize)
+{
+  frameBenchResult_t result = {0, 0};
+  streamFraming_t frame;
+  uint32_t pos = 0;
+
+  streamFramingInitialize(&frame);
+  streamFramingConfigure(&frame, mode, FRAME_BENCH_FRAME_MAX);
+
+  while(pos < len)
+  {
+    if(blockSize == 0)
+    {
+      streamFramingFollow(&frame, stream[pos++]);
+      if(frame.isReady)
+      {
+        takeFrame(&frame, &result);
+      }
+    }
+    else
+    {
+      uint16_t n = (uint16_t)((len - pos < blockSize) ? (len - pos) : blockSize);
+      uint16_t used = 0;
+
+      /*the framer stops after each frame, the rest of the block is fed again*/
+      while(used < n)
+      {
+        used += streamFramingFeed(&frame, &stream[pos + used], (uint16_t)(n - used));
+        if(frame.isReady)
+        {
+          takeFrame(&frame, &result);
+        }
+      }
+      pos += n;
+    }
+  }
+
+  /*frames still kept by the framer*/
+  (void)streamFramingFeed(&frame, stream, 0);
+  while(frame.isReady)
+  {
+    takeFrame(&frame, &result);
+    (void)streamFramingFeed(&frame, stream, 0);
+  }
+  return result;
+}
+
+static int measureThroughput(uint8_t *stream, streamFramingMode_t mode)
+{
+  static const uint16_t blockSizes[] = {0, 1, 64, 512, 4096};
+  uint32_t len = 0;
+  int failed = 0;
+  unsigned i;
+
+  srand(1);
+  for(i = 0; i < FRAME_BENCH_FRAMES; i++)
+  {
+    len += makeFrame(&stream[len], mode, false);
+  }
+  printf("%s: %d frames, %lu bytes\n", modeName(mode), FRAME_BENCH_FRAMES, (unsigned long)len);
+
+  for(i = 0; i < sizeof(blockSizes) / sizeof(blockSizes[0]); i++)
+  {
+    frameBenchResult_t result = {0, 0};
+    double start = secondsNow();
+    int round;
+
+    for(round = 0; round < FRAME_BENCH_ROUNDS; round++)
+    {
+      result = deframe(stream, len, mode, blockSizes[i]);
+    }
+
+    if(blockSizes[i] == 0)
+    {
+      printf("  byte by byte: ");
+    }
+    else
+    {
+      printf("  %4u B blocks: ", blockSizes[i]);
+    }
+    printf("%7.1f MB/s, %lu frames good, %lu bad\n", (double)len * FRAME_BENCH_ROUNDS / (secondsNow() - start) / 1e6,
+           (unsigned long)result.good, (unsigned long)result.bad);
+
+    failed |= ((result.good != FRAME_BENCH_FRAMES) || (result.bad != 0));
+  }
+  return failed;
+}
+
+/*every 10th frame with a flipped length byte, optionally random bit errors
+  on the wire as well. Returns the number of undamaged frames lost.*/
+static uint32_t measureResync(uint8_t *stream, streamFramingMode_t mode, bool bitErrors)
+{
+  frameBenchResult_t result;
+  uint32_t damaged = 0;
+  uint32_t len = 0;
+  uint32_t lost;
+  unsigned i;
+
+  srand(2);
+  for(i = 0; i < FRAME_BENCH_FRAMES; i++)
+  {
+    bool flipLength = ((i % FRAME_BENCH_FLIP_EVERY) == 0);
+    uint32_t frameLen = makeFrame(&stream[len], mode, flipLength);
+    bool hit = flipLength;
+    uint32_t j;
+
+    for(j = 0; bitErrors && (j < frameLen); j++)
+    {
+      if((rand() % FRAME_BENCH_BIT_ERROR_ODDS) == 0)
+      {
+        stream[len + j] ^= (uint8_t)(1 << (rand() % 8));
+        hit = true;
+      }
+    }
+    damaged += hit;
+    len += frameLen;
+  }
+
+  result = deframe(stream, len, mode, 512);
+  lost = FRAME_BENCH_FRAMES - damaged - result.good;
+  printf("  %-10s %s: %lu frames damaged, %lu good, %lu undamaged frames lost\n", modeName(mode),
+         (bitErrors ? "length flips and bit errors" : "length flips               "), (unsigned long)damaged,
+         (unsigned long)result.good, (unsigned long)lost);
+  return lost;
+}
+
+int main(void)
+{
+  uint8_t *stream = malloc(FRAME_BENCH_STREAM_SIZE);
+  int failed = 0;
+
+  if(stream == NULL)
+  {
+    printf("out of memory\n");
+    return 1;
+  }
+
+  failed |= measureThroughput(stream, STREAM_FRAMING_MODE_START_STOP);
+  failed |= measureThroughput(stream, STREAM_FRAMING_MODE_COBS);
+
+  printf("resync, the length byte of every %dth frame flipped, one bit error per %d bytes:\n",
+         FRAME_BENCH_FLIP_EVERY, FRAME_BENCH_BIT_ERROR_ODDS);
+  (void)measureResync(stream, STREAM_FRAMING_MODE_START_STOP, false);
+  (void)measureResync(stream, STREAM_FRAMING_MODE_START_STOP, true);
+  failed |= (measureResync(stream, STREAM_FRAMING_MODE_COBS, false) != 0);
+  (void)measureResync(stream, STREAM_FRAMING_MODE_COBS, true);
+
+  free(stream);
+  return failed;
+}
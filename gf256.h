@@ -0,0 +1,18 @@
+#ifndef __GF256_H__
+#define __GF256_H__
+#include <stdint.h>
+
+
+/*arithmetic in GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D).
+  Addition and subtraction are XOR. The log and exp tables take 768 bytes of flash.*/
+
+uint8_t gf256Mul(uint8_t a, uint8_t b);
+
+/*b must not be zero*/
+uint8_t gf256Div(uint8_t a, uint8_t b);
+
+/*dst ^= coef * src for each byte, the kernel of the erasure code*/
+void gf256MulAdd(uint8_t *dst, const uint8_t *src, uint8_t coef, uint16_t size);
+
+
+#endif      //__GF256_H__
@@ -0,0 +1,153 @@
+/*
+GF(2^8) multiply-add with the SSSE3 byte shuffle (PSHUFB) for x86 targets.
+
+Multiplication by a constant is linear over XOR, so
+  coef * b = coef * (b & 0x0F) ^ coef * (b & 0xF0)
+and both halves come from a 16 entry table, which fits into one register.
+Sixteen bytes are handled with two shuffles. The tail goes to the portable
+gf256MulAdd.
+*/
+
+#include <stddef.h>
+#include "gf256Ssse3.h"
+#include "gf256.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+static bool supportChecked = false;
+static bool supported = false;
+
+__attribute__((target("ssse3"))) static void gf256MulAddHw(uint8_t *dst, const uint8_t *src, uint8_t coef, uint16_t size)
+{
+  uint8_t powers[8];     /*coef * 2^k*/
+  uint8_t lowTable[16];
+  uint8_t highTable[16];
+  uint8_t i;
+  __m128i low, high, mask;
+
+  /*the tables are built from the products with the single bits, so that short
+    buffers gain too*/
+  powers[0] = coef;
+  for(i = 1; i < 8; i++)
+  {
+    powers[i] = (uint8_t)((powers[i - 1] << 1) ^ ((powers[i - 1] & 0x80) ? 0x1D : 0));
+  }
+  lowTable[0] = 0;
+  highTable[0] = 0;
+  for(i = 1; i < 16; i++)
+  {
+    uint8_t bit = (uint8_t)__builtin_ctz(i);
+
+    lowTable[i] = lowTable[i & (i - 1)] ^ powers[bit];
+    highTable[i] = highTable[i & (i - 1)] ^ powers[bit + 4];
+  }
+  low = _mm_loadu_si128((const __m128i *)lowTable);
+  high = _mm_loadu_si128((const __m128i *)highTable);
+  mask = _mm_set1_epi8(0x0F);
+
+  while(size >= 16)
+  {
+    __m128i s = _mm_loadu_si128((const __m128i *)src);
+    __m128i d = _mm_loadu_si128((const __m128i *)dst);
+    __m128i productLow = _mm_shuffle_epi8(low, _mm_and_si128(s, mask));
+    __m128i productHigh = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+
+    d = _mm_xor_si128(d, _mm_xor_si128(productLow, productHigh));
+    _mm_storeu_si128((__m128i *)dst, d);
+    src += 16;
+    dst += 16;
+    size -= 16;
+  }
+
+  gf256MulAdd(dst, src, coef, size);
+}
+
+static bool cpuHasSsse3(void)
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if(__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+  {
+    return false;
+  }
+  return ((ecx & bit_SSSE3) != 0);
+}
+
+/*compare against the table based implementation before taking this one into use*/
+static bool crossCheck(void)
+{
+  static uint8_t pattern[96 + 7];
+  uint8_t expected[96];
+  uint8_t result[96];
+  uint16_t len, offset, i;
+  uint16_t coef;
+  uint32_t seed = 0x13572468;
+
+  for(i = 0; i < sizeof(pattern); i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    pattern[i] = (uint8_t)(seed >> 16);
+  }
+
+  for(coef = 0; coef < 256; coef++)
+  {
+    for(len = 0; len <= 96; len += ((coef < 4) ? 1 : 31))
+    {
+      for(offset = 0; offset < 8; offset += 3)
+      {
+        for(i = 0; i < len; i++)
+        {
+          expected[i] = result[i] = (uint8_t)(i * 7);
+        }
+        gf256MulAdd(expected, &pattern[offset], (uint8_t)coef, len);
+        gf256MulAddHw(result, &pattern[offset], (uint8_t)coef, len);
+
+        for(i = 0; i < len; i++)
+        {
+          if(expected[i] != result[i])
+          {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool gf256Ssse3IsSupported(void)
+{
+  if(!supportChecked)
+  {
+    supported = cpuHasSsse3() && crossCheck();
+    supportChecked = true;
+  }
+  return supported;
+}
+
+void gf256MulAddSsse3(uint8_t *dst, const uint8_t *src, uint8_t coef, uint16_t size)
+{
+  if((dst == NULL) || (src == NULL) || (coef < 2) || !gf256Ssse3IsSupported())
+  {
+    gf256MulAdd(dst, src, coef, size);
+    return;
+  }
+  gf256MulAddHw(dst, src, coef, size);
+}
+
+#else
+
+bool gf256Ssse3IsSupported(void)
+{
+  return false;
+}
+
+void gf256MulAddSsse3(uint8_t *dst, const uint8_t *src, uint8_t coef, uint16_t size)
+{
+  gf256MulAdd(dst, src, coef, size);
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef __GF256SSSE3_H__
+#define __GF256SSSE3_H__
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/*true if the CPU supports the SSSE3 byte shuffle and the implementation
+  has been cross-checked against the table based gf256MulAdd*/
+bool gf256Ssse3IsSupported(void);
+
+/*bit-exact with gf256MulAdd(). Falls back to gf256MulAdd() when not supported.*/
+void gf256MulAddSsse3(uint8_t *dst, const uint8_t *src, uint8_t coef, uint16_t size);
+
+
+#endif      //__GF256SSSE3_H__
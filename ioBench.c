@@ -0,0 +1,149 @@
+/*
+ioBench: cost of receiving frames through ioLinux, not part of the library.
+
+Frames are written in batches to the master side of a pseudo terminal, and
+read back through ioLinuxTargetIf.devReadChecked from the slave side, as the
+protocol would read them from a serial port. Every frame must arrive with a
+good check.
+
+The read() calls of ioLinux are counted by linking with -Wl,--wrap=read. The
+result is the number of read() calls per frame and the CPU time per MB.
+*/
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/resource.h>
+#include "crc.h"
+#include "thermit.h"
+#include "streamFraming.h"
+#include "ioLinux.h"
+
+#define IO_BENCH_FRAMES     20000
+#define IO_BENCH_BATCH      30      /*frames written at a time*/
+#define IO_BENCH_PAYLOAD    (THERMIT_PAYLOAD_SIZE)
+
+static unsigned long readCalls = 0;
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+  readCalls++;
+  return __real_read(fd, buf, count);
+}
+
+static double cpuSeconds(void)
+{
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+  return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+         (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+/*a full data frame with start and stop sequences. Returns the bytes written.*/
+static uint16_t makeFrame(uint8_t *out, uint32_t frameNo)
+{
+  uint16_t len = 0;
+  uint16_t start;
+  uint16_t crc;
+  int i;
+
+  out[len++] = START_CHAR;
+  out[len++] = START_CHAR;
+  start = len;
+  out[len++] = 0x04;
+  for(i = 0; i < 4; i++)
+  {
+    out[len++] = (uint8_t)(frameNo >> (8 * i));
+  }
+  out[len++] = IO_BENCH_PAYLOAD;
+  for(i = 0; i < IO_BENCH_PAYLOAD; i++)
+  {
+    out[len++] = (uint8_t)(frameNo * 7 + i);
+  }
+  crc = crc16(&out[start], len - start);
+  out[len++] = (uint8_t)(crc & 0xFF);
+  out[len++] = (uint8_t)(crc >> 8);
+  out[len++] = STOP_CHAR;
+  out[len++] = STOP_CHAR;
+  return len;
+}
+
+int main(void)
+{
+  thermitTargetAdaptationInterface_t *tgt = &ioLinuxTargetIf;
+  uint8_t batch[IO_BENCH_BATCH * (THERMIT_MSG_SIZE_MAX + 4)];
+  uint8_t frame[THERMIT_MSG_SIZE_MAX];
+  unsigned long bytes = 0;
+  uint32_t sent = 0, good = 0;
+  thermitIoSlot_t slot;
+  struct termios tio;
+  double cpu;
+  int master;
+
+  /*the pseudo terminal stands in for the serial port*/
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0) || (tcgetattr(master, &tio) != 0))
+  {
+    printf("no pseudo terminal\n");
+    return 1;
+  }
+  cfmakeraw(&tio);
+  (void)tcsetattr(master, TCSANOW, &tio);
+
+  slot = tgt->devOpen((uint8_t *)ptsname(master), THERMIT_READ);
+  if(slot < 0)
+  {
+    printf("could not open '%s'\n", ptsname(master));
+    return 1;
+  }
+
+  readCalls = 0;
+  cpu = cpuSeconds();
+
+  while(sent < IO_BENCH_FRAMES)
+  {
+    uint32_t batchLen = 0;
+    uint32_t batchFrames = 0;
+
+    while((batchFrames < IO_BENCH_BATCH) && (sent < IO_BENCH_FRAMES))
+    {
+      batchLen += makeFrame(&batch[batchLen], sent);
+      batchFrames++;
+      sent++;
+    }
+    if(write(master, batch, batchLen) != (ssize_t)batchLen)
+    {
+      printf("write failed\n");
+      return 1;
+    }
+    bytes += batchLen;
+
+    /*exactly the frames just written, so no read() waits for the timeout*/
+    while(batchFrames-- > 0)
+    {
+      thermitFrameCheck_t check;
+
+      if((tgt->devReadChecked(slot, frame, sizeof(frame), &check) > 0) && (check == THERMIT_FRAME_CRC16_OK))
+      {
+        good++;
+      }
+    }
+  }
+
+  cpu = cpuSeconds() - cpu;
+  printf("%lu frames of %d bytes in batches of %d: %lu good, %.2f read() calls per frame, %.3f s CPU per MB\n",
+         (unsigned long)sent, IO_BENCH_PAYLOAD, IO_BENCH_BATCH, (unsigned long)good, (double)readCalls / sent, cpu / ((double)bytes / 1e6));
+
+  (void)tgt->devClose(slot);
+  close(master);
+  return ((good == sent) ? 0 : 1);
+}
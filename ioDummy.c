@@ -52,11 +52,20 @@ static int dbgPrintf(const char *restrict format, ...)
 }
 
 
+/*virtual clock: time moves only when the test says so, which keeps the timers deterministic*/
+static uint32_t virtualClockMs = 0;
+
 static uint32_t millis(uint32_t *max)
 {
-    static uint32_t ret = 0;
+    if(max)
+        *max = 0xFFFFFFFF;
+
+    return virtualClockMs;
+}
 
-    return ret++;
+void ioDummyClockAdvance(uint32_t ms)
+{
+    virtualClockMs += ms;
 }
 
 static bool ioFileAvailableForSending(uint8_t *fileNamePtr, uint16_t *sizePtr)
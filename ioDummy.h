@@ -3,4 +3,6 @@
 
 extern thermitTargetAdaptationInterface_t ioDummyTargetIf;
 
+void ioDummyClockAdvance(uint32_t ms);
+
 #endif  //__IODUMMY_H__
\ No newline at end of file
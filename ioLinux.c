@@ -3,16 +3,37 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <string.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include "crc.h"
+#include "crcClmul.h"
+#include "crc32cSse42.h"
+#include "gf256.h"
+#include "gf256Ssse3.h"
+#include "lz.h"
 #include "thermit.h"
 #include "streamFraming.h"
+#include "ioLinux.h"
 
 #define IOLINUX_DEVICES_MAX 1
-#define IOLINUX_FILES_MAX 1
+/*a file per transfer slot in each direction, and the old copy of each incoming file for
+  the delta transfer*/
+#if THERMIT_DELTA
+#define IOLINUX_FILES_MAX (3 * THERMIT_TRANSFER_SLOTS)
+#else
+#define IOLINUX_FILES_MAX (2 * THERMIT_TRANSFER_SLOTS)
+#endif
+#define IOLINUX_RX_BUFFER_SIZE 4096   /*bytes taken from the device per read() call at most*/
+#define IOLINUX_TX_BATCH_MAX 16       /*frames per writev() call in ioDeviceWriteBatch()*/
+#define IOLINUX_TX_TIMEOUT_MS 1000    /*give up when the device does not accept data for this long*/
+#define IOLINUX_DEVNAME_MAX 64
+#define IOLINUX_PART_SUFFIX ".part"  /*an incoming file is written under its name with this added, and renamed when complete*/
 
 
 #define IOLINUX_USE_DUMMY_FILE  true
@@ -23,13 +44,23 @@ static thermitIoSlot_t ioDeviceOpen(uint8_t *devName, thermitIoMode_t mode);
 static int ioDeviceClose(thermitIoSlot_t slot);
 static int ioDeviceRead(thermitIoSlot_t slot, uint8_t *buf, int16_t maxLen);
 static int ioDeviceWrite(thermitIoSlot_t slot, uint8_t *buf, int16_t len);
+static int ioDeviceReadChecked(thermitIoSlot_t slot, uint8_t *buf, int16_t maxLen, thermitFrameCheck_t *check);
+static int ioDeviceWriteBatch(thermitIoSlot_t slot, uint8_t **bufs, int16_t *lens, uint16_t count);
+static int ioDeviceTxPending(thermitIoSlot_t slot);
 static thermitIoSlot_t ioFileOpen(uint8_t *fileName, thermitIoMode_t mode, uint16_t *fileSize);
 static int ioFileRead(thermitIoSlot_t slot, uint16_t offset, uint8_t *buf, int16_t maxLen);
 static int ioFileWrite(thermitIoSlot_t slot, uint16_t offset, uint8_t *buf, int16_t len);
+static thermitIoSlot_t ioFileOpen32(uint8_t *fileName, thermitIoMode_t mode, uint32_t *fileSize);
+static thermitIoSlot_t ioFileOpenPrevious(uint8_t *fileName, uint32_t *fileSize);
+static int ioFileRead32(thermitIoSlot_t slot, uint32_t offset, uint8_t *buf, int16_t maxLen);
+static int ioFileWrite32(thermitIoSlot_t slot, uint32_t offset, uint8_t *buf, int16_t len);
 static int ioFileClose(thermitIoSlot_t slot);
+static int ioFileDiscard(thermitIoSlot_t slot);
 static bool ioFileAvailableForSending(uint8_t *fileNamePtr, uint16_t *sizePtr);
 
 static int dbgPrintf(const char *restrict format, ...);
+static const uint8_t *ioDictionary(uint16_t *len);
+static void selectAcceleratedImplementation(void) __attribute__((constructor));
 
 
 thermitTargetAdaptationInterface_t ioLinuxTargetIf = 
@@ -45,7 +76,18 @@ thermitTargetAdaptationInterface_t ioLinuxTargetIf =
   ioFileAvailableForSending,/*fileAvailableForSending*/
   millis,/*sysGetMs*/    
   dbgPrintf,/*sysPrintf*/
-  crc16/*sysCrc16*/
+  crc16,/*sysCrc16*/
+  ioDeviceReadChecked,/*devReadChecked*/
+  crc32c,/*sysCrc32c*/
+  ioDeviceWriteBatch,/*devWriteBatch*/
+  ioDeviceTxPending,/*devTxPending*/
+  ioFileOpen32,/*fileOpen32*/
+  ioFileRead32,/*fileRead32*/
+  ioFileWrite32,/*fileWrite32*/
+  gf256MulAdd,/*sysGf256MulAdd*/
+  ioDictionary,/*sysDictionary*/
+  ioFileOpenPrevious,/*fileOpenPrevious*/
+  ioFileDiscard/*fileDiscard*/
 };
 
 
@@ -54,17 +96,30 @@ typedef struct
 {
   bool active;
   int handle;
+  uint8_t rxBuf[IOLINUX_RX_BUFFER_SIZE];  /*ring buffer of received, not yet framed bytes*/
+  uint16_t rxHead;                        /*index of the oldest byte*/
+  uint16_t rxCount;                       /*number of bytes in the ring*/
+  streamFraming_t frame;
+  uint8_t txBuf[IOLINUX_TX_BATCH_MAX * STREAM_FRAMING_COBS_MAX_LENGTH(THERMIT_MSG_SIZE_MAX)];  /*COBS encoded frames*/
 } ioDeviceObject_t;
 
+typedef struct
+{
+  char devName[IOLINUX_DEVNAME_MAX];
+  streamFramingMode_t mode;
+} ioFramingConfig_t;
+
 typedef struct
 {
   bool active;
-  FILE *handle;
-  uint8_t data[THERMIT_PAYLOAD_SIZE * THERMIT_CHUNK_COUNT_MAX];
-  uint16_t size;
+  int handle;         /*file descriptor, accessed with pread/pwrite: no seeking, one syscall per chunk*/
+  uint32_t size;
+  bool isIncoming;    /*written under the part name, see IOLINUX_PART_SUFFIX*/
+  char fileName[THERMIT_FILENAME_MAX + 1];
 } ioFileObject_t;
 
 static ioDeviceObject_t communicationDevices[IOLINUX_DEVICES_MAX];
+static ioFramingConfig_t framingConfig[IOLINUX_DEVICES_MAX];
 static ioFileObject_t storageFiles[IOLINUX_FILES_MAX];
 
 
@@ -81,6 +136,26 @@ static int dbgPrintf(const char *restrict format, ...)
 }
 
 
+/*runs at program startup, before any instance copies the interface*/
+static void selectAcceleratedImplementation(void)
+{
+  if (crc16ClmulIsSupported())
+  {
+    ioLinuxTargetIf.sysCrc16 = crc16Clmul;
+  }
+
+  if (crc32cSse42IsSupported())
+  {
+    ioLinuxTargetIf.sysCrc32c = crc32cSse42;
+  }
+
+  if (gf256Ssse3IsSupported())
+  {
+    ioLinuxTargetIf.sysGf256MulAdd = gf256MulAddSsse3;
+  }
+}
+
+
 static uint32_t millis(uint32_t *max)
 {
     uint32_t ret = 0;
@@ -101,6 +176,11 @@ static void initDevices()
   static bool initialized = false;
   int i;
 
+  if (initialized)
+  {
+    return;
+  }
+
   for (i = 0; i < IOLINUX_DEVICES_MAX; i++)
   {
     communicationDevices[i].active = false;
@@ -113,6 +193,11 @@ static void initFiles()
   static bool initialized = false;
   int i;
 
+  if (initialized)
+  {
+    return;
+  }
+
   for (i = 0; i < IOLINUX_FILES_MAX; i++)
   {
     storageFiles[i].active = false;
@@ -154,7 +239,7 @@ static int reserveFile()
 
 static bool deviceSlotIsValid(thermitIoSlot_t slot)
 {
-  if ((slot >= 0) && (slot < IOLINUX_FILES_MAX))
+  if ((slot >= 0) && (slot < IOLINUX_DEVICES_MAX))
   {
     return true;
   }
@@ -187,6 +272,21 @@ static void releaseFile(thermitIoSlot_t slot)
   }
 }
 
+#if !IOLINUX_USE_DUMMY_FILE
+/*the name an incoming file is written under. partName has room for THERMIT_FILENAME_MAX
+  characters and the suffix.*/
+static bool partFileName(char *partName, const char *fileName)
+{
+  if (strlen(fileName) > THERMIT_FILENAME_MAX)
+  {
+    return false;
+  }
+  strcpy(partName, fileName);
+  strcat(partName, IOLINUX_PART_SUFFIX);
+  return true;
+}
+#endif
+
 static bool ioFileAvailableForSending(uint8_t *fileNamePtr, uint16_t *sizePtr)
 {
   bool ret = false;
@@ -272,6 +372,73 @@ static void set_blocking(int fd, int should_block)
     error_message("error %d setting term attributes", errno);
 }
 
+/*select the framing used on a device. Must be called before the device is opened.*/
+bool ioLinuxSetFramingMode(const char *devName, streamFramingMode_t mode)
+{
+  int i;
+
+  if ((devName == NULL) || (strlen(devName) >= IOLINUX_DEVNAME_MAX))
+  {
+    return false;
+  }
+
+  for (i = 0; i < IOLINUX_DEVICES_MAX; i++)
+  {
+    if ((framingConfig[i].devName[0] == 0) || (strcmp(framingConfig[i].devName, devName) == 0))
+    {
+      strcpy(framingConfig[i].devName, devName);
+      framingConfig[i].mode = mode;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*compression dictionary, loaded before the instance is created*/
+static uint8_t dictionaryBuf[LZ_DICTIONARY_SIZE_MAX];
+static uint16_t dictionaryLen = 0;
+
+bool ioLinuxLoadDictionary(const char *fileName)
+{
+  bool ret = false;
+  int f;
+
+  if ((fileName != NULL) && ((f = open(fileName, O_RDONLY)) >= 0))
+  {
+    ssize_t len = read(f, dictionaryBuf, sizeof(dictionaryBuf));
+
+    if (len > 0)
+    {
+      dictionaryLen = (uint16_t)len;
+      ret = true;
+    }
+    close(f);
+  }
+  return ret;
+}
+
+static const uint8_t *ioDictionary(uint16_t *len)
+{
+  *len = dictionaryLen;
+  return ((dictionaryLen > 0) ? dictionaryBuf : NULL);
+}
+
+static streamFramingMode_t configuredFramingMode(const char *devName)
+{
+  int i;
+
+  for (i = 0; i < IOLINUX_DEVICES_MAX; i++)
+  {
+    if (strcmp(framingConfig[i].devName, devName) == 0)
+    {
+      return framingConfig[i].mode;
+    }
+  }
+
+  return STREAM_FRAMING_MODE_START_STOP;
+}
+
 static thermitIoSlot_t ioDeviceOpen(uint8_t *devName, thermitIoMode_t mode)
 {
   thermitIoSlot_t ret = -1;
@@ -291,9 +458,9 @@ static thermitIoSlot_t ioDeviceOpen(uint8_t *devName, thermitIoMode_t mode)
   {
     if (devName != NULL)
     {
-      int fd = open(devName, O_RDWR | O_NOCTTY | O_SYNC);
-      uint8_t tmpByte;
+      int fd = open(devName, O_RDWR | O_NOCTTY);
       uint32_t bytesFlushed=0;
+      ssize_t readBytes;
 
       if (fd >= 0)
       {
@@ -301,12 +468,17 @@ static thermitIoSlot_t ioDeviceOpen(uint8_t *devName, thermitIoMode_t mode)
         set_blocking(fd, 0);                  // set no blocking
 
         communicationDevices[slot].handle = fd;
+        communicationDevices[slot].rxHead = 0;
+        communicationDevices[slot].rxCount = 0;
+        streamFramingInitialize(&(communicationDevices[slot].frame));
+        streamFramingConfigure(&(communicationDevices[slot].frame), configuredFramingMode((const char *)devName), THERMIT_MSG_SIZE_MAX);
 
-        dbgPrintf("device '%s' opened\r\n", devName);
+        dbgPrintf("device '%s' opened, %s framing\r\n", devName,
+          (communicationDevices[slot].frame.mode == STREAM_FRAMING_MODE_COBS ? "COBS" : "start/stop"));
 
         /*flush*/
-        while(read(fd, &tmpByte, sizeof(tmpByte)) == 1)
-          bytesFlushed++; /*drop*/
+        while((readBytes = read(fd, communicationDevices[slot].rxBuf, IOLINUX_RX_BUFFER_SIZE)) > 0)
+          bytesFlushed += readBytes; /*drop*/
 
         dbgPrintf("flushed %ld bytes\r\n", bytesFlushed);
 
@@ -336,6 +508,70 @@ static int ioDeviceClose(thermitIoSlot_t slot)
   return ret;
 }
 
+/*fill the free space of the receive ring with a single read() call*/
+static int rxRingFill(ioDeviceObject_t *dev)
+{
+  int ret = 0;
+  uint16_t tail, space;
+  ssize_t readBytes;
+
+  if (dev->rxCount == 0)
+  {
+    /*empty: start from the beginning to get the largest possible read*/
+    dev->rxHead = 0;
+  }
+
+  tail = (dev->rxHead + dev->rxCount) % IOLINUX_RX_BUFFER_SIZE;
+  space = IOLINUX_RX_BUFFER_SIZE - dev->rxCount;
+
+  /*contiguous free space only, the rest is filled on next call after wrap-around*/
+  if (space > IOLINUX_RX_BUFFER_SIZE - tail)
+  {
+    space = IOLINUX_RX_BUFFER_SIZE - tail;
+  }
+
+  if (space > 0)
+  {
+    readBytes = read(dev->handle, &(dev->rxBuf[tail]), space);
+
+    if (readBytes > 0)
+    {
+      dev->rxCount += (uint16_t)readBytes;
+      ret = (int)readBytes;
+    }
+  }
+
+  return ret;
+}
+
+/*feed buffered bytes to the framing until a frame is complete or the ring is empty*/
+static void rxRingFeed(ioDeviceObject_t *dev, streamFraming_t *frame)
+{
+  /*bytes of a failed frame may still be waiting for a rescan*/
+  (void)streamFramingFeed(frame, NULL, 0);
+
+  while ((dev->rxCount > 0) && (frame->isReady == false))
+  {
+    uint16_t contiguous = IOLINUX_RX_BUFFER_SIZE - dev->rxHead;
+    uint16_t consumed;
+
+    if (contiguous > dev->rxCount)
+    {
+      contiguous = dev->rxCount;
+    }
+
+    consumed = streamFramingFeed(frame, &(dev->rxBuf[dev->rxHead]), contiguous);
+
+    dev->rxHead = (dev->rxHead + consumed) % IOLINUX_RX_BUFFER_SIZE;
+    dev->rxCount -= consumed;
+
+    if (consumed == 0)
+    {
+      break;  /*framing is not taking more*/
+    }
+  }
+}
+
 /*  read packet from communication device  */
 /*
   Call with:
@@ -349,52 +585,131 @@ static int ioDeviceClose(thermitIoSlot_t slot)
 */
 
 static int ioDeviceRead(thermitIoSlot_t slot, uint8_t *buf, int16_t maxLen)
+{
+  return ioDeviceReadChecked(slot, buf, maxLen, NULL);
+}
+
+/*  read packet and its CRC check result from communication device  */
+/*
+  As ioDeviceRead, but the CRC calculated by the stream framing while
+  receiving is reported in 'check', so the protocol can skip its own pass.
+*/
+static int ioDeviceReadChecked(thermitIoSlot_t slot, uint8_t *buf, int16_t maxLen, thermitFrameCheck_t *check)
 {
   int16_t ret = -1;
-  uint8_t tmpByte;
-  uint8_t tmpBuf[128];
-  static streamFraming_t frameStorage[IOLINUX_DEVICES_MAX];
-  static bool initialized = false;
 
-  /*first call to ioDeviceRead initializes the frames for each instance*/
-  if (!initialized)
+  if (check)
   {
-    int i;
-    for(i=0; i<IOLINUX_DEVICES_MAX; i++)
-    {
-      streamFramingInitialize(&frameStorage[i]);
-    }
-    initialized = true;
+    *check = THERMIT_FRAME_UNCHECKED;
   }
 
   if (deviceSlotIsValid(slot))
   {
-    int fd = communicationDevices[slot].handle;
-    streamFraming_t *frame = &(frameStorage[slot]);
+    ioDeviceObject_t *dev = &(communicationDevices[slot]);
+    streamFraming_t *frame = &(dev->frame);
 
     /*the serial port should be fine*/
     ret = 0;
 
-    /*check if something is coming in and collect all received bytes until a frame end is found*/
-    while ((frame->isReady == false) && (read(fd, &tmpByte, sizeof(tmpByte)) == 1))
+    /*parse what is left from the previous call first. Read more from the device only
+      when the ring runs empty without a complete frame. Bytes following the frame
+      stay in the ring for the next call.*/
+    rxRingFeed(dev, frame);
+
+    while ((frame->isReady == false) && (rxRingFill(dev) > 0))
     {
-      streamFramingFollow(frame, tmpByte);
+      rxRingFeed(dev, frame);
+    }
 
-      if (frame->isReady && (frame->len <= maxLen))
+    if (frame->isReady)
+    {
+      if (frame->len <= maxLen)
       {
         memcpy(buf, frame->buf, frame->len);
         ret = (int16_t)frame->len;
 
-        streamFramingInitialize(frame);
-
-        break; /*done. jump out of the loop*/
+        if (check)
+        {
+          switch (frame->check)
+          {
+          case STREAM_FRAMING_CHECK_CRC16_OK:
+            *check = THERMIT_FRAME_CRC16_OK;
+            break;
+          case STREAM_FRAMING_CHECK_CRC32C_OK:
+            *check = THERMIT_FRAME_CRC32C_OK;
+            break;
+          default:
+            *check = THERMIT_FRAME_CHECK_FAILED;
+            break;
+          }
+        }
       }
+
+      streamFramingRestart(frame);
     }
   }
 
   return ret;
 }
 
+static uint8_t startSequence[2] = {START_CHAR, START_CHAR};
+static uint8_t stopSequence[2] = {STOP_CHAR, STOP_CHAR};
+
+/*write all the given vectors, continuing after partial writes*/
+static int writeAll(int fd, struct iovec *iov, int iovCount)
+{
+  while (iovCount > 0)
+  {
+    ssize_t sentBytes = writev(fd, iov, iovCount);
+
+    if (sentBytes < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      else if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      {
+        /*output buffer is full: wait until the device takes more*/
+        struct pollfd pfd = {fd, POLLOUT, 0};
+
+        if (poll(&pfd, 1, IOLINUX_TX_TIMEOUT_MS) <= 0)
+        {
+          return -1;
+        }
+        continue;
+      }
+      return -1; /*other errors are fatal*/
+    }
+
+    /*skip the vectors that were completely sent and adjust the partially sent one*/
+    while ((iovCount > 0) && ((size_t)sentBytes >= iov->iov_len))
+    {
+      sentBytes -= iov->iov_len;
+      iov++;
+      iovCount--;
+    }
+
+    if (iovCount > 0)
+    {
+      iov->iov_base = (uint8_t *)iov->iov_base + sentBytes;
+      iov->iov_len -= sentBytes;
+    }
+  }
+
+  return 0;
+}
+
+static void framedVector(struct iovec *iov, uint8_t *buf, int16_t len)
+{
+  iov[0].iov_base = startSequence;
+  iov[0].iov_len = sizeof(startSequence);
+  iov[1].iov_base = buf;
+  iov[1].iov_len = len;
+  iov[2].iov_base = stopSequence;
+  iov[2].iov_len = sizeof(stopSequence);
+}
+
 /*  send packet to communication device  */
 /*
   Call with:
@@ -408,33 +723,99 @@ static int ioDeviceRead(thermitIoSlot_t slot, uint8_t *buf, int16_t maxLen)
 static int ioDeviceWrite(thermitIoSlot_t slot, uint8_t *buf, int16_t len)
 {
   int ret = -1;
-  uint8_t startSequence[2] = {START_CHAR, START_CHAR};
-  uint8_t stopSequence[2] = {STOP_CHAR, STOP_CHAR};
 
-  if (deviceSlotIsValid(slot))
+  if (deviceSlotIsValid(slot) && (len >= 0) && (len <= THERMIT_MSG_SIZE_MAX))
+  {
+    ioDeviceObject_t *dev = &(communicationDevices[slot]);
+    struct iovec iov[3];
+
+    if (dev->frame.mode == STREAM_FRAMING_MODE_COBS)
+    {
+      iov[0].iov_base = dev->txBuf;
+      iov[0].iov_len = streamFramingCobsEncode(buf, len, dev->txBuf);
+      ret = writeAll(dev->handle, iov, 1);
+    }
+    else
+    {
+      /*start sequence, frame and stop sequence in one system call*/
+      framedVector(iov, buf, len);
+      ret = writeAll(dev->handle, iov, 3);
+    }
+  }
+  return ret;
+}
+
+/*  send several packets to communication device  */
+/*
+  Call with:
+    bufs   - pointers to the packets
+    lens   - length of each packet
+    count  - number of packets
+  Returns:
+    0 on success
+    -1 on failure
+*/
+static int ioDeviceWriteBatch(thermitIoSlot_t slot, uint8_t **bufs, int16_t *lens, uint16_t count)
+{
+  int ret = -1;
+
+  if (deviceSlotIsValid(slot) && bufs && lens)
   {
-    int fd = communicationDevices[slot].handle;
+    ioDeviceObject_t *dev = &(communicationDevices[slot]);
+    struct iovec iov[3 * IOLINUX_TX_BATCH_MAX];
+    uint16_t i = 0;
+
+    ret = 0;
 
-    if (write(fd, startSequence, sizeof(startSequence)) == sizeof(startSequence))
+    while ((ret == 0) && (i < count))
     {
-      int max = 10; /*used to stop the loop if sending fails*/
+      int iovCount = 0;
+      uint16_t encodedLen = 0;
+      uint16_t frames;
 
-      while (len > 0)
+      for (frames = 0; (frames < IOLINUX_TX_BATCH_MAX) && (i < count); frames++, i++)
       {
-        int sentBytes = write(fd, buf, len);
+        if ((lens[i] < 0) || (lens[i] > THERMIT_MSG_SIZE_MAX))
+        {
+          return -1;
+        }
 
-        if (sentBytes < 0 || --max < 1) /* Errors are fatal */
+        if (dev->frame.mode == STREAM_FRAMING_MODE_COBS)
         {
-          return (-1);
+          /*encoded frames are collected back to back into one vector*/
+          encodedLen += streamFramingCobsEncode(bufs[i], lens[i], &(dev->txBuf[encodedLen]));
+          iov[0].iov_base = dev->txBuf;
+          iov[0].iov_len = encodedLen;
+          iovCount = 1;
+        }
+        else
+        {
+          framedVector(&iov[iovCount], bufs[i], lens[i]);
+          iovCount += 3;
         }
-        len -= sentBytes;
-        buf += sentBytes;
       }
 
-      if (write(fd, stopSequence, sizeof(stopSequence)) == sizeof(stopSequence))
-      {
-        ret = 0;
-      }
+      ret = writeAll(dev->handle, iov, iovCount);
+    }
+  }
+  return ret;
+}
+
+/*  bytes written to the device but not sent yet  */
+/*
+  Returns the number of bytes in the output queue, or -1 if unknown.
+*/
+static int ioDeviceTxPending(thermitIoSlot_t slot)
+{
+  int ret = -1;
+
+  if (deviceSlotIsValid(slot))
+  {
+    int pending;
+
+    if (ioctl(communicationDevices[slot].handle, TIOCOUTQ, &pending) == 0)
+    {
+      ret = pending;
     }
   }
   return ret;
@@ -453,7 +834,7 @@ static int ioDeviceWrite(thermitIoSlot_t slot, uint8_t *buf, int16_t len)
     0 on success.
     -1 on failure    
 */
-static thermitIoSlot_t ioFileOpen(uint8_t *fileName, thermitIoMode_t mode, uint16_t *fileSize)
+static thermitIoSlot_t ioFileOpen32(uint8_t *fileName, thermitIoMode_t mode, uint32_t *fileSize)
 {
   thermitIoSlot_t ret = -1;
 
@@ -468,35 +849,29 @@ static thermitIoSlot_t ioFileOpen(uint8_t *fileName, thermitIoMode_t mode, uint1
 
     if (fileSlotIsValid(slot))
     {
-      FILE *f;
+      int f = -1;
       switch (mode)
       {
         case THERMIT_READ: /* Read */
 #if IOLINUX_USE_DUMMY_FILE
-          { //for scope of the local variable
-            uint16_t b;
-
-            f = NULL;
-            *fileSize = 345;
-
-            for(b = 0; b < *fileSize; b++)
-            {
-              storageFiles[slot].data[b] = b / 60;
-            }
-            ret = 0;
-          }
+          /*content is generated in ioFileRead32()*/
+          *fileSize = 345;
+          ret = 0;
 #else
-          if (f = fopen(fileName, "rb"))
+          if ((f = open(fileName, O_RDONLY)) >= 0)
           {
-            int32_t size;
-            ret = 0;
+            struct stat st;
 
             /*find out the file size*/
-            fseek(f, 0, SEEK_END);
-            size = ftell(f);
-            fseek(f, 0, SEEK_SET);
-
-            *fileSize = (uint16_t)(size & 0xFFFF);
+            if ((fstat(f, &st) == 0) && (st.st_size <= 0xFFFFFFFF))
+            {
+              *fileSize = (uint32_t)st.st_size;
+              ret = 0;
+            }
+            else
+            {
+              close(f);
+            }
           }
 #endif
           break;
@@ -504,37 +879,28 @@ static thermitIoSlot_t ioFileOpen(uint8_t *fileName, thermitIoMode_t mode, uint1
         case THERMIT_WRITE: /* Write (create) */
 
 #if IOLINUX_USE_DUMMY_FILE
-          f = NULL;
           ret = 0;
 #else
-          if (f = fopen(fileName, "wb"))
-          {
-            int result;
-            ret = 0;
-
-            result = fseek(f, (long)(*fileSize-1), SEEK_SET);
-            if (result == -1) 
-            {
-              fclose(f);
-              dbgPrintf("file stretching failed: seek");
-              ret = -1;
-            }
+        {
+          char partName[THERMIT_FILENAME_MAX + sizeof(IOLINUX_PART_SUFFIX)];
 
-            result = fwrite("", 1, 1, f);
-            if (result < 0) 
+          /*the old copy stays in place, readable through ioFileOpenPrevious(), until
+            the new one is complete. The new one is read back for its hash check.*/
+          if (partFileName(partName, (const char *)fileName) && ((f = open(partName, O_RDWR | O_CREAT | O_TRUNC, 0644)) >= 0))
+          {
+            /*reserve the final size at once*/
+            if (ftruncate(f, (off_t)*fileSize) == 0)
             {
-              fclose(f);
-              dbgPrintf("file stretching failed: write");
-              ret = -1;
+              ret = 0;
             }
-            result = fseek(f, 0, SEEK_SET);
-            if (result == -1) 
+            else
             {
-              fclose(f);
-              dbgPrintf("file stretching failed: rewind");
-              ret = -1;
+              close(f);
+              (void)unlink(partName);
+              dbgPrintf("file stretching failed: %s\r\n", strerror(errno));
             }
           }
+        }
 #endif
           break;
 
@@ -547,6 +913,9 @@ static thermitIoSlot_t ioFileOpen(uint8_t *fileName, thermitIoMode_t mode, uint1
       {
         storageFiles[slot].handle = f;
         storageFiles[slot].size = *fileSize;
+        storageFiles[slot].isIncoming = (mode == THERMIT_WRITE);
+        strncpy(storageFiles[slot].fileName, (const char *)fileName, THERMIT_FILENAME_MAX);
+        storageFiles[slot].fileName[THERMIT_FILENAME_MAX] = '\0';
         ret = (thermitIoSlot_t)slot;
       }    
       else
@@ -561,38 +930,99 @@ static thermitIoSlot_t ioFileOpen(uint8_t *fileName, thermitIoMode_t mode, uint1
   return ret;
 }
 
-static int ioFileRead(thermitIoSlot_t slot, uint16_t offset, uint8_t *buf, int16_t maxLen)
+/*  open the existing copy of an incoming file  */
+/*
+  Call with:
+    fileName  - Pointer to filename.
+    fileSize  - returns the size of the existing copy.
+  Returns:
+    slot on success, read with ioFileRead32().
+    -1 if there is no such file.
+*/
+static thermitIoSlot_t ioFileOpenPrevious(uint8_t *fileName, uint32_t *fileSize)
+{
+  thermitIoSlot_t ret = -1;
+
+  initFiles();
+
+  if(fileName && fileSize)
+  {
+    int slot;
+    slot = reserveFile();
+
+    if (fileSlotIsValid(slot))
+    {
+      int f = -1;
+
+#if IOLINUX_USE_DUMMY_FILE
+      /*the same generated content as the files read for sending*/
+      *fileSize = 345;
+      ret = 0;
+#else
+      if ((f = open(fileName, O_RDONLY)) >= 0)
+      {
+        struct stat st;
+
+        if ((fstat(f, &st) == 0) && (st.st_size <= 0xFFFFFFFF))
+        {
+          *fileSize = (uint32_t)st.st_size;
+          ret = 0;
+        }
+        else
+        {
+          close(f);
+        }
+      }
+#endif
+
+      if(ret == 0)
+      {
+        storageFiles[slot].handle = f;
+        storageFiles[slot].size = *fileSize;
+        storageFiles[slot].isIncoming = false;
+        ret = (thermitIoSlot_t)slot;
+      }
+      else
+      {
+        releaseFile(slot);
+      }
+    }
+  }
+
+  dbgPrintf("***fileOpenPrevious(%s) -> return=%d\r\n", fileName, ret);
+
+  return ret;
+}
+
+static int ioFileRead32(thermitIoSlot_t slot, uint32_t offset, uint8_t *buf, int16_t maxLen)
 {
   int ret = -1;
 
-  if (fileSlotIsValid(slot))
+  if (fileSlotIsValid(slot) && (maxLen >= 0))
   {
 #if IOLINUX_USE_DUMMY_FILE
-    uint16_t i;
+    int16_t i;
     int readBytes = 0;
 
     for(i = 0; i < maxLen; i++)
     {
-      uint16_t bIdx = offset + i;
+      uint32_t bIdx = offset + i;
 
       if(bIdx >= storageFiles[slot].size)
         break;
 
-      *(buf++) = storageFiles[slot].data[bIdx];
+      *(buf++) = (uint8_t)(bIdx / 60);
       readBytes++;
     }
 
     ret = readBytes;
 #else
-    FILE *f = storageFiles[slot].handle;
+    ssize_t readBytes = pread(storageFiles[slot].handle, buf, (size_t)maxLen, (off_t)offset);
 
-    if (fseek(f, offset, SEEK_SET) >= 0)
+    /*0 at the end of the file*/
+    if (readBytes >= 0)
     {
-      size_t readBytes = fread(buf, 1, maxLen, f);
-      if (readBytes > 0)
-      {
-        ret = (int)readBytes;
-      }
+      ret = (int)readBytes;
     }
 #endif
   }
@@ -600,31 +1030,97 @@ static int ioFileRead(thermitIoSlot_t slot, uint16_t offset, uint8_t *buf, int16
   return ret;
 }
 
+static int ioFileWrite32(thermitIoSlot_t slot, uint32_t offset, uint8_t *buf, int16_t len)
+{
+  int ret = -1;
+
+  if (fileSlotIsValid(slot) && (len >= 0))
+  {
+#if IOLINUX_USE_DUMMY_FILE
+    /*going to dev/null*/
+    ret = 0;
+#else
+    if (pwrite(storageFiles[slot].handle, buf, (size_t)len, (off_t)offset) == len)
+    {
+      ret = 0;
+    }
+#endif
+  }
+
+  return ret;
+}
+
+/*16 bit versions for the targets without large file support*/
+static thermitIoSlot_t ioFileOpen(uint8_t *fileName, thermitIoMode_t mode, uint16_t *fileSize)
+{
+  thermitIoSlot_t ret = -1;
+
+  if(fileSize)
+  {
+    uint32_t size = *fileSize;
+
+    ret = ioFileOpen32(fileName, mode, &size);
+    if((ret >= 0) && (size > 0xFFFF))
+    {
+      /*the offsets of these callbacks cannot reach the end of the file*/
+      (void)ioFileClose(ret);
+      ret = -1;
+    }
+    *fileSize = (uint16_t)(size & 0xFFFF);
+  }
+  return ret;
+}
+
+static int ioFileRead(thermitIoSlot_t slot, uint16_t offset, uint8_t *buf, int16_t maxLen)
+{
+  return ioFileRead32(slot, offset, buf, maxLen);
+}
+
 static int ioFileWrite(thermitIoSlot_t slot, uint16_t offset, uint8_t *buf, int16_t len)
+{
+  return ioFileWrite32(slot, offset, buf, len);
+}
+
+static int ioFileClose(thermitIoSlot_t slot)
 {
   int ret = -1;
 
   if (fileSlotIsValid(slot))
   {
 #if IOLINUX_USE_DUMMY_FILE
-    /*going to dev/null*/
+    releaseFile(slot);
     ret = 0;
 #else
-    FILE *f = storageFiles[slot].handle;
-    if (fseek(f, offset, SEEK_SET) >= 0)
+    ret = 0;
+    if (close(storageFiles[slot].handle) != 0)
     {
-      if (fwrite(buf, 1, len, f) == len)
+      ret = -1;
+    }
+
+    /*the incoming file is complete: it takes the place of the old copy*/
+    if (storageFiles[slot].isIncoming)
+    {
+      char partName[THERMIT_FILENAME_MAX + sizeof(IOLINUX_PART_SUFFIX)];
+
+      if (!partFileName(partName, storageFiles[slot].fileName) || (ret != 0) ||
+          (rename(partName, storageFiles[slot].fileName) != 0))
       {
-        ret = 0;
+        dbgPrintf("renaming '%s' failed: %s\r\n", partName, strerror(errno));
+        ret = -1;
       }
     }
+    releaseFile(slot);
 #endif
   }
 
+  dbgPrintf("***fileClose(%d) -> return=%d\r\n", slot, ret);
+
   return ret;
 }
 
-static int ioFileClose(thermitIoSlot_t slot)
+/*an incoming file that will not be completed: the part written so far is removed, the
+  old copy stays as it was*/
+static int ioFileDiscard(thermitIoSlot_t slot)
 {
   int ret = -1;
 
@@ -634,13 +1130,22 @@ static int ioFileClose(thermitIoSlot_t slot)
     releaseFile(slot);
     ret = 0;
 #else
-    fclose(storageFiles[slot].handle);
+    close(storageFiles[slot].handle);
+    if (storageFiles[slot].isIncoming)
+    {
+      char partName[THERMIT_FILENAME_MAX + sizeof(IOLINUX_PART_SUFFIX)];
+
+      if (partFileName(partName, storageFiles[slot].fileName))
+      {
+        (void)unlink(partName);
+      }
+    }
     releaseFile(slot);
     ret = 0;
 #endif
   }
 
-  dbgPrintf("***fileClose(%d) -> return=%d\r\n", slot, ret);
+  dbgPrintf("***fileDiscard(%d) -> return=%d\r\n", slot, ret);
 
   return ret;
 }
@@ -1,6 +1,11 @@
 #ifndef __IOLINUX_H__
 #define __IOLINUX_H__
 
+#include "streamFraming.h"
+
 extern thermitTargetAdaptationInterface_t ioLinuxTargetIf;
 
+bool ioLinuxSetFramingMode(const char *devName, streamFramingMode_t mode);
+bool ioLinuxLoadDictionary(const char *fileName);
+
 #endif  //__IOLINUX_H__
\ No newline at end of file
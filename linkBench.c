@@ -0,0 +1,1107 @@
+/*
+linkBench: two thermit instances talking over a simulated link, not part of the library.
+
+The master sends files to the slave through two in-memory frame queues, one per
+direction. The link can lose frames and delay them. Without a delay the other
+end reads a frame in the same step it was sent. Both ends run on the virtual clock of ioDummy, which moves
+LINK_BENCH_STEP_MS for every step of the two instances, so the results do not
+depend on the speed of the machine.
+
+The content of every received file is checked. The exit code is nonzero when
+a file is broken or a scenario does not finish.
+
+Needs THERMIT_INSTANCES_MAX of 2. The scenario is given as the first argument,
+all of them are run without one:
+ - burst: goodput on a clean link. THERMIT_BURST_LENGTH_MAX is chosen at build
+   time, so "make bench" builds and runs this once per burst length.
+ - loss: goodput and the adapted burst length over a sweep of loss rates.
+ - large: one 16 MB file in large file mode, through the 32 bit file callbacks,
+   on a clean link and with 2% loss.
+ - small: files per second for 1 kB files. THERMIT_TRANSFER_SLOTS is chosen at
+   build time, "make bench" runs this with 1 and with the default slots.
+ - timers: checks of the retransmission timer, the tail loss probe and the
+   keep-alive, on the virtual clock.
+ - latency: completion time percentiles of small files offered one by one on a
+   lossy link. "make bench" runs this also with the tail loss probe disabled
+   by a THERMIT_PROBE_MIN_MS above the longest timeout.
+ - fec: goodput over a sweep of loss rates, on a link without delay and with
+   100 ms each way. "make bench" runs this with and without THERMIT_FEC_GROUP.
+ - delta: bytes on the wire when the slave has an old copy of the file with 1%
+   of it edited, and a block taken from the old copy that is not the one signed.
+   Needs THERMIT_DELTA, "make bench" builds it for this.
+ - compression: bytes on the wire and goodput for files of telemetry records in
+   text, which compress, and for the usual pattern, which does not, without and
+   with a limit of bytes per step on the link. "make bench" builds it with
+   THERMIT_COMPRESSION of THERMIT_CODEC_LZ for this.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "crc.h"
+#include "thermit.h"
+#include "ioDummy.h"
+
+#define LINK_BENCH_STEP_MS          10      /*virtual time per step of both ends*/
+#define LINK_BENCH_PIPE_FRAMES      4096    /*frames in flight per direction, more are dropped*/
+#define LINK_BENCH_SINKS            16      /*incoming files open at the same time*/
+#define LINK_BENCH_READ_SLOT        1000    /*file slots of the outgoing files start here*/
+#define LINK_BENCH_PREVIOUS_SLOT    2000    /*file slots of the old copies on the slave start here*/
+#define LINK_BENCH_LATENCY_FILES    1000    /*files with a recorded completion time*/
+#define LINK_BENCH_TEXT_SIZE        4096    /*the text content repeats after this*/
+
+typedef struct
+{
+  uint8_t buf[THERMIT_MSG_SIZE_MAX];
+  int16_t len;
+  uint32_t dueMs;           /*delivered from this time on*/
+} linkFrame_t;
+
+typedef struct
+{
+  linkFrame_t frames[LINK_BENCH_PIPE_FRAMES];
+  uint32_t head;            /*next frame to deliver*/
+  uint32_t tail;            /*next free place*/
+} linkPipe_t;
+
+typedef struct
+{
+  uint32_t lossPerMille;    /*frames lost at random*/
+  bool down;                /*every frame is lost*/
+  int32_t dropChunk;        /*the first data frame of this chunk from the master is lost, -1: none*/
+  uint32_t dropFeedback;    /*frames of the slave lost after that chunk*/
+  uint32_t delayMs;         /*one way delay. The sync frames are repeated every step,
+                              so the delay is switched on after the sync.*/
+  uint32_t bytesPerStep;    /*0: no limit, else the frames queue behind each other at this rate*/
+} linkConditions_t;
+
+typedef struct
+{
+  uint32_t fileSize;
+  uint32_t filesToSend;
+  uint32_t filesOffered;
+  uint32_t filesReceived;
+  uint32_t filesBroken;
+  uint32_t bytesReceived;
+  uint32_t offerGapMs;      /*time between the files offered, 0: all at once*/
+  uint32_t nextOfferMs;
+  uint32_t offeredMs[LINK_BENCH_LATENCY_FILES];
+  uint32_t latencyMs[LINK_BENCH_LATENCY_FILES];   /*from offered to received, in the order received*/
+  uint32_t latencyCount;
+} linkFiles_t;
+
+typedef struct
+{
+  uint8_t *buf;             /*NULL: free*/
+  uint32_t size;
+  uint32_t fileNo;
+} linkSink_t;
+
+typedef struct
+{
+  uint32_t editOffset;      /*the old copy differs from the file in these bytes*/
+  uint32_t editLength;      /*0: the slave has no old copies*/
+  bool changes;             /*the old copy changes after its first block has been matched*/
+  uint32_t readsAtStart;    /*reads of the old copies from offset 0*/
+  uint32_t filesDiscarded;
+} linkPrevious_t;
+
+static linkPipe_t pipes[2];             /*indexed by the sending end: 0 master, 1 slave*/
+static linkConditions_t conditions;
+static linkFiles_t files;
+static linkSink_t sinks[LINK_BENCH_SINKS];
+static uint32_t randomState = 1;
+static linkPrevious_t previous;
+static uint8_t text[LINK_BENCH_TEXT_SIZE];
+static bool textContent = false;        /*the files are text records instead of the pattern*/
+static uint32_t framesSent = 0;
+static uint32_t bytesSent[2];           /*by each end, the frames lost on the link included*/
+static uint32_t lineBytes[2];           /*the line of each end is busy until this many bytes have gone at bytesPerStep*/
+static uint32_t lastWriteMs[2];         /*latest frame sent by each end*/
+static uint32_t lastReadMs[2];          /*latest frame received by each end*/
+static uint32_t feedbackToDrop = 0;
+static thermitDiagnostics_t masterDiagnostics;    /*after the latest step*/
+static thermitDiagnostics_t slaveDiagnostics;
+
+
+static uint32_t nowMs(void)
+{
+  return ioDummyTargetIf.sysGetMs(NULL);
+}
+
+static void linkConditionsClear(void)
+{
+  memset(&conditions, 0, sizeof(conditions));
+  conditions.dropChunk = -1;
+}
+
+static uint32_t linkRandom(void)
+{
+  randomState = randomState * 1103515245 + 12345;
+  return (randomState >> 16) & 0x7FFF;
+}
+
+/*content of byte offset of the file fileNo*/
+static uint8_t filePattern(uint32_t fileNo, uint32_t offset)
+{
+  if(textContent)
+  {
+    return text[(offset + fileNo * 41) % LINK_BENCH_TEXT_SIZE];
+  }
+  return (uint8_t)(offset * 7 + offset / 251 + fileNo);
+}
+
+/*telemetry records as a logger would write them, one line per second, most channels idle*/
+static void textInit(void)
+{
+  char line[128];
+  unsigned len = 0;
+  unsigned i;
+
+  for(i = 0; len < LINK_BENCH_TEXT_SIZE; i++)
+  {
+    int n = snprintf(line, sizeof(line), "12:%02u:%02u,%u.%u,0,0,0,0,%u,0,0,0,0,1013,0,0,0,0,ok\n",
+                     (i / 60) % 60, i % 60, 20 + (i * 7) % 3, (i * 3) % 10, 40 + (i * 5) % 7);
+    int k;
+
+    for(k = 0; (k < n) && (len < LINK_BENCH_TEXT_SIZE); k++)
+    {
+      text[len++] = (uint8_t)line[k];
+    }
+  }
+}
+
+/*content of byte offset of the old copy of the file fileNo*/
+static uint8_t previousPattern(uint32_t fileNo, uint32_t offset)
+{
+  bool edited = ((offset >= previous.editOffset) && (offset - previous.editOffset < previous.editLength));
+
+  return (uint8_t)(filePattern(fileNo, offset) ^ (edited ? 0x5A : 0));
+}
+
+static uint32_t fileNumber(const uint8_t *fileName)
+{
+  return (uint32_t)strtoul((const char *)fileName + 1, NULL, 10);
+}
+
+
+/*devices: the slot is the end, 0 for the master and 1 for the slave*/
+static thermitIoSlot_t linkOpen(uint8_t *devName, thermitIoMode_t mode)
+{
+  (void)mode;
+  return ((devName[0] == 'm') ? 0 : 1);
+}
+
+static int linkClose(thermitIoSlot_t slot)
+{
+  (void)slot;
+  return 0;
+}
+
+static int linkRead(thermitIoSlot_t slot, uint8_t *buf, int16_t maxLen)
+{
+  linkPipe_t *pipe = &pipes[1 - slot];
+  int ret = 0;
+
+  if((pipe->head != pipe->tail) && (pipe->frames[pipe->head % LINK_BENCH_PIPE_FRAMES].dueMs <= nowMs()))
+  {
+    linkFrame_t *frame = &(pipe->frames[pipe->head % LINK_BENCH_PIPE_FRAMES]);
+
+    ret = ((frame->len < maxLen) ? frame->len : maxLen);
+    memcpy(buf, frame->buf, ret);
+    pipe->head++;
+    lastReadMs[slot] = nowMs();
+  }
+  return ret;
+}
+
+static int linkWrite(thermitIoSlot_t slot, uint8_t *buf, int16_t len)
+{
+  linkPipe_t *pipe = &pipes[slot];
+  bool lost = (conditions.down || ((linkRandom() % 1000) < conditions.lossPerMille));
+
+  if((slot == 0) && (conditions.dropChunk >= 0) && (buf[THERMIT_FCODE_OFFSET] == THERMIT_FCODE_DATA_TRANSFER) &&
+     (buf[THERMIT_SND_CHUNKNO_OFFSET] == conditions.dropChunk))
+  {
+    conditions.dropChunk = -1;
+    feedbackToDrop = conditions.dropFeedback;
+    lost = true;
+  }
+  else if((slot == 1) && (feedbackToDrop > 0))
+  {
+    feedbackToDrop--;
+    lost = true;
+  }
+
+  framesSent++;
+  bytesSent[slot] += (uint32_t)len;
+  lastWriteMs[slot] = nowMs();
+  if(!lost && (pipe->tail - pipe->head < LINK_BENCH_PIPE_FRAMES))
+  {
+    linkFrame_t *frame = &(pipe->frames[pipe->tail % LINK_BENCH_PIPE_FRAMES]);
+
+    memcpy(frame->buf, buf, len);
+    frame->len = len;
+    frame->dueMs = nowMs() + conditions.delayMs;
+    if(conditions.bytesPerStep > 0)
+    {
+      uint32_t lineFree = nowMs() / LINK_BENCH_STEP_MS * conditions.bytesPerStep;
+
+      lineBytes[slot] = ((lineBytes[slot] > lineFree) ? lineBytes[slot] : lineFree) + (uint32_t)len;
+      frame->dueMs = lineBytes[slot] / conditions.bytesPerStep * LINK_BENCH_STEP_MS + conditions.delayMs;
+    }
+    pipe->tail++;
+  }
+  return 0;
+}
+
+
+/*files: the master reads the pattern, the slave writes into a sink and checks it at close*/
+static thermitIoSlot_t fileOpen32(uint8_t *fileName, thermitIoMode_t mode, uint32_t *fileSize)
+{
+  thermitIoSlot_t ret = -1;
+  int i;
+
+  if(mode == THERMIT_READ)
+  {
+    *fileSize = files.fileSize;
+    ret = LINK_BENCH_READ_SLOT + (thermitIoSlot_t)fileNumber(fileName);
+  }
+  else
+  {
+    for(i = 0; (i < LINK_BENCH_SINKS) && (ret < 0); i++)
+    {
+      if(sinks[i].buf == NULL)
+      {
+        sinks[i].buf = malloc(*fileSize ? *fileSize : 1);
+        sinks[i].size = *fileSize;
+        sinks[i].fileNo = fileNumber(fileName);
+        if(sinks[i].buf)
+        {
+          memset(sinks[i].buf, 0xEE, sinks[i].size);
+          ret = i;
+        }
+      }
+    }
+  }
+  return ret;
+}
+
+/*the master reads the files, the slave its old copies and the files it has received*/
+static int fileRead32(thermitIoSlot_t slot, uint32_t offset, uint8_t *buf, int16_t maxLen)
+{
+  int ret = 0;
+
+  if((slot >= 0) && (slot < LINK_BENCH_SINKS))
+  {
+    while((ret < maxLen) && (offset + ret < sinks[slot].size))
+    {
+      buf[ret] = sinks[slot].buf[offset + ret];
+      ret++;
+    }
+  }
+  else if(slot >= LINK_BENCH_PREVIOUS_SLOT)
+  {
+    /*the first read from the start matches the block, the next one copies it*/
+    bool changed = (previous.changes && (offset == 0) && (previous.readsAtStart++ > 0));
+
+    while((ret < maxLen) && (offset + ret < files.fileSize))
+    {
+      buf[ret] = (uint8_t)(previousPattern((uint32_t)(slot - LINK_BENCH_PREVIOUS_SLOT), offset + ret) ^ (changed ? 0xFF : 0));
+      ret++;
+    }
+  }
+  else
+  {
+    while((ret < maxLen) && (offset + ret < files.fileSize))
+    {
+      buf[ret] = filePattern((uint32_t)(slot - LINK_BENCH_READ_SLOT), offset + ret);
+      ret++;
+    }
+  }
+  return ret;
+}
+
+static int fileWrite32(thermitIoSlot_t slot, uint32_t offset, uint8_t *buf, int16_t len)
+{
+  int ret = -1;
+
+  if((slot >= 0) && (slot < LINK_BENCH_SINKS) && (offset + len <= sinks[slot].size))
+  {
+    memcpy(&(sinks[slot].buf[offset]), buf, len);
+    ret = 0;
+  }
+  return ret;
+}
+
+static int fileClose(thermitIoSlot_t slot)
+{
+  if((slot >= 0) && (slot < LINK_BENCH_SINKS))
+  {
+    linkSink_t *sink = &sinks[slot];
+    uint32_t i;
+
+    for(i = 0; i < sink->size; i++)
+    {
+      if(sink->buf[i] != filePattern(sink->fileNo, i))
+      {
+        files.filesBroken++;
+        break;
+      }
+    }
+    if((sink->fileNo < LINK_BENCH_LATENCY_FILES) && (files.latencyCount < LINK_BENCH_LATENCY_FILES))
+    {
+      files.latencyMs[files.latencyCount++] = nowMs() - files.offeredMs[sink->fileNo];
+    }
+    files.filesReceived++;
+    files.bytesReceived += sink->size;
+    free(sink->buf);
+    sink->buf = NULL;
+  }
+  return 0;
+}
+
+/*the incoming file failed its check: it is dropped without checking its content*/
+static int fileDiscard(thermitIoSlot_t slot)
+{
+  if((slot >= 0) && (slot < LINK_BENCH_SINKS))
+  {
+    free(sinks[slot].buf);
+    sinks[slot].buf = NULL;
+    previous.filesDiscarded++;
+  }
+  return 0;
+}
+
+/*the slave has an old copy of every file*/
+static thermitIoSlot_t slaveFileOpenPrevious(uint8_t *fileName, uint32_t *fileSize)
+{
+  *fileSize = files.fileSize;
+  return LINK_BENCH_PREVIOUS_SLOT + (thermitIoSlot_t)fileNumber(fileName);
+}
+
+static thermitIoSlot_t fileOpen16(uint8_t *fileName, thermitIoMode_t mode, uint16_t *fileSize)
+{
+  uint32_t size = *fileSize;
+  thermitIoSlot_t ret = fileOpen32(fileName, mode, &size);
+
+  *fileSize = (uint16_t)size;
+  return ret;
+}
+
+static int fileRead16(thermitIoSlot_t slot, uint16_t offset, uint8_t *buf, int16_t maxLen)
+{
+  return fileRead32(slot, offset, buf, maxLen);
+}
+
+static int fileWrite16(thermitIoSlot_t slot, uint16_t offset, uint8_t *buf, int16_t len)
+{
+  return fileWrite32(slot, offset, buf, len);
+}
+
+static bool masterFileAvailable(uint8_t *fileNamePtr, uint16_t *sizePtr)
+{
+  bool ret = false;
+
+  if((files.filesOffered < files.filesToSend) && (nowMs() >= files.nextOfferMs))
+  {
+    sprintf((char *)fileNamePtr, "f%lu", (unsigned long)files.filesOffered);
+    *sizePtr = (uint16_t)((files.fileSize <= 0xFFFF) ? files.fileSize : 0xFFFF);
+    if(files.filesOffered < LINK_BENCH_LATENCY_FILES)
+    {
+      files.offeredMs[files.filesOffered] = nowMs();
+    }
+    files.nextOfferMs = nowMs() + files.offerGapMs;
+    files.filesOffered++;
+    ret = true;
+  }
+  return ret;
+}
+
+static bool slaveFileAvailable(uint8_t *fileNamePtr, uint16_t *sizePtr)
+{
+  (void)fileNamePtr;
+  (void)sizePtr;
+  return false;
+}
+
+static int quietPrintf(const char *restrict format, ...)
+{
+  (void)format;
+  return 0;
+}
+
+
+static thermitTargetAdaptationInterface_t endInterface(bool isMaster)
+{
+  thermitTargetAdaptationInterface_t tgt;
+
+  memset(&tgt, 0, sizeof(tgt));
+  tgt.devOpen = linkOpen;
+  tgt.devClose = linkClose;
+  tgt.devRead = linkRead;
+  tgt.devWrite = linkWrite;
+  tgt.fileOpen = fileOpen16;
+  tgt.fileClose = fileClose;
+  tgt.fileRead = fileRead16;
+  tgt.fileWrite = fileWrite16;
+  tgt.fileAvailableForSending = (isMaster ? masterFileAvailable : slaveFileAvailable);
+  if(files.fileSize > 0xFFFF)
+  {
+    tgt.fileOpen32 = fileOpen32;
+    tgt.fileRead32 = fileRead32;
+    tgt.fileWrite32 = fileWrite32;
+  }
+  if(!isMaster && (previous.editLength > 0))
+  {
+    tgt.fileOpenPrevious = slaveFileOpenPrevious;
+    tgt.fileDiscard = fileDiscard;
+  }
+  tgt.sysGetMs = ioDummyTargetIf.sysGetMs;
+  tgt.sysPrintf = quietPrintf;
+  tgt.sysCrc16 = crc16;
+  return tgt;
+}
+
+/*both ends, between linkStart() and linkStop()*/
+typedef struct
+{
+  thermit_t *master;
+  thermit_t *slave;
+  thermitState_t masterState;   /*after the latest step*/
+  thermitState_t slaveState;
+} linkEnds_t;
+
+static linkEnds_t ends;
+
+static void linkStart(uint32_t fileSize, uint32_t filesToSend)
+{
+  thermitTargetAdaptationInterface_t masterIf;
+  thermitTargetAdaptationInterface_t slaveIf;
+
+  memset(pipes, 0, sizeof(pipes));
+  memset(&files, 0, sizeof(files));
+  files.fileSize = fileSize;
+  files.filesToSend = filesToSend;
+  framesSent = 0;
+  memset(bytesSent, 0, sizeof(bytesSent));
+  memset(lineBytes, 0, sizeof(lineBytes));
+  randomState = 1;
+  feedbackToDrop = 0;
+
+  /*files over 64k need the 32 bit callbacks*/
+  masterIf = endInterface(true);
+  slaveIf = endInterface(false);
+
+  memset(&ends, 0, sizeof(ends));
+  ends.master = thermitNew((uint8_t *)"m", true, &masterIf);
+  ends.slave = thermitNew((uint8_t *)"s", false, &slaveIf);
+  if((ends.master == NULL) || (ends.slave == NULL))
+  {
+    printf("no thermit instance, THERMIT_INSTANCES_MAX must be 2\n");
+    exit(1);
+  }
+}
+
+static void linkStep(void)
+{
+  ioDummyClockAdvance(LINK_BENCH_STEP_MS);
+  ends.masterState = ends.master->m->step(ends.master);
+  ends.slaveState = ends.slave->m->step(ends.slave);
+  (void)ends.master->m->getDiagnostics(ends.master, &masterDiagnostics);
+  (void)ends.slave->m->getDiagnostics(ends.slave, &slaveDiagnostics);
+}
+
+static void linkStop(void)
+{
+  int i;
+
+  thermitDelete(ends.master);
+  thermitDelete(ends.slave);
+
+  /*files left incomplete*/
+  for(i = 0; i < LINK_BENCH_SINKS; i++)
+  {
+    free(sinks[i].buf);
+    sinks[i].buf = NULL;
+  }
+}
+
+/*
+Sends filesToSend files of fileSize bytes from the master to the slave and
+returns the number of steps it took, or 0 if it did not finish in maxSteps.
+*/
+static uint32_t runTransfer(uint32_t fileSize, uint32_t filesToSend, uint32_t maxSteps)
+{
+  uint32_t steps = 0;
+
+  linkStart(fileSize, filesToSend);
+  while((files.filesReceived < filesToSend) && (steps < maxSteps))
+  {
+    linkStep();
+    steps++;
+  }
+  linkStop();
+  return ((files.filesReceived == filesToSend) ? steps : 0);
+}
+
+static int scenarioBurst(void)
+{
+  uint32_t steps;
+
+  linkConditionsClear();
+  steps = runTransfer(15000, 20, 100000);
+
+  printf("burst length %d, clean link: ", THERMIT_BURST_LENGTH_MAX);
+  if(steps == 0)
+  {
+    printf("did not finish\n");
+    return 1;
+  }
+  printf("%lu files of %lu bytes in %lu steps, %.2f chunks per step, %.1f kB/s\n", (unsigned long)files.filesReceived,
+         (unsigned long)files.fileSize, (unsigned long)steps, (double)files.bytesReceived / THERMIT_PAYLOAD_SIZE / steps,
+         (double)files.bytesReceived / (steps * LINK_BENCH_STEP_MS));
+  if(files.filesBroken)
+  {
+    printf("%lu files broken\n", (unsigned long)files.filesBroken);
+  }
+  return (files.filesBroken != 0);
+}
+
+static int scenarioLoss(void)
+{
+  static const uint32_t lossPerMille[] = {0, 10, 20, 50, 100, 200};
+  int failed = 0;
+  unsigned i;
+
+  printf("loss sweep, 10 files of 15000 bytes, burst length up to %d:\n", THERMIT_BURST_LENGTH_MAX);
+  for(i = 0; i < sizeof(lossPerMille) / sizeof(lossPerMille[0]); i++)
+  {
+    thermitDiagnostics_t *diag = &masterDiagnostics;
+    uint32_t steps;
+    int k;
+
+    linkConditionsClear();
+    conditions.lossPerMille = lossPerMille[i];
+    steps = runTransfer(15000, 10, 100000);
+
+    printf("  %4.1f%% loss: ", lossPerMille[i] / 10.0);
+    if(steps == 0)
+    {
+      printf("did not finish\n");
+      failed = 1;
+      continue;
+    }
+    printf("%5lu steps, %5.1f kB/s, %4lu frames sent, %4lu retransmits, burst length %d, history",
+           (unsigned long)steps, (double)files.bytesReceived / (steps * LINK_BENCH_STEP_MS), (unsigned long)framesSent,
+           (unsigned long)diag->retransmits, diag->burstLength);
+    for(k = 0; k < THERMIT_BURST_HISTORY_LENGTH; k++)
+    {
+      uint8_t burst = diag->burstHistory[(diag->burstHistoryIdx + k) % THERMIT_BURST_HISTORY_LENGTH];
+
+      if(burst)
+      {
+        printf(" %d", burst);
+      }
+    }
+    printf("\n");
+    failed |= (files.filesBroken != 0);
+  }
+  return failed;
+}
+
+static int scenarioLarge(void)
+{
+  static const uint32_t lossPerMille[] = {0, 20};
+  int failed = 0;
+  unsigned i;
+
+  for(i = 0; i < sizeof(lossPerMille) / sizeof(lossPerMille[0]); i++)
+  {
+    uint32_t steps;
+
+    linkConditionsClear();
+    conditions.lossPerMille = lossPerMille[i];
+    steps = runTransfer(16UL * 1024 * 1024, 1, 1000000);
+
+    printf("large file, %.1f%% loss: ", lossPerMille[i] / 10.0);
+    if(steps == 0)
+    {
+      printf("did not finish\n");
+      failed = 1;
+      continue;
+    }
+    printf("%lu bytes in %lu steps, %lu frames sent, %.1f kB/s, %s\n", (unsigned long)files.bytesReceived, (unsigned long)steps,
+           (unsigned long)framesSent, (double)files.bytesReceived / (steps * LINK_BENCH_STEP_MS),
+           (files.filesBroken ? "BROKEN" : "content checked"));
+    failed |= (files.filesBroken != 0);
+  }
+  return failed;
+}
+
+static int scenarioSmall(void)
+{
+  static const uint32_t lossPerMille[] = {0, 20};
+  int failed = 0;
+  unsigned i;
+
+  for(i = 0; i < sizeof(lossPerMille) / sizeof(lossPerMille[0]); i++)
+  {
+    uint32_t steps;
+
+    linkConditionsClear();
+    conditions.lossPerMille = lossPerMille[i];
+    steps = runTransfer(1024, 500, 100000);
+
+    printf("1 kB files, %d transfer slots, %.1f%% loss: ", THERMIT_TRANSFER_SLOTS, lossPerMille[i] / 10.0);
+    if(steps == 0)
+    {
+      printf("did not finish\n");
+      failed = 1;
+      continue;
+    }
+    printf("%lu files in %lu steps, %.1f files/s\n", (unsigned long)files.filesReceived, (unsigned long)steps,
+           files.filesReceived * 1000.0 / (steps * LINK_BENCH_STEP_MS));
+    failed |= (files.filesBroken != 0);
+  }
+  return failed;
+}
+
+static int timerCheck(const char *what, bool ok)
+{
+  printf("  %-58s %s\n", what, (ok ? "ok" : "FAILED"));
+  return (ok ? 0 : 1);
+}
+
+/*steps until both ends are running, false if not within maxSteps*/
+static bool stepUntilRunning(uint32_t maxSteps)
+{
+  uint32_t steps = 0;
+
+  do
+  {
+    linkStep();
+    steps++;
+  } while(((ends.masterState != THERMIT_RUNNING) || (ends.slaveState != THERMIT_RUNNING)) && (steps < maxSteps));
+
+  return ((ends.masterState == THERMIT_RUNNING) && (ends.slaveState == THERMIT_RUNNING));
+}
+
+static bool stepUntilReceived(uint32_t filesReceived, uint32_t maxSteps)
+{
+  uint32_t steps = 0;
+
+  while((files.filesReceived < filesReceived) && (steps < maxSteps))
+  {
+    linkStep();
+    steps++;
+  }
+  return (files.filesReceived >= filesReceived);
+}
+
+/*
+The link goes down in the middle of a file. Each timeout must wait twice as
+long as the one before, starting from the estimated RTO, up to
+THERMIT_RTO_MAX_MS. The file must finish when the link is back.
+*/
+static int timerBackoff(void)
+{
+  uint32_t waits[16];
+  uint32_t count = 0;
+  uint32_t timeouts;
+  uint32_t rtoMs;
+  uint32_t downMs;
+  bool doubling = true;
+  uint32_t i;
+  int failed = 0;
+
+  linkConditionsClear();
+  linkStart(15000, 1);
+  for(i = 0; (i < 1000) && (masterDiagnostics.rttMs == 0); i++)
+  {
+    linkStep();
+  }
+
+  rtoMs = masterDiagnostics.rtoMs;
+  timeouts = masterDiagnostics.timeouts;
+  conditions.down = true;
+  for(downMs = 0; downMs < 2500; downMs += LINK_BENCH_STEP_MS)
+  {
+    uint32_t lastSentMs = lastWriteMs[0];
+
+    linkStep();
+    if((masterDiagnostics.timeouts != timeouts) && (count < sizeof(waits) / sizeof(waits[0])))
+    {
+      waits[count++] = nowMs() - lastSentMs;
+      timeouts = masterDiagnostics.timeouts;
+    }
+  }
+  conditions.down = false;
+
+  printf("  link down for %lu ms, RTO %lu ms, waits before the timeouts:", (unsigned long)downMs, (unsigned long)rtoMs);
+  for(i = 0; i < count; i++)
+  {
+    uint32_t expected = ((rtoMs << i) < THERMIT_RTO_MAX_MS) ? (rtoMs << i) : THERMIT_RTO_MAX_MS;
+
+    printf(" %lu", (unsigned long)waits[i]);
+    doubling &= ((waits[i] >= expected) && (waits[i] <= expected + LINK_BENCH_STEP_MS));
+  }
+  printf("\n");
+
+  failed |= timerCheck("RTO estimated from the round trips", (rtoMs >= THERMIT_RTO_MIN_MS) && (rtoMs < THERMIT_RTO_INITIAL_MS));
+  failed |= timerCheck("at least 4 timeouts while the link is down", (count >= 4));
+  failed |= timerCheck("the wait doubles after each timeout", doubling);
+  failed |= timerCheck("the file finishes when the link is back", stepUntilReceived(1, 10000) && (files.filesBroken == 0));
+  linkStop();
+  return failed;
+}
+
+/*
+The last chunk of a file is lost. If the feedback of the receiver reports it,
+it is resent at once. If that feedback is lost as well, the tail loss probe
+must resend it before the retransmission timer runs out.
+*/
+static int timerProbe(uint32_t feedbackLost)
+{
+  uint32_t chunks = 50;
+  uint32_t startMs = nowMs();
+  bool finished;
+  int failed = 0;
+
+  linkConditionsClear();
+  conditions.dropChunk = (int32_t)(chunks - 1);
+  conditions.dropFeedback = feedbackLost;
+  linkStart(chunks * THERMIT_PAYLOAD_SIZE, 1);
+  finished = stepUntilReceived(1, 10000);
+
+  printf("  last chunk and %lu feedback frames lost: %lu probes, %lu timeouts, finished in %lu ms\n", (unsigned long)feedbackLost,
+         (unsigned long)masterDiagnostics.probes, (unsigned long)masterDiagnostics.timeouts, (unsigned long)(nowMs() - startMs));
+  failed |= timerCheck("the last chunk was lost", (conditions.dropChunk < 0) && (feedbackToDrop == 0));
+  if(feedbackLost == 0)
+  {
+    failed |= timerCheck("the feedback asks for it, no probe", (masterDiagnostics.probes == 0));
+  }
+  else
+  {
+    failed |= timerCheck("a tail loss probe is sent", (masterDiagnostics.probes == 1));
+  }
+  failed |= timerCheck("no retransmission timeout", (masterDiagnostics.timeouts == 0));
+  failed |= timerCheck("the file finishes", finished && (files.filesBroken == 0));
+  linkStop();
+  return failed;
+}
+
+/*
+An idle link stays in sync on the keep-alives. When the peer goes silent for
+THERMIT_KEEP_ALIVE_LOST keep-alive periods both ends resync, and a file goes
+through once the link is back.
+*/
+static int timerKeepAlive(void)
+{
+  uint32_t idleFrames;
+  uint32_t downMs;
+  uint32_t silentMs = 0;
+  bool stayedInSync = true;
+  int failed = 0;
+
+  linkConditionsClear();
+  linkStart(1024, 1);
+  failed |= timerCheck("the first file finishes", stepUntilReceived(1, 10000));
+
+  idleFrames = framesSent;
+  for(downMs = 0; downMs < 10000; downMs += LINK_BENCH_STEP_MS)
+  {
+    linkStep();
+    stayedInSync &= ((ends.masterState == THERMIT_RUNNING) && (ends.slaveState == THERMIT_RUNNING));
+  }
+  idleFrames = framesSent - idleFrames;
+  printf("  idle for 10 s: %lu frames\n", (unsigned long)idleFrames);
+  failed |= timerCheck("idle link stays in sync", stayedInSync);
+  failed |= timerCheck("keep-alives are sent while idle", (idleFrames >= 10) && (idleFrames <= 40));
+
+  conditions.down = true;
+  for(downMs = 0; downMs < 6000; downMs += LINK_BENCH_STEP_MS)
+  {
+    linkStep();
+    if((silentMs == 0) && (ends.masterState != THERMIT_RUNNING))
+    {
+      silentMs = nowMs() - lastReadMs[0];
+    }
+  }
+  conditions.down = false;
+  printf("  link down: the master resyncs after %lu ms without a frame\n", (unsigned long)silentMs);
+  failed |= timerCheck("the silent peer is detected after the keep-alive periods",
+                       (silentMs >= 1000UL * THERMIT_KEEP_ALIVE_LOST) && (silentMs <= 1000UL * THERMIT_KEEP_ALIVE_LOST + LINK_BENCH_STEP_MS));
+
+  failed |= timerCheck("both ends are back in sync", stepUntilRunning(10000));
+  files.filesToSend++;
+  failed |= timerCheck("the next file finishes", stepUntilReceived(2, 10000) && (files.filesBroken == 0));
+  linkStop();
+  return failed;
+}
+
+static int scenarioTimers(void)
+{
+  int failed = 0;
+
+  printf("timers:\n");
+  failed |= timerBackoff();
+  failed |= timerProbe(0);
+  failed |= timerProbe(2);
+  failed |= timerKeepAlive();
+  return failed;
+}
+
+static int compareU32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+
+  return ((x > y) - (x < y));
+}
+
+static int scenarioLatency(void)
+{
+  static const uint32_t lossPerMille[] = {0, 20, 50, 100};
+  uint32_t filesToSend = 300;
+  int failed = 0;
+  unsigned i;
+
+  printf("latency, %lu files of 1 kB offered every 500 ms, tail loss probe after %d ms at the earliest:\n",
+         (unsigned long)filesToSend, THERMIT_PROBE_MIN_MS);
+  for(i = 0; i < sizeof(lossPerMille) / sizeof(lossPerMille[0]); i++)
+  {
+    uint32_t *lat = files.latencyMs;
+    uint32_t n;
+    bool finished;
+
+    linkConditionsClear();
+    conditions.lossPerMille = lossPerMille[i];
+    linkStart(1024, filesToSend);
+    files.offerGapMs = 500;
+    finished = stepUntilReceived(filesToSend, 100000);
+
+    printf("  %4.1f%% loss: ", lossPerMille[i] / 10.0);
+    n = files.latencyCount;
+    if(!finished || (n == 0))
+    {
+      printf("did not finish\n");
+      failed = 1;
+    }
+    else
+    {
+      qsort(lat, n, sizeof(lat[0]), compareU32);
+      printf("p50 %4lu ms, p90 %4lu ms, p99 %4lu ms, max %4lu ms, %lu probes, %lu timeouts\n", (unsigned long)lat[n / 2],
+             (unsigned long)lat[n * 9 / 10], (unsigned long)lat[n * 99 / 100], (unsigned long)lat[n - 1],
+             (unsigned long)masterDiagnostics.probes, (unsigned long)masterDiagnostics.timeouts);
+      failed |= (files.filesBroken != 0);
+    }
+    linkStop();
+  }
+  return failed;
+}
+
+static int scenarioFec(void)
+{
+  static const uint32_t lossPerMille[] = {0, 20, 50, 100, 200};
+  static const uint32_t delayMs[] = {0, 100};
+  uint32_t filesToSend = 10;
+  int failed = 0;
+  unsigned d, i;
+
+  for(d = 0; d < sizeof(delayMs) / sizeof(delayMs[0]); d++)
+  {
+    printf("fec, group %d with %d parity frames, %lu files of 15000 bytes, %lu ms each way:\n", THERMIT_FEC_GROUP, THERMIT_FEC_PARITY,
+           (unsigned long)filesToSend,
+           (unsigned long)delayMs[d]);
+    for(i = 0; i < sizeof(lossPerMille) / sizeof(lossPerMille[0]); i++)
+    {
+      uint32_t startMs;
+      bool finished;
+
+      linkConditionsClear();
+      linkStart(15000, filesToSend);
+      finished = stepUntilRunning(1000);
+      startMs = nowMs();
+      conditions.lossPerMille = lossPerMille[i];
+      conditions.delayMs = delayMs[d];
+      finished = finished && stepUntilReceived(filesToSend, 200000);
+
+      printf("  %4.1f%% loss: ", lossPerMille[i] / 10.0);
+      if(!finished)
+      {
+        printf("did not finish\n");
+        failed = 1;
+      }
+      else
+      {
+        printf("%5.1f kB/s, %4lu frames sent, %4lu retransmits, %4lu parity frames, %4lu chunks rebuilt\n",
+               (double)files.bytesReceived / (nowMs() - startMs), (unsigned long)framesSent,
+               (unsigned long)masterDiagnostics.retransmits, (unsigned long)masterDiagnostics.fecParities,
+               (unsigned long)slaveDiagnostics.fecRepairs);
+        failed |= (files.filesBroken != 0);
+      }
+      linkStop();
+    }
+  }
+  return failed;
+}
+
+/*
+The slave has an old copy of the file with 1% of it edited in the middle. The
+signatures and the edited blocks cross the link, the rest is taken from the old
+copy: the bytes on the wire are compared with the transfer without the old copy.
+Then the old copy changes after its first block has been matched, so the block
+taken is not the one signed. The file must fail its hash and be dropped.
+*/
+static int scenarioDelta(void)
+{
+  static const uint32_t fileSizes[] = {15000, 1000000};
+  int failed = 0;
+  bool finished;
+  uint32_t deltaBytes = 0;
+  unsigned i;
+
+  printf("delta, THERMIT_DELTA %d, the old copy has 1%% of the file edited:\n", THERMIT_DELTA);
+  for(i = 0; i < sizeof(fileSizes) / sizeof(fileSizes[0]); i++)
+  {
+    uint32_t plainBytes;
+
+    memset(&previous, 0, sizeof(previous));
+    linkConditionsClear();
+    finished = (runTransfer(fileSizes[i], 1, 1000000) > 0);
+    plainBytes = bytesSent[0] + bytesSent[1];
+
+    previous.editOffset = fileSizes[i] / 2;
+    previous.editLength = fileSizes[i] / 100;
+    finished = finished && (runTransfer(fileSizes[i], 1, 1000000) > 0);
+    deltaBytes = bytesSent[0] + bytesSent[1];
+
+    printf("  %7lu bytes: ", (unsigned long)fileSizes[i]);
+    if(!finished)
+    {
+      printf("did not finish\n");
+      failed = 1;
+      continue;
+    }
+    printf("%7lu bytes on the wire, %4.1f%% of the file, without the old copy %7lu, %4lu signature frames, %5lu chunks from the old copy, %s\n",
+           (unsigned long)deltaBytes, deltaBytes * 100.0 / fileSizes[i], (unsigned long)plainBytes,
+           (unsigned long)masterDiagnostics.deltaSignatures, (unsigned long)slaveDiagnostics.deltaCopiedChunks,
+           (files.filesBroken ? "BROKEN" : "content checked"));
+    failed |= (files.filesBroken != 0);
+  }
+  /*the edit is 1% of the file, the blocks around it and the signatures add to that*/
+  if(THERMIT_DELTA)
+  {
+    failed |= timerCheck("1 MB file: under 3% of it on the wire", deltaBytes * 100.0 / fileSizes[i - 1] < 3.0);
+  }
+
+  memset(&previous, 0, sizeof(previous));
+  previous.editOffset = 7500;
+  previous.editLength = 150;
+  previous.changes = true;
+  linkConditionsClear();
+  linkStart(15000, 1);
+  finished = stepUntilRunning(1000);
+  while(finished && (previous.filesDiscarded == 0) && (files.filesReceived == 0) && (nowMs() < 100000))
+  {
+    linkStep();
+  }
+  printf("  the old copy changes after its first block has matched: %lu hash failures, %lu files dropped, %lu kept\n",
+         (unsigned long)slaveDiagnostics.deltaHashFailures, (unsigned long)previous.filesDiscarded, (unsigned long)files.filesReceived);
+  if(THERMIT_DELTA)
+  {
+    failed |= timerCheck("the file fails its hash and is dropped", (slaveDiagnostics.deltaHashFailures == 1) && (previous.filesDiscarded == 1));
+    failed |= timerCheck("no broken file is kept", (files.filesReceived == 0) && (files.filesBroken == 0));
+  }
+  linkStop();
+  return failed;
+}
+
+/*
+Files of text records and of the pattern on a clean link, without a limit and
+on a line of 300 bytes per step. With compression on, the text should take fewer
+bytes on the wire and, on the slow line, move faster. The pattern should go raw
+and cost the same as without compression.
+*/
+static int scenarioCompression(void)
+{
+  static const char *contents[] = {"pattern", "text"};
+  int failed = 0;
+  unsigned i;
+
+  textInit();
+  printf("compression, THERMIT_COMPRESSION 0x%04x, 10 files of 15000 bytes, no loss:\n", THERMIT_COMPRESSION);
+  for(i = 0; i < 4; i++)
+  {
+    uint32_t steps;
+
+    textContent = (i % 2 == 1);
+    linkConditionsClear();
+    conditions.bytesPerStep = ((i < 2) ? 0 : 300);
+    steps = runTransfer(15000, 10, 100000);
+
+    printf("  %-7s, %s: ", contents[i % 2], ((i < 2) ? "no byte limit " : "300 B per step"));
+    if(steps == 0)
+    {
+      printf("did not finish\n");
+      failed = 1;
+      continue;
+    }
+    printf("%6lu bytes on the wire, %5.1f%% of the files, %4lu chunks compressed, %5lu bytes saved, %4lu retransmits, %5.1f kB/s, %s\n",
+           (unsigned long)bytesSent[0], bytesSent[0] * 100.0 / files.bytesReceived, (unsigned long)masterDiagnostics.compressedChunks,
+           (unsigned long)masterDiagnostics.compressionSavedBytes, (unsigned long)masterDiagnostics.retransmits,
+           (double)files.bytesReceived / (steps * LINK_BENCH_STEP_MS), (files.filesBroken ? "BROKEN" : "content checked"));
+    failed |= (files.filesBroken != 0);
+  }
+  textContent = false;
+  return failed;
+}
+
+int main(int argc, char **argv)
+{
+  const char *scenario = ((argc > 1) ? argv[1] : "");
+  bool all = (scenario[0] == 0);
+  int failed = 0;
+
+  if(all || (strcmp(scenario, "burst") == 0))
+  {
+    failed |= scenarioBurst();
+  }
+  if(all || (strcmp(scenario, "loss") == 0))
+  {
+    failed |= scenarioLoss();
+  }
+  if(all || (strcmp(scenario, "large") == 0))
+  {
+    failed |= scenarioLarge();
+  }
+  if(all || (strcmp(scenario, "small") == 0))
+  {
+    failed |= scenarioSmall();
+  }
+  if(all || (strcmp(scenario, "timers") == 0))
+  {
+    failed |= scenarioTimers();
+  }
+  if(all || (strcmp(scenario, "latency") == 0))
+  {
+    failed |= scenarioLatency();
+  }
+  if(all || (strcmp(scenario, "fec") == 0))
+  {
+    failed |= scenarioFec();
+  }
+  if(all || (strcmp(scenario, "delta") == 0))
+  {
+    failed |= scenarioDelta();
+  }
+  if(all || (strcmp(scenario, "compression") == 0))
+  {
+    failed |= scenarioCompression();
+  }
+
+  return failed;
+}
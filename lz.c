@@ -0,0 +1,366 @@
+/*
+A byte oriented LZ77 for short buffers. Each token starts with a control byte:
+
+  0x00..0x7F  literal run: (c + 1) bytes follow
+  0x80..0xFF  match: (c & 0x7F) + LZ_MATCH_MIN bytes copied from the output,
+              one byte of distance (1..255) follows
+
+A match may overlap the bytes it produces, which turns runs of one value into
+a single token. The encoder tries every earlier position for the longest match.
+That is cheap for the buffers of a few dozen bytes it is meant for, and keeps
+the memory use at the stack frame.
+
+The dictionary mode has a separate token set, as the buffer alone is too short
+to repeat itself much:
+
+  0x00..0x7F  literal run: (c + 1) bytes follow
+  0x80..0xBF  match in the output: (c & 0x3F) + LZ_MATCH_MIN bytes, one byte of distance follows
+  0xC0..0xFF  match in the dictionary: ((c >> 3) & 0x07) + LZ_MATCH_MIN bytes, the offset
+              is (c & 0x07) and the next byte, 11 bits
+
+The dictionary matches are found through a hash of their first three bytes and
+a chain of the earlier positions with the same hash.
+*/
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include "lz.h"
+
+/*the lengths are inclusive: a match takes a byte while it stays within the maximum*/
+#define LZ_MATCH_MIN      3
+#define LZ_MATCH_MAX      (0x7F + LZ_MATCH_MIN)
+#define LZ_LITERAL_MAX    0x80
+#define LZ_DISTANCE_MAX   255
+#define LZ_MATCH_FLAG     0x80
+
+#define LZ_DICT_FLAG          0xC0
+#define LZ_DICT_MATCH_MAX     (0x07 + LZ_MATCH_MIN)
+#define LZ_DICT_OUTPUT_MAX    (0x3F + LZ_MATCH_MIN)
+#define LZ_DICT_CHAIN_DEPTH   64    /*dictionary positions tried for each byte*/
+
+
+/*literal runs of src[from..to), false if they do not fit*/
+static bool lzPutLiterals(const uint8_t *src, uint16_t from, uint16_t to, uint8_t *dst, uint16_t *out, uint16_t dstMax)
+{
+  while(from < to)
+  {
+    uint16_t run = to - from;
+    uint16_t i;
+
+    if(run > LZ_LITERAL_MAX)
+    {
+      run = LZ_LITERAL_MAX;
+    }
+    if(*out + 1 + run > dstMax)
+    {
+      return false;
+    }
+
+    dst[(*out)++] = (uint8_t)(run - 1);
+    for(i = 0; i < run; i++)
+    {
+      dst[(*out)++] = src[from++];
+    }
+  }
+  return true;
+}
+
+uint16_t lzCompress(const uint8_t *src, uint16_t srcLen, uint8_t *dst, uint16_t dstMax)
+{
+  uint16_t in = 0;
+  uint16_t out = 0;
+  uint16_t literalStart = 0;
+
+  if((src == NULL) || (dst == NULL))
+  {
+    return 0;
+  }
+
+  while(in < srcLen)
+  {
+    uint16_t bestLen = 0;
+    uint16_t bestDistance = 0;
+    uint16_t distance;
+    uint16_t distanceMax = ((in < LZ_DISTANCE_MAX) ? in : LZ_DISTANCE_MAX);
+
+    for(distance = 1; distance <= distanceMax; distance++)
+    {
+      uint16_t len = 0;
+
+      while((in + len < srcLen) && (len + 1 <= LZ_MATCH_MAX) && (src[in + len] == src[in + len - distance]))
+      {
+        len++;
+      }
+      if(len > bestLen)
+      {
+        bestLen = len;
+        bestDistance = distance;
+      }
+    }
+
+    if(bestLen >= LZ_MATCH_MIN)
+    {
+      if(!lzPutLiterals(src, literalStart, in, dst, &out, dstMax) || (out + 2 > dstMax))
+      {
+        return 0;
+      }
+      dst[out++] = (uint8_t)(LZ_MATCH_FLAG | (bestLen - LZ_MATCH_MIN));
+      dst[out++] = (uint8_t)bestDistance;
+      in += bestLen;
+      literalStart = in;
+    }
+    else
+    {
+      in++;
+    }
+  }
+
+  if(!lzPutLiterals(src, literalStart, in, dst, &out, dstMax))
+  {
+    return 0;
+  }
+  return out;
+}
+
+int lzDecompress(const uint8_t *src, uint16_t srcLen, uint8_t *dst, uint16_t dstMax)
+{
+  uint16_t in = 0;
+  uint16_t out = 0;
+
+  if((src == NULL) || (dst == NULL))
+  {
+    return -1;
+  }
+
+  while(in < srcLen)
+  {
+    uint8_t control = src[in++];
+
+    if(control & LZ_MATCH_FLAG)
+    {
+      uint16_t len = (control & (uint8_t)~LZ_MATCH_FLAG) + LZ_MATCH_MIN;
+      uint16_t distance;
+
+      if(in >= srcLen)
+      {
+        return -1;
+      }
+      distance = src[in++];
+      if((distance == 0) || (distance > out) || (out + len > dstMax))
+      {
+        return -1;
+      }
+      while(len--)
+      {
+        dst[out] = dst[out - distance];
+        out++;
+      }
+    }
+    else
+    {
+      uint16_t run = control + 1;
+
+      if((in + run > srcLen) || (out + run > dstMax))
+      {
+        return -1;
+      }
+      while(run--)
+      {
+        dst[out++] = src[in++];
+      }
+    }
+  }
+  return out;
+}
+
+
+static uint8_t lzHash(const uint8_t *p)
+{
+  uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+
+  return (uint8_t)((v * 2654435761UL) >> 24);
+}
+
+void lzDictionaryInit(lzDictionary_t *dict, const uint8_t *data, uint16_t len)
+{
+  uint16_t i;
+
+  if(dict)
+  {
+    memset(dict, 0, sizeof(lzDictionary_t));
+    if(data)
+    {
+      dict->data = data;
+      dict->len = ((len < LZ_DICTIONARY_SIZE_MAX) ? len : LZ_DICTIONARY_SIZE_MAX);
+
+      for(i = 0; i + LZ_MATCH_MIN <= dict->len; i++)
+      {
+        uint8_t h = lzHash(&data[i]);
+
+        dict->chain[i] = dict->head[h];
+        dict->head[h] = i + 1;
+      }
+    }
+  }
+}
+
+uint16_t lzCompressDict(const lzDictionary_t *dict, const uint8_t *src, uint16_t srcLen, uint8_t *dst, uint16_t dstMax)
+{
+  uint16_t in = 0;
+  uint16_t out = 0;
+  uint16_t literalStart = 0;
+
+  if((dict == NULL) || (src == NULL) || (dst == NULL))
+  {
+    return 0;
+  }
+
+  while(in < srcLen)
+  {
+    uint16_t bestLen = 0;
+    uint16_t bestDistance = 0;
+    uint16_t dictLen = 0;
+    uint16_t dictOffset = 0;
+    uint16_t distance;
+    uint16_t distanceMax = ((in < LZ_DISTANCE_MAX) ? in : LZ_DISTANCE_MAX);
+
+    for(distance = 1; distance <= distanceMax; distance++)
+    {
+      uint16_t len = 0;
+
+      while((in + len < srcLen) && (len + 1 <= LZ_DICT_OUTPUT_MAX) && (src[in + len] == src[in + len - distance]))
+      {
+        len++;
+      }
+      if(len > bestLen)
+      {
+        bestLen = len;
+        bestDistance = distance;
+      }
+    }
+
+    /*a dictionary match is at most LZ_DICT_MATCH_MAX long, it only wins over a shorter match in the output*/
+    if((in + LZ_MATCH_MIN <= srcLen) && (bestLen < LZ_DICT_MATCH_MAX))
+    {
+      uint16_t candidate = dict->head[lzHash(&src[in])];
+      uint16_t depth = 0;
+
+      while((candidate != 0) && (depth < LZ_DICT_CHAIN_DEPTH) && (dictLen < LZ_DICT_MATCH_MAX))
+      {
+        uint16_t pos = candidate - 1;
+        uint16_t len = 0;
+
+        while((in + len < srcLen) && (pos + len < dict->len) && (len + 1 <= LZ_DICT_MATCH_MAX) && (src[in + len] == dict->data[pos + len]))
+        {
+          len++;
+        }
+        if(len > dictLen)
+        {
+          dictLen = len;
+          dictOffset = pos;
+        }
+        candidate = dict->chain[pos];
+        depth++;
+      }
+    }
+
+    if((bestLen >= LZ_MATCH_MIN) || (dictLen >= LZ_MATCH_MIN))
+    {
+      if(!lzPutLiterals(src, literalStart, in, dst, &out, dstMax) || (out + 2 > dstMax))
+      {
+        return 0;
+      }
+      if(dictLen > bestLen)
+      {
+        dst[out++] = (uint8_t)(LZ_DICT_FLAG | ((dictLen - LZ_MATCH_MIN) << 3) | (dictOffset >> 8));
+        dst[out++] = (uint8_t)dictOffset;
+        in += dictLen;
+      }
+      else
+      {
+        dst[out++] = (uint8_t)(LZ_MATCH_FLAG | (bestLen - LZ_MATCH_MIN));
+        dst[out++] = (uint8_t)bestDistance;
+        in += bestLen;
+      }
+      literalStart = in;
+    }
+    else
+    {
+      in++;
+    }
+  }
+
+  if(!lzPutLiterals(src, literalStart, in, dst, &out, dstMax))
+  {
+    return 0;
+  }
+  return out;
+}
+
+int lzDecompressDict(const lzDictionary_t *dict, const uint8_t *src, uint16_t srcLen, uint8_t *dst, uint16_t dstMax)
+{
+  uint16_t in = 0;
+  uint16_t out = 0;
+
+  if((dict == NULL) || (src == NULL) || (dst == NULL))
+  {
+    return -1;
+  }
+
+  while(in < srcLen)
+  {
+    uint8_t control = src[in++];
+
+    if((control & LZ_DICT_FLAG) == LZ_DICT_FLAG)
+    {
+      uint16_t len = ((control >> 3) & 0x07) + LZ_MATCH_MIN;
+      uint16_t offset;
+
+      if(in >= srcLen)
+      {
+        return -1;
+      }
+      offset = (uint16_t)(((control & 0x07) << 8) | src[in++]);
+      if((offset + len > dict->len) || (out + len > dstMax))
+      {
+        return -1;
+      }
+      memcpy(&dst[out], &(dict->data[offset]), len);
+      out += len;
+    }
+    else if(control & LZ_MATCH_FLAG)
+    {
+      uint16_t len = (control & 0x3F) + LZ_MATCH_MIN;
+      uint16_t distance;
+
+      if(in >= srcLen)
+      {
+        return -1;
+      }
+      distance = src[in++];
+      if((distance == 0) || (distance > out) || (out + len > dstMax))
+      {
+        return -1;
+      }
+      while(len--)
+      {
+        dst[out] = dst[out - distance];
+        out++;
+      }
+    }
+    else
+    {
+      uint16_t run = control + 1;
+
+      if((in + run > srcLen) || (out + run > dstMax))
+      {
+        return -1;
+      }
+      memcpy(&dst[out], &src[in], run);
+      in += run;
+      out += run;
+    }
+  }
+  return out;
+}
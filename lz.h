@@ -0,0 +1,33 @@
+#ifndef __LZ_H__
+#define __LZ_H__
+#include <stdint.h>
+
+
+/*LZ77 compression of short buffers, such as one chunk. No tables, only the stack frame.*/
+
+/*compressed length, or 0 if the result does not fit into dstMax bytes*/
+uint16_t lzCompress(const uint8_t *src, uint16_t srcLen, uint8_t *dst, uint16_t dstMax);
+
+/*decompressed length, or -1 if the data is broken or does not fit into dstMax bytes*/
+int lzDecompress(const uint8_t *src, uint16_t srcLen, uint8_t *dst, uint16_t dstMax);
+
+
+/*dictionary mode: both ends have the same dictionary, and the chunks refer to it.
+  The index for the encoder takes two bytes per dictionary byte.*/
+#define LZ_DICTIONARY_SIZE_MAX    2048    /*longer dictionaries are cut, the format has 11 bits for the offset*/
+#define LZ_DICTIONARY_HASH_SIZE   256
+
+typedef struct
+{
+  const uint8_t *data;
+  uint16_t len;
+  uint16_t head[LZ_DICTIONARY_HASH_SIZE];   /*latest position of each hash + 1, 0: none*/
+  uint16_t chain[LZ_DICTIONARY_SIZE_MAX];   /*previous position with the same hash + 1*/
+} lzDictionary_t;
+
+void lzDictionaryInit(lzDictionary_t *dict, const uint8_t *data, uint16_t len);
+uint16_t lzCompressDict(const lzDictionary_t *dict, const uint8_t *src, uint16_t srcLen, uint8_t *dst, uint16_t dstMax);
+int lzDecompressDict(const lzDictionary_t *dict, const uint8_t *src, uint16_t srcLen, uint8_t *dst, uint16_t dstMax);
+
+
+#endif      //__LZ_H__
@@ -1,4 +1,5 @@
 #include "stdio.h"
+#include <string.h>
 #include "thermit.h"
 #include <time.h>
 #include <unistd.h>
@@ -14,15 +15,27 @@ int main(int argc, char* argv[])
     bool masterRole = false;
     uint8_t *linkName = NULL;
 
-    if(argc == 3)
+    if((argc >= 3) && (argc <= 5))
     {
         linkName = argv[1];
         masterRole = (argv[2][0] == 'm' ? true : false);
+
+        if((argc >= 4) && (strcmp(argv[3], "cobs") == 0))
+        {
+            (void)ioLinuxSetFramingMode((const char *)linkName, STREAM_FRAMING_MODE_COBS);
+        }
+
+        if((argc == 5) && !ioLinuxLoadDictionary(argv[4]))
+        {
+            #ifndef THERMIT_NO_DEBUG
+            printf("could not load the dictionary '%s'\r\n", argv[4]);
+            #endif
+        }
     }
     else
     {
       #ifndef THERMIT_NO_DEBUG
-      printf("syntax: %s devname mode, where:\r\ndevname = '/dev/xyz0'\r\nmode = 'm' (master)\r\nmode = 's' (slave)\r\n", argv[0]);
+      printf("syntax: %s devname mode [framing [dictionary]], where:\r\ndevname = '/dev/xyz0'\r\nmode = 'm' (master)\r\nmode = 's' (slave)\r\nframing = 'cobs' (default: start/stop bytes)\r\ndictionary = compression dictionary file made with dictTrain\r\n", argv[0]);
       #endif
     }
 
@@ -9,6 +9,21 @@ uint8_t msgLen(uint8_t *start, uint8_t *currentPosition)
   return (uint8_t)(b - a);
 }
 
+void msgPutU32(uint8_t **buf, uint32_t val)
+{
+  if(buf && *buf)
+  {
+    uint8_t *b = *buf;
+
+    *(b++) = (val & 0xFF);
+    *(b++) = ((val >> 8) & 0xFF);
+    *(b++) = ((val >> 16) & 0xFF);
+    *(b++) = ((val >> 24) & 0xFF);
+
+    *buf = b;
+  }
+}
+
 void msgPutU16(uint8_t **buf, uint16_t val)
 {
   if(buf && *buf)
@@ -34,6 +49,23 @@ void msgPutU8(uint8_t **buf, uint8_t val)
   }
 }
 
+uint32_t msgGetU32(uint8_t **buf)
+{
+  uint32_t ret = 0;
+  if(buf && *buf)
+  {
+    uint8_t *b = *buf;
+
+    ret |= *(b++);
+    ret |= ((uint32_t)*(b++)) << 8;
+    ret |= ((uint32_t)*(b++)) << 16;
+    ret |= ((uint32_t)*(b++)) << 24;
+
+    *buf = b;
+  }
+  return ret;
+}
+
 uint16_t msgGetU16(uint8_t **buf)
 {
   uint16_t ret = 0;
@@ -4,8 +4,10 @@
 
 
 uint8_t msgLen(uint8_t *start, uint8_t *currentPosition);
+void msgPutU32(uint8_t **buf, uint32_t val);
 void msgPutU16(uint8_t **buf, uint16_t val);
 void msgPutU8(uint8_t **buf, uint8_t val);
+uint32_t msgGetU32(uint8_t **buf);
 uint16_t msgGetU16(uint8_t **buf);
 uint8_t msgGetU8(uint8_t **buf);
 
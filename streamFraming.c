@@ -3,8 +3,6 @@
 #include "streamFraming.h"
 #include "crc.h"
 
-#define THERMIT_MAX_PAYLOAD_LENGTH  112
-
 
 
 
@@ -18,112 +16,508 @@ start/stop bytes are used to recognize the frame:
 
 thermit frame:
 [ FCode | RecFileID | RecFeedback | SendFileID | SendChunkNo | PayloadLength | Payload | CRC (16bit) ]
+RecFeedback and SendChunkNo are 32 bit wide when the FCode has the wide
+header flag (0x40) set.
 
 The start/stop bytes are dropped and only the thermit 
 frame is given to the protocol.
+
+The start/stop framing does not escape anything, so a broken length byte
+keeps the parser off until it finds another start pair. Devices can
+therefore use COBS (Consistent Overhead Byte Stuffing) instead:
+[ COBS(thermit frame) | 00 ]
+The encoded frame never contains 00, so a damaged frame costs only
+itself: the parser always restarts at the next delimiter.
+
+The CRC is calculated while the bytes arrive, so the finished frame
+can be handed over together with the check result and the protocol
+does not need to make a second pass over the buffer. The check type in
+use is learned from the frames: the expected one is calculated on the
+fly and the other one is tried only if that fails.
+*/
+
+#define CHECK_LENGTH(_frame) ((_frame)->crc32cExpected ? 4 : 2)
+
+static void updateCheck(streamFraming_t *frame, const uint8_t *data, uint16_t len)
+{
+  if (frame->crc32cExpected)
+  {
+    crc32cUpdate(&(frame->crc32c), data, len);
+  }
+  else
+  {
+    crc16Update(&(frame->crc), data, len);
+  }
+}
+
+/*copy up to 'wanted' bytes of the input into the frame buffer*/
+static uint16_t collect(streamFraming_t *frame, const uint8_t *data, uint16_t len, uint16_t wanted)
+{
+  uint16_t n = (len < wanted ? len : wanted);
+
+  memcpy(&(frame->buf[frame->len]), data, n);
+  frame->len += n;
+
+  return n;
+}
+
+static bool crc16Matches(streamFraming_t *frame, uint16_t calculated)
+{
+  uint8_t *p = &(frame->buf[frame->len - 2]);
+
+  return (calculated == (uint16_t)(p[0] | (p[1] << 8)));
+}
+
+static bool crc32cMatches(streamFraming_t *frame, uint32_t calculated)
+{
+  uint8_t *p = &(frame->buf[frame->len - 4]);
+
+  return (calculated == ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24)));
+}
+
+static streamFramingCheck_t checkFrame(streamFraming_t *frame)
+{
+  streamFramingCheck_t ret = STREAM_FRAMING_CHECK_FAILED;
+
+  if (frame->crc32cExpected)
+  {
+    if (crc32cMatches(frame, crc32cFinal(&(frame->crc32c))))
+    {
+      ret = STREAM_FRAMING_CHECK_CRC32C_OK;
+    }
+    else if (crc16Matches(frame, crc16(frame->buf, frame->len - 2)))
+    {
+      ret = STREAM_FRAMING_CHECK_CRC16_OK;
+      frame->crc32cExpected = false;
+    }
+  }
+  else
+  {
+    if (crc16Matches(frame, crc16Final(&(frame->crc))))
+    {
+      ret = STREAM_FRAMING_CHECK_CRC16_OK;
+    }
+    else if (crc32cMatches(frame, crc32c(frame->buf, frame->len - 4)))
+    {
+      ret = STREAM_FRAMING_CHECK_CRC32C_OK;
+      frame->crc32cExpected = true;
+    }
+  }
+
+  return ret;
+}
+
+/*
+Queue the bytes of a failed start/stop frame for a second look. The scan
+restarts from the second start byte, so a frame whose start sequence was
+preceded by a stray START_CHAR is found as well. Bytes not yet scanned
+from an earlier rescan follow them. The stop sequence can't start a frame
+and is not kept.
 */
+static void rescanLater(streamFraming_t *frame)
+{
+  uint16_t remaining = frame->historyLen - frame->historyPos;
+
+  if ((frame->mode == STREAM_FRAMING_MODE_START_STOP) && ((size_t)(1 + frame->len + remaining) <= sizeof(frame->history)))
+  {
+    memmove(&(frame->history[1 + frame->len]), &(frame->history[frame->historyPos]), remaining);
+    frame->history[0] = START_CHAR;
+    memcpy(&(frame->history[1]), frame->buf, frame->len);
+    frame->historyLen = 1 + frame->len + remaining;
+    frame->historyPos = 0;
+  }
+}
+
+/*add the zero that ended the previous COBS block, if any*/
+static bool cobsAppendZero(streamFraming_t *frame)
+{
+  if (frame->cobsZeroPending)
+  {
+    if (frame->len >= frame->maxLen)
+    {
+      return false;
+    }
+    frame->buf[frame->len++] = 0;
+    frame->cobsZeroPending = false;
+  }
+  return true;
+}
+
+static uint8_t headerLength(uint8_t fCode)
+{
+  return (STREAM_FRAMING_IS_WIDE(fCode) ? STREAM_FRAMING_HEADER_LENGTH_WIDE : STREAM_FRAMING_HEADER_LENGTH);
+}
+
+/*the decoded frame must be exactly as long as its length byte says*/
+static bool cobsFrameIsComplete(streamFraming_t *frame)
+{
+  uint8_t hLen = ((frame->len > 0) ? headerLength(frame->buf[0]) : STREAM_FRAMING_HEADER_LENGTH);
+
+  return (frame->len > hLen) &&
+         (frame->len == hLen + frame->buf[hLen - 1] + 2);
+}
 
 void streamFramingFollow(streamFraming_t *frame, uint8_t inByte)
 {
-  bool error = true;
+  if (streamFramingFeed(frame, &inByte, 1) == 0)
+  {
+    /*a frame got ready before this byte was looked at. Keep it for the
+      next call if there is room, otherwise it is dropped.*/
+    uint16_t remaining = frame->historyLen - frame->historyPos;
 
-  //printf("rec: %02X\r\n", inByte);
+    if (remaining < sizeof(frame->history))
+    {
+      memmove(frame->history, &(frame->history[frame->historyPos]), remaining);
+      frame->history[remaining] = inByte;
+      frame->historyLen = remaining + 1;
+      frame->historyPos = 0;
+    }
+  }
+}
 
+/*
+Bulk version of streamFramingFollow(): the start sequence (or the COBS
+delimiter) is searched with memchr() and the frame data is copied in blocks.
+Returns the number of bytes consumed. The function returns as soon as a
+frame is ready, so the caller can take the frame, call
+streamFramingRestart() and feed the rest of the buffer again.
+*/
+uint16_t streamFramingFeed(streamFraming_t *frame, const uint8_t *buf, uint16_t len)
+{
+  uint16_t pos = 0;
 
-  switch (frame->state)
+  while (!frame->isReady)
   {
-  case MSG_STATE_START:
-    if (inByte == START_CHAR)
+    /*bytes left over from a failed frame are scanned before the new ones*/
+    bool fromHistory = (frame->historyPos < frame->historyLen);
+    const uint8_t *in;
+    uint16_t avail;
+    uint16_t used = 0;
+    uint16_t n;
+    bool error = false;
+    bool rescan = false;
+
+    if (fromHistory)
     {
-      if (--(frame->stateRoundsLeft) == 0)
+      in = &(frame->history[frame->historyPos]);
+      avail = frame->historyLen - frame->historyPos;
+    }
+    else if (pos < len)
+    {
+      in = &(buf[pos]);
+      avail = len - pos;
+    }
+    else
+    {
+      break;  /*all consumed*/
+    }
+
+    switch (frame->state)
+    {
+    case MSG_STATE_START:
+      if (frame->stateRoundsLeft == 2)
+      {
+        /*skip the garbage up to the next possible start*/
+        const uint8_t *found = memchr(in, START_CHAR, avail);
+
+        if (found == NULL)
+        {
+          used = avail;
+          break;
+        }
+        used += (uint16_t)(found - in) + 1;
+        frame->stateRoundsLeft = 1;
+      }
+      else if (*in == START_CHAR)
       {
         /*last round -> advance to next state*/
+        used++;
+        frame->fromHistory = fromHistory;
         frame->state = MSG_STATE_HEADER;
         frame->stateRoundsLeft = 5;
       }
-      error = false;
-    }
-    break;
+      else
+      {
+        error = true;
+      }
+      break;
 
-  case MSG_STATE_HEADER:
-    frame->buf[frame->len++] = inByte;
-    if (--(frame->stateRoundsLeft) == 0)
-    {
-      /*advance to next state*/
-      frame->state = MSG_STATE_LEN;
-      frame->stateRoundsLeft = 1;
-    }
-    
-    error = false;
-    break;
+    case MSG_STATE_HEADER:
+      {
+        bool firstByte = (frame->len == 0);
 
-  case MSG_STATE_LEN:
-    frame->buf[frame->len++] = inByte;
-    if (--(frame->stateRoundsLeft) == 0)
-    {
-      if(inByte < THERMIT_MAX_PAYLOAD_LENGTH)
+        n = collect(frame, in, avail, frame->stateRoundsLeft);
+        updateCheck(frame, in, n);
+        used += n;
+        frame->stateRoundsLeft -= n;
+
+        if (firstByte && (n > 0) && STREAM_FRAMING_IS_WIDE(frame->buf[0]))
+        {
+          /*the function code tells the header to be longer*/
+          frame->stateRoundsLeft += STREAM_FRAMING_HEADER_LENGTH_WIDE - STREAM_FRAMING_HEADER_LENGTH;
+        }
+      }
+
+      if (frame->stateRoundsLeft == 0)
+      {
+        /*advance to next state*/
+        frame->state = MSG_STATE_LEN;
+        frame->stateRoundsLeft = 1;
+      }
+      break;
+
+    case MSG_STATE_LEN:
+      frame->buf[frame->len++] = *in;
+      updateCheck(frame, in, 1);
+      used++;
+
+      if (frame->len + *in + 2 <= frame->maxLen)
       {
         /*advance to next state*/
         frame->state = MSG_STATE_PAYLOAD_AND_CRC;
-        frame->stateRoundsLeft = inByte + 2;  /*payload+crc*/
+        frame->stateRoundsLeft = *in + 2;  /*payload+crc*/
       }
-    }
-    
-    error = false;
-    break;
+      else
+      {
+        rescan = true;
+        error = true;
+      }
+      break;
 
-  case MSG_STATE_PAYLOAD_AND_CRC:
-    /*note: we don't check CRC here. The protocol handler will check it anyway.*/
-    frame->buf[frame->len++] = inByte;
-    if (--(frame->stateRoundsLeft) == 0)
-    {
-      /*advance to next state*/
-      frame->state = MSG_STATE_STOP;
-      frame->stateRoundsLeft = 2;
-    }
-    
-    error = false;
-    break;
+    case MSG_STATE_PAYLOAD_AND_CRC:
+      {
+        uint16_t covered = 0;
 
-  case MSG_STATE_STOP:
-    if (inByte == STOP_CHAR)
-    {
-      if (--(frame->stateRoundsLeft) == 0)
+        /*the last bytes are the check itself, all others are covered by it*/
+        if (frame->stateRoundsLeft > CHECK_LENGTH(frame))
+        {
+          covered = frame->stateRoundsLeft - CHECK_LENGTH(frame);
+        }
+
+        n = collect(frame, in, avail, frame->stateRoundsLeft);
+        updateCheck(frame, in, (n < covered ? n : covered));
+        used += n;
+        frame->stateRoundsLeft -= n;
+
+        if (frame->stateRoundsLeft == 0)
+        {
+          /*advance to next state*/
+          frame->state = MSG_STATE_STOP;
+          frame->stateRoundsLeft = 2;
+        }
+      }
+      break;
+
+    case MSG_STATE_STOP:
+      if (*in == STOP_CHAR)
       {
-        /*last round -> advance to next state*/
-        frame->state = MSG_STATE_FINISHED;
-        /*no stateRoundsLeft needed for this state*/
+        used++;
+        if (--(frame->stateRoundsLeft) == 0)
+        {
+          /*last round -> advance to next state*/
+          frame->state = MSG_STATE_FINISHED;
+          /*no stateRoundsLeft needed for this state*/
+
+          /*mark frame ready to be sent to ControlTask*/
+          frame->check = checkFrame(frame);
+          frame->isReady = true;
+
+          if (frame->check == STREAM_FRAMING_CHECK_FAILED)
+          {
+            /*the length byte may have been hit: the next frame may be hiding in this one*/
+            rescan = true;
+
+            /*a false start found by the rescan is not worth reporting*/
+            error = frame->fromHistory;
+          }
+        }
+      }
+      else
+      {
+        rescan = true;
+        error = true;
+      }
+      break;
+
+    case MSG_STATE_COBS_CODE:
+      used++;
+      if (*in == COBS_DELIMITER)
+      {
+        /*end of frame. The zero implied by the last block is not part of the data.*/
+        if (cobsFrameIsComplete(frame))
+        {
+          frame->state = MSG_STATE_FINISHED;
+          updateCheck(frame, frame->buf, frame->len - CHECK_LENGTH(frame));
+          frame->check = checkFrame(frame);
+          frame->isReady = true;
+        }
+        else
+        {
+          /*garbage or a broken frame: the next byte starts a new one*/
+          streamFramingRestart(frame);
+        }
+      }
+      else if (!cobsAppendZero(frame))
+      {
+        frame->state = MSG_STATE_COBS_DISCARD;
+      }
+      else
+      {
+        frame->stateRoundsLeft = *in - 1;
+        frame->cobsZeroPending = (*in < 0xFF);
 
-        /*mark frame ready to be sent to ControlTask*/
-        frame->isReady = true;
+        if (frame->stateRoundsLeft > 0)
+        {
+          frame->state = MSG_STATE_COBS_DATA;
+        }
       }
+      break;
+
+    case MSG_STATE_COBS_DATA:
+      {
+        const uint8_t *delimiter;
 
-      error = false;
+        n = (avail < frame->stateRoundsLeft ? avail : frame->stateRoundsLeft);
+        delimiter = memchr(in, COBS_DELIMITER, n);
+
+        if (delimiter != NULL)
+        {
+          /*frame cut short: resync right here*/
+          used += (uint16_t)(delimiter - in) + 1;
+          streamFramingRestart(frame);
+        }
+        else if (frame->len + n > frame->maxLen)
+        {
+          frame->state = MSG_STATE_COBS_DISCARD;
+        }
+        else
+        {
+          (void)collect(frame, in, n, n);
+          used += n;
+          frame->stateRoundsLeft -= n;
+
+          if (frame->stateRoundsLeft == 0)
+          {
+            frame->state = MSG_STATE_COBS_CODE;
+          }
+        }
+      }
+      break;
+
+    case MSG_STATE_COBS_DISCARD:
+      {
+        const uint8_t *delimiter = memchr(in, COBS_DELIMITER, avail);
+
+        if (delimiter == NULL)
+        {
+          used = avail;
+        }
+        else
+        {
+          used += (uint16_t)(delimiter - in) + 1;
+          streamFramingRestart(frame);
+        }
+      }
+      break;
+
+    case MSG_STATE_FINISHED:
+      /*the frame has not been taken yet, don't consume anything*/
+      return pos;
+
+    default:
+      /*out of sync*/
+      error = true;
+      break;
+    }
+
+    if (fromHistory)
+    {
+      frame->historyPos += used;
+    }
+    else
+    {
+      pos += used;
     }
-    break;
 
-  case MSG_STATE_FINISHED:
-    /*idle... we shouldn't get here at anytime, but it wouldn't be an error.
-      We just drop all the bytes.*/
-    error = false;
-    break;
+    if (rescan)
+    {
+      rescanLater(frame);
+    }
 
-  default:
-    /*out of sync*/
-    break;
+    if (error)
+    {
+      /*restart listening from start. The offending byte is not consumed,
+        it may be the first byte of the next start sequence.*/
+      streamFramingRestart(frame);
+    }
   }
 
-  if (error)
-  {
-    /*restart listening from start*/
-    streamFramingInitialize(frame);
-  }
+  return pos;
 }
 
 void streamFramingInitialize(streamFraming_t *frame)
 {
   memset(frame, 0, sizeof(streamFraming_t));
+  frame->maxLen = STREAM_FRAMING_BUFFER_SIZE;
 
-  frame->state = MSG_STATE_START;
+  streamFramingRestart(frame);
+}
+
+/*prepare for the next frame, keeping what has been learned about the link
+  and the bytes still waiting to be rescanned*/
+void streamFramingRestart(streamFraming_t *frame)
+{
+  frame->len = 0;
+  frame->state = (frame->mode == STREAM_FRAMING_MODE_COBS ? MSG_STATE_COBS_CODE : MSG_STATE_START);
   frame->stateRoundsLeft = 2;
+  frame->cobsZeroPending = false;
+  frame->fromHistory = false;
+  frame->check = STREAM_FRAMING_CHECK_FAILED;
+  frame->isReady = false;
+  frame->idleCounter = 0;
+  crc16Init(&(frame->crc));
+  crc32cInit(&(frame->crc32c));
+}
+
+/*select the framing and the longest frame the link carries. The length is
+  capped to the buffer size. A tight limit lets the start/stop framing notice
+  a false start or a broken length byte sooner.*/
+void streamFramingConfigure(streamFraming_t *frame, streamFramingMode_t mode, uint16_t maxLen)
+{
+  frame->mode = mode;
+  frame->maxLen = (maxLen < STREAM_FRAMING_BUFFER_SIZE ? maxLen : STREAM_FRAMING_BUFFER_SIZE);
+
+  streamFramingRestart(frame);
+}
+
+/*COBS encode a frame and append the delimiter. The output buffer must hold
+  STREAM_FRAMING_COBS_MAX_LENGTH(len) bytes. Returns the encoded length.*/
+uint16_t streamFramingCobsEncode(const uint8_t *in, uint16_t len, uint8_t *out)
+{
+  uint16_t codeIdx = 0;
+  uint16_t outLen = 1;
+  uint8_t code = 1;
+  uint16_t i;
+
+  for (i = 0; i < len; i++)
+  {
+    if (in[i] != 0)
+    {
+      out[outLen++] = in[i];
+      code++;
+    }
+
+    if ((in[i] == 0) || (code == 0xFF))
+    {
+      /*close the block*/
+      out[codeIdx] = code;
+      codeIdx = outLen++;
+      code = 1;
+    }
+  }
+
+  out[codeIdx] = code;
+  out[outLen++] = COBS_DELIMITER;
+
+  return outLen;
 }
@@ -3,10 +3,30 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include "crc.h"
 
 
 #define START_CHAR 0xA5
 #define STOP_CHAR 0x5A
+#define COBS_DELIMITER 0x00
+
+/*largest frame the length byte can describe: header, 255 bytes of payload
+  (including the extra CRC-32C bytes) and the 16bit CRC*/
+#define STREAM_FRAMING_HEADER_LENGTH 6
+#define STREAM_FRAMING_HEADER_LENGTH_WIDE 12    /*function codes 0x40..0x7F: 32 bit feedback and chunk number*/
+#define STREAM_FRAMING_IS_WIDE(_fCode) (((_fCode) & 0xC0) == 0x40)
+#ifndef STREAM_FRAMING_BUFFER_SIZE
+#define STREAM_FRAMING_BUFFER_SIZE (STREAM_FRAMING_HEADER_LENGTH_WIDE + 255 + 2)
+#endif
+
+/*worst case size of a COBS encoded frame, including the delimiter*/
+#define STREAM_FRAMING_COBS_MAX_LENGTH(_len) ((_len) + ((_len) / 254) + 2)
+
+typedef enum
+{
+  STREAM_FRAMING_MODE_START_STOP = 0,   /*A5 A5 ... 5A 5A, nothing escaped*/
+  STREAM_FRAMING_MODE_COBS              /*COBS encoded, each frame followed by 00*/
+} streamFramingMode_t;
 
 typedef enum
 {
@@ -20,26 +40,53 @@ typedef enum
 
   /*stop char for stream based connections, such as uart*/
   MSG_STATE_STOP,
-  MSG_STATE_FINISHED
+  MSG_STATE_FINISHED,
+
+  /*COBS mode*/
+  MSG_STATE_COBS_CODE,      /*next byte is a code byte*/
+  MSG_STATE_COBS_DATA,      /*copying the bytes of the current code block*/
+  MSG_STATE_COBS_DISCARD    /*broken frame, waiting for the delimiter*/
 } streamFramingState_t;
 
+typedef enum
+{
+  STREAM_FRAMING_CHECK_FAILED = 0,
+  STREAM_FRAMING_CHECK_CRC16_OK,
+  STREAM_FRAMING_CHECK_CRC32C_OK
+} streamFramingCheck_t;
+
 
 typedef struct
 {
-  uint8_t buf[128];
+  uint8_t buf[STREAM_FRAMING_BUFFER_SIZE];
   uint16_t len;
 
+  streamFramingMode_t mode; /*survives streamFramingRestart()*/
+  uint16_t maxLen;          /*longer frames are dropped early, survives streamFramingRestart()*/
   streamFramingState_t state;
-  uint8_t stateRoundsLeft;
-  uint16_t crcReceived;
+  uint16_t stateRoundsLeft;
+  bool cobsZeroPending;     /*current COBS block ends with an encoded zero*/
+  crc16Context_t crc;       /*calculated over header, length and payload while the bytes arrive*/
+  crc32cContext_t crc32c;   /*ditto, when the link is using CRC-32C*/
+  bool crc32cExpected;      /*learned from the link, survives streamFramingRestart()*/
+  streamFramingCheck_t check; /*valid when isReady is set*/
   bool isReady;
   uint16_t idleCounter;
+
+  uint8_t history[STREAM_FRAMING_BUFFER_SIZE + 1];  /*bytes of a failed frame, scanned again for a start*/
+  uint16_t historyLen;
+  uint16_t historyPos;
+  bool fromHistory;         /*current frame was started by the rescan*/
 } streamFraming_t;
 
 
 
 void streamFramingFollow(streamFraming_t *frame, uint8_t inByte);
+uint16_t streamFramingFeed(streamFraming_t *frame, const uint8_t *buf, uint16_t len);
 void streamFramingInitialize(streamFraming_t *frame);
+void streamFramingRestart(streamFraming_t *frame);
+void streamFramingConfigure(streamFraming_t *frame, streamFramingMode_t mode, uint16_t maxLen);
+uint16_t streamFramingCobsEncode(const uint8_t *in, uint16_t len, uint8_t *out);
 
 
 
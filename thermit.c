@@ -2,23 +2,20 @@
 #include "string.h" //memset
 #include "crc.h"
 #include "msgBuf.h"
+#include "gf256.h"
+#include "lz.h"
+#include "delta.h"
 
 
+#ifndef THERMIT_INSTANCES_MAX
 #define THERMIT_INSTANCES_MAX 1
+#endif
 
 #define DIRTY_CHUNK_NONE    0xFF
 
-#define THERMIT_EASY_MODE   true
-typedef struct
-{
-  uint32_t receivedFiles;
-  uint32_t receivedBytes;
-  uint32_t sentFiles;
-  uint32_t sentBytes;
-  uint32_t crcErrors;
-  uint32_t retransmits;
-  uint32_t reconnections;
-} thermitDiagnostics_t;
+#ifndef THERMIT_EASY_MODE
+#define THERMIT_EASY_MODE   false   /*true: only master sends files, slave receives*/
+#endif
 
 typedef struct
 {
@@ -27,35 +24,153 @@ typedef struct
   uint16_t maxFileSize; /*this is the maximum transferable unit size (i.e. the file size)*/
   uint16_t keepAliveMs; /*0: disable keepalive, 1..65k: idle time after which a keepalive packet is sent*/
   uint16_t burstLength; /*how many packets to be sent at one step. This is to be auto-tuned during transfer to optimize the hw link buffer usage. */
+  uint16_t checkType;   /*frame check used after SYNC, see thermitCheckType_t. The higher value is the stronger check.*/
+  uint16_t maxFileSize64k;  /*maximum file size in large file mode, in 64 kB units. 0: large files are not supported.*/
+  uint16_t transferSlots;   /*files in transfer at the same time, per direction*/
+  uint16_t fecGroup;        /*0: no forward error correction, K: parity frames after each K chunks*/
+  uint16_t fecParity;       /*parity frames per group, 1: XOR, more: Reed-Solomon*/
+  uint16_t compression;     /*proposal: codecs supported, THERMIT_CODEC_x bits. Negotiated: the codec used, 0: none*/
+  uint16_t dictionaryId;    /*CRC16 of the compression dictionary, 0: none*/
+  uint16_t delta;           /*1: the files are signed block by block for the delta transfer, 0: off*/
 } thermitParameters_t;
 
+#define THERMIT_PARAMETER_COUNT         13
+#define THERMIT_PARAMETER_COUNT_V10     12  /*peers without the delta field*/
+#define THERMIT_PARAMETER_COUNT_V9      11  /*peers without the dictionaryId field*/
+#define THERMIT_PARAMETER_COUNT_V8      10  /*peers without the compression field*/
+#define THERMIT_PARAMETER_COUNT_V7      9   /*peers without the fecParity field*/
+#define THERMIT_PARAMETER_COUNT_V6      8   /*peers without the fecGroup field*/
+#define THERMIT_PARAMETER_COUNT_V3      7   /*peers without the transferSlots field*/
+#define THERMIT_PARAMETER_COUNT_V2      6   /*peers without the maxFileSize64k field*/
+#define THERMIT_PARAMETER_COUNT_LEGACY  5   /*peers without the checkType field*/
 
-#define THERMIT_FILE_OFFSET(chunkNo, prv)   ((chunkNo) * ((prv)->parameters.chunkSize))
-#define THERMIT_CHUNK_LENGTH_TX(chunkNo, prv)  ((chunkNo) == (((prv)->txProgress.numberOfChunksNeeded)-1) ? ((prv)->txProgress.fileSize % ((prv)->parameters.chunkSize)) : (prv)->parameters.chunkSize)
-#define THERMIT_CHUNK_LENGTH_RX(chunkNo, prv)  ((chunkNo) == (((prv)->rxProgress.numberOfChunksNeeded)-1) ? ((prv)->rxProgress.fileSize % ((prv)->parameters.chunkSize)) : (prv)->parameters.chunkSize)
 
+#define THERMIT_FILE_OFFSET(chunkNo, prog)   ((uint32_t)(chunkNo) * ((prog)->chunkSize))
+#define THERMIT_CHUNK_LENGTH(chunkNo, prog)  ((chunkNo) == (((prog)->numberOfChunksNeeded)-1) ? ((prog)->fileSize - THERMIT_FILE_OFFSET(chunkNo, prog)) : (prog)->chunkSize)
 
-#define THERMIT_PROGRESS_STATUS_LENGTH                DIVISION_ROUNDED_UP(THERMIT_CHUNK_COUNT_MAX, 8)   
+
+/*the chunk status bitmap covers a window of chunks. In large file mode the window
+  slides forward as the chunks at its start get done; otherwise it covers the whole file.*/
+#define THERMIT_PROGRESS_WINDOW_CHUNKS                256
+#define THERMIT_PROGRESS_STATUS_LENGTH                (THERMIT_PROGRESS_WINDOW_CHUNKS / 8)
 #define THERMIT_PROGRESS_STATUS_BYTE_INDEX(chunkNo)   ((chunkNo) / 8)
 #define THERMIT_PROGRESS_STATUS_BIT_INDEX(chunkNo)    ((chunkNo) % 8)
 
 #define THERMIT_ADVANCE_TO_NEXT(var, max) ((((var)) + 1) % (max))
 
+#define THERMIT_GAP_QUEUE_LENGTH    8     /*gaps kept for early resending, older ones wait for the end of the pass*/
+#define THERMIT_READY_REPORTS       3     /*a received file is reported ready this many times, or again when asked*/
+
+/*the sender starts a new file only within this distance from its oldest unconfirmed file.
+  The receiver then remembers enough received files to recognize any repeated file info:
+  the window, and the older files finishing meanwhile.*/
+#define THERMIT_TX_WINDOW_FILES(slots)  (2 * (slots))
+#define THERMIT_READY_FILES             (THERMIT_TX_WINDOW_FILES(THERMIT_TRANSFER_SLOTS) + THERMIT_TRANSFER_SLOTS)
+#define THERMIT_FEC_PARITY_BUFFERS    GET_MAX(THERMIT_FEC_PARITY, 1)
+#define THERMIT_NACK_GAP_LENGTH       2   /*first chunk, count*/
+#define THERMIT_NACK_GAP_LENGTH_WIDE  6   /*32 bit first chunk, 16 bit count*/
+#define THERMIT_DELTA_SIGNATURE_LENGTH  8     /*32 bit weak and strong checksum of a block*/
+#define THERMIT_DELTA_LAST_FRAME        0x80  /*in the first byte of the signature frame: the report is due*/
+#define THERMIT_DELTA_FILE_HASH         0x40  /*in the first byte of the signature frame: the hash of the whole file follows the blocks*/
+#define THERMIT_DELTA_FILE_HASH_LENGTH  4
+#define THERMIT_DELTA_REPORT_NO_COPY    0x01  /*in the first byte of the report: there is no old copy, send the file as is*/
+
+#define GET_MAX(_a, _b) ((_a) > (_b) ? (_a) : (_b))
+#define GET_MIN(_a, _b) ((_a) < (_b) ? (_a) : (_b))
+
+typedef struct
+{
+  uint32_t firstChunk;
+  uint16_t count;
+} thermitGap_t;
+
+/*rx: a block of the incoming file as signed by the sender*/
+typedef struct
+{
+  uint32_t firstChunk;
+  uint32_t length;      /*bytes, the last block of the file may be shorter*/
+  uint32_t weak;
+  uint32_t strong;
+  bool found;
+} thermitDeltaBlock_t;
+
+/*rx: buffered reading of the old copy, for the rolling search*/
+typedef struct
+{
+  uint8_t buf[THERMIT_PAYLOAD_SIZE];
+  uint32_t start;
+  uint16_t len;
+} thermitDeltaReader_t;
+
 typedef struct
 {
   bool running;
-  uint16_t fileSize;
+  bool isLarge;         /*large file mode: wide frame header and sliding status window*/
+  uint32_t fileSize;
   thermitIoSlot_t fileHandle;
   uint8_t fileId;
-  uint8_t chunkNo;
+  uint32_t chunkNo;     /*tx: next chunk to be sent, rx: one past the highest chunk received*/
+  uint16_t chunkSize;
   uint8_t fileName[THERMIT_FILENAME_MAX+1];
 
-  uint8_t chunkStatus[THERMIT_PROGRESS_STATUS_LENGTH];     /*each bit represents one chunk: 1=dirty 0=done*/
+  uint8_t chunkStatus[THERMIT_PROGRESS_STATUS_LENGTH];     /*each bit represents one chunk from windowStart on: 1=dirty 0=done*/
+  uint32_t windowStart;                                     /*chunks before this are done, always a multiple of 8*/
   uint8_t progressPercent;
   uint16_t progressBytesDone;
   uint16_t oneChunkPercentScaled100;   // this value represents how many percents one chunk is of the whole file, multiplied by 100
-  uint8_t numberOfChunksNeeded;
+  uint32_t numberOfChunksNeeded;
   bool waitForFeedback;
+  bool resending;       /*chunks sent from now on have been sent already*/
+
+  /*tx: retransmission timer and round trip measurement*/
+  uint32_t lastSendMs;  /*latest chunk or file info of this file was sent*/
+  uint8_t rtoBackoff;   /*timeouts in a row, each one doubles the timeout*/
+  bool feedbackSeen;    /*the receiver has reported this file at least once*/
+  bool resendInfo;      /*the file info is sent again before the next chunk*/
+  bool infoHeld;        /*a burst has been sent, the rest waits until the receiver reports the file*/
+  bool rttTiming;       /*the round trip of rttChunk is being measured*/
+  bool probeSent;       /*the tail loss probe of this wait for feedback has been sent*/
+  uint32_t rttChunk;
+  uint32_t rttSentMs;
+
+  /*tx: chunks reported missing by the peer, resent before continuing the pass.
+    rx: gaps seen in the incoming chunk order, not reported yet.*/
+  thermitGap_t gapQueue[THERMIT_GAP_QUEUE_LENGTH];
+  uint8_t gapCount;
+  uint32_t ackedEnd;    /*tx: the selective acks have told about the chunks before this*/
+  uint32_t resendEnd;   /*tx: the resending pass skips from here to the chunks not sent yet, 0: it goes through*/
+
+  bool feedbackNow;     /*rx: the sender waits for feedback, report this file in the next frame*/
+
+  /*forward error correction: the parity frames of the current group, each one the sum of
+    the chunks times their coefficients. tx: the chunks sent for the first time,
+    rx: the chunks received for the first time, and the parity frames received.*/
+  uint8_t fecBuf[THERMIT_FEC_PARITY_BUFFERS][THERMIT_PAYLOAD_SIZE];
+  bool fecParityHeld[THERMIT_FEC_PARITY_BUFFERS];   /*rx: the parity frame is in fecBuf*/
+  uint32_t fecGroupStart;
+  uint16_t fecChunks;   /*chunks of the group in fecBuf*/
+  uint8_t fecPending;   /*tx: the group is complete, this many parity frames go next*/
+  uint8_t fecParitySent;    /*tx: parity frames of the group sent*/
+  uint32_t fecSentEnd;  /*tx: chunks before this have been sent at least once*/
+  uint32_t fecParityNext;   /*rx: first group after the latest parity frame*/
+
+  /*delta transfer. tx: the file is signed a round of blocks at a time, and only the chunks
+    the receiver does not find in its old copy are sent. rx: the old copy and where its
+    blocks were last found.*/
+  uint16_t deltaBlockChunks;  /*tx: chunks per signed block, 0: the file is sent as is*/
+  uint32_t deltaRoundStart;   /*tx: the blocks of the current round*/
+  uint32_t deltaRoundEnd;
+  uint32_t deltaFrameStart;   /*tx: first chunk of the latest signature frame*/
+  uint32_t deltaSignedEnd;    /*tx: chunks before this have been signed*/
+  uint32_t deltaHashedEnd;    /*tx: chunks before this are in deltaFileHash*/
+  uint32_t deltaFileHash;     /*tx: strong checksum of the file so far. rx: of the whole file, when deltaFileHashValid.*/
+  bool deltaFileHashValid;    /*rx: the sender has given the hash, the file is checked before it is closed*/
+  bool deltaWaiting;          /*tx: the round is signed, waiting for the report*/
+  bool deltaCopyOpen;         /*rx: the old copy is open*/
+  thermitIoSlot_t deltaCopy;
+  uint32_t deltaCopySize;
+  int32_t deltaShift;         /*rx: offset in the old copy minus offset in the file, of the latest block found*/
+  bool deltaReportDue;        /*rx: the last signature frame of the round has come*/
 } thermitProgress_t;
 
 
@@ -83,17 +198,52 @@ typedef struct
   bool ackReceived;
 
   uint8_t receivedFeedback;
-  uint8_t firstDirtyChunk;
+  uint32_t firstDirtyChunk;
 
   bool sendWTF;
 
   bool isMaster;
 
-  thermitProgress_t txProgress;
-  thermitProgress_t rxProgress;
+  /*transfers in progress. txProgress and rxProgress point to the slots of the frame
+    being built or handled, NULL if the frame is not about any file.*/
+  thermitProgress_t txSlots[THERMIT_TRANSFER_SLOTS];
+  thermitProgress_t rxSlots[THERMIT_TRANSFER_SLOTS];
+  thermitProgress_t *txProgress;
+  thermitProgress_t *rxProgress;
+  uint8_t txSlotNext;                                 /*round robin: slot to send the next chunk from*/
+  uint8_t feedbackNext;                               /*round robin: rx slot or received file to report next*/
+  uint8_t readyFileIds[THERMIT_READY_FILES];          /*received files, reported ready while the sender may still wait for it*/
+  uint8_t readyReports[THERMIT_READY_FILES];          /*how many more times each one is reported*/
+  uint8_t readyNext;
 
   thermitParameters_t parameters;
   thermitDiagnostics_t diagnostics;
+
+  /*frames of the current burst, collected for devWriteBatch*/
+  uint8_t burstBuf[THERMIT_BURST_LENGTH_MAX][THERMIT_MSG_SIZE_MAX];
+  int16_t burstLen[THERMIT_BURST_LENGTH_MAX];
+  uint8_t burstCount;
+
+  /*burst length adaptation: values seen at the previous adaptation round*/
+  uint8_t burstLastCount;
+  uint32_t burstLastCrcErrors;
+  uint32_t burstLossEvents;
+  uint32_t burstLastLossEvents;
+
+  /*round trip time estimation, the timeout itself is in diagnostics.rtoMs*/
+  uint32_t timeMaxMs;       /*wrap value of sysGetMs*/
+  bool rttValid;
+  uint32_t rttSmoothed8;    /*smoothed round trip time, ms * 8*/
+  uint32_t rttVariance4;    /*round trip time variation, ms * 4*/
+
+  /*keep-alive: the latest frame sent and received while running*/
+  uint32_t lastTxMs;
+  uint32_t lastRxMs;
+
+#if (THERMIT_COMPRESSION & THERMIT_CODEC_LZ_DICT)
+  /*shared compression dictionary and its index*/
+  lzDictionary_t dictionary;
+#endif
 } thermitPrv_t;
 
 static int deSerializeParameterStruct(uint8_t *buf, uint8_t len, thermitParameters_t *params);
@@ -105,16 +255,72 @@ static void debugDumpFrame(thermitPrv_t *prv, uint8_t *buf, uint8_t *prefix);
 static void debugDumpState(thermitPrv_t *prv, uint8_t *prefix, uint8_t *postfix);
 static void debugDumpProgress(thermitPrv_t *prv, thermitProgress_t *prog, uint8_t *prefix, uint8_t *postfix);
 
-static int progressInitialize(thermitPrv_t *prv, thermitProgress_t *prog, uint16_t fileSize);
-static int progressSetChunkStatus(thermitPrv_t *prv, thermitProgress_t *prog, uint8_t chunkNo, bool done);
-static bool progressGetChunkIsDone(thermitPrv_t *prv, thermitProgress_t *prog, uint8_t chunkNo);
-static bool progressGetFirstDirty(thermitPrv_t *prv, thermitProgress_t *prog, uint8_t *dirtyChunk);
-
+static thermitIoSlot_t fileOpen(thermitPrv_t *prv, uint8_t *fileName, thermitIoMode_t mode, uint32_t *fileSize);
+static int fileRead(thermitPrv_t *prv, thermitIoSlot_t slot, uint32_t offset, uint8_t *buf, int16_t maxLen);
+static int fileWrite(thermitPrv_t *prv, thermitIoSlot_t slot, uint32_t offset, uint8_t *buf, int16_t len);
+static void fileDiscard(thermitPrv_t *prv, thermitIoSlot_t slot);
+static uint16_t chunkCompress(thermitPrv_t *prv, uint8_t *src, uint16_t len, uint8_t *dst);
+static int chunkDecompress(thermitPrv_t *prv, uint8_t *src, uint16_t len, uint8_t *dst, uint16_t maxLen);
+static bool fileNeedsLargeMode(thermitPrv_t *prv, uint32_t fileSize);
+static int progressInitialize(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t fileSize);
+static void progressFillWindow(thermitProgress_t *prog, uint8_t firstByte);
+static int progressSetChunkStatus(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t chunkNo, bool done);
+static bool progressGetChunkIsDone(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t chunkNo);
+static bool progressChunkIsInWindow(thermitProgress_t *prog, uint32_t chunkNo);
+static bool progressGetFirstDirty(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t *dirtyChunk);
+static bool progressGetNextDirty(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t fromChunk, uint32_t *dirtyChunk);
+static bool progressGetLastDirty(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t beforeChunk, uint32_t *dirtyChunk);
+static void progressSetDoneBefore(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t chunkNo);
+static void progressMergeDirty(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t mapStart, uint8_t *dirtyMap, uint8_t len);
+static void progressSlideWindow(thermitProgress_t *prog);
+static void gapQueuePut(thermitProgress_t *prog, uint32_t firstChunk, uint32_t count);
+static bool resendQueueGet(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t *chunkNo);
+static void gapQueueDropDone(thermitPrv_t *prv, thermitProgress_t *prog);
+static uint32_t fecGroupLength(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t groupStart);
+static uint16_t fecParityCount(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t groupStart);
+static uint8_t fecCoefficient(uint16_t parityNo, uint16_t chunkIdx);
+static void fecMulAdd(thermitPrv_t *prv, uint8_t *dst, const uint8_t *src, uint8_t coef, uint16_t len);
+static bool fecGroupSelect(thermitProgress_t *prog, uint32_t groupStart);
+static void fecAdd(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t chunkNo, uint8_t *data, uint16_t len);
+static bool fecInvert(uint8_t matrix[][THERMIT_FEC_PARITY_BUFFERS], uint8_t inverse[][THERMIT_FEC_PARITY_BUFFERS], uint16_t n);
+static uint16_t fecRepair(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t chunkNo);
+static bool fecGapWaits(thermitPrv_t *prv, thermitProgress_t *prog);
+
+static thermitProgress_t *slotFind(thermitPrv_t *prv, thermitProgress_t *slots, uint8_t fileId);
+static thermitProgress_t *slotFindFree(thermitPrv_t *prv, thermitProgress_t *slots);
+static thermitProgress_t *txSlotNextToSend(thermitPrv_t *prv);
+static bool txWindowOpen(thermitPrv_t *prv);
+static thermitProgress_t *rxSlotWithGaps(thermitPrv_t *prv);
+static thermitProgress_t *rxSlotNeedingSelectiveAck(thermitPrv_t *prv);
+static void readyFileAdd(thermitPrv_t *prv, uint8_t fileId);
+static void readyFilesPrune(thermitPrv_t *prv, uint8_t newFileId);
+static bool feedbackPending(thermitPrv_t *prv);
+static bool feedbackUrgent(thermitPrv_t *prv);
+static bool readyFileRemind(thermitPrv_t *prv, uint8_t fileId);
+static void feedbackSelect(thermitPrv_t *prv);
+
+
+static uint32_t timeNow(thermitPrv_t *prv);
+static uint32_t timeElapsed(thermitPrv_t *prv, uint32_t sinceMs);
+static void rttInitialize(thermitPrv_t *prv);
+static void rttUpdate(thermitPrv_t *prv, uint32_t rttMs);
+static void rttChunkSent(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t chunkNo, bool resent);
+static void rttFeedbackReceived(thermitPrv_t *prv, thermitProgress_t *prog, bool fileIsReady);
+static bool rttFeedbackIsCurrent(thermitPrv_t *prv, thermitProgress_t *prog);
+static void txSlotsTimerCheck(thermitPrv_t *prv);
+static thermitProgress_t *txSlotInfoToResend(thermitPrv_t *prv);
+static thermitProgress_t *txSlotParityToSend(thermitPrv_t *prv);
+static bool keepAliveDue(thermitPrv_t *prv);
+static bool keepAlivePeerLost(thermitPrv_t *prv);
 
 static void initializeState(thermitPrv_t *prv);
 
 static int parsePacketContent(thermitPrv_t *prv);
 
+static bool frameAllowsWideHeader(uint8_t fCode);
+static uint8_t frameHeaderLength(uint8_t wireFCode);
+static uint8_t frameCapacity(thermitPrv_t *prv);
+static uint8_t compactFeedback(uint32_t feedback);
 static uint8_t* framePrepare(thermitPrv_t *prv);
 static int frameFinalize(thermitPrv_t *prv, uint8_t len);
 
@@ -132,18 +338,40 @@ static int waitForSyncProposal(thermitPrv_t *prv);
 static int waitForSyncAck(thermitPrv_t *prv);
 static int waitForSyncResponse(thermitPrv_t *prv);
 static int waitForDataMessage(thermitPrv_t *prv);
+static void handleFeedback(thermitPrv_t *prv);
+static void rxFileCheckReady(thermitPrv_t *prv, thermitProgress_t *rxProgress);
+static bool selectiveAckNeeded(thermitPrv_t *prv, thermitProgress_t *rxProgress);
+static uint8_t fillSelectiveAck(thermitPrv_t *prv, thermitProgress_t *rxProgress, uint8_t *plBuf);
+static bool mergeSelectiveAck(thermitPrv_t *prv, thermitProgress_t *txProgress, uint8_t *map, uint8_t len);
+static uint16_t deltaBlockChunks(thermitPrv_t *prv, thermitProgress_t *txProgress);
+static uint8_t fillDeltaSignatures(thermitPrv_t *prv, thermitProgress_t *txProgress, uint8_t *plBuf, uint8_t capacity);
+static void deltaFrameSelect(thermitProgress_t *txProgress, uint32_t chunkNo);
+static void deltaRewind(thermitProgress_t *txProgress);
+static int deltaReadByte(thermitPrv_t *prv, thermitProgress_t *rxProgress, thermitDeltaReader_t *reader, uint32_t pos);
+static bool deltaBlockMatches(thermitPrv_t *prv, thermitProgress_t *rxProgress, uint32_t offset, thermitDeltaBlock_t *block);
+static void deltaBlockCopy(thermitPrv_t *prv, thermitProgress_t *rxProgress, uint32_t offset, thermitDeltaBlock_t *block);
+static bool deltaBlockFind(thermitPrv_t *prv, thermitProgress_t *rxProgress, thermitDeltaBlock_t *block, uint32_t blockLength);
+static void deltaSearch(thermitPrv_t *prv, thermitProgress_t *rxProgress, thermitDeltaBlock_t *blocks, uint8_t count, uint32_t blockLength);
+static void deltaCopyClose(thermitPrv_t *prv, thermitProgress_t *rxProgress);
+static bool deltaFileHashMatches(thermitPrv_t *prv, thermitProgress_t *rxProgress);
+static void handleDeltaSignatures(thermitPrv_t *prv);
+static void handleDeltaReport(thermitPrv_t *prv);
+static thermitProgress_t *rxSlotWithDeltaReport(thermitPrv_t *prv);
+uint32_t getFeedback(thermitPrv_t *prv);
 
 
 
 
 static thermitState_t mStep(thermit_t *inst);
 static int mReset(thermit_t *inst);
+static int mGetDiagnostics(thermit_t *inst, thermitDiagnostics_t *diagnostics);
 
 
 static const struct thermitMethodTable_t mTable =
 {
   mStep,
   mReset,
+  mGetDiagnostics,
 };
 
 
@@ -163,13 +391,13 @@ static bool validateTargetAdaptation(thermitTargetAdaptationInterface_t *targetI
     return false;
   if(targetIf->devWrite == NULL)
     return false;
-  if(targetIf->fileOpen == NULL)
+  if((targetIf->fileOpen == NULL) && (targetIf->fileOpen32 == NULL))
     return false;
   if(targetIf->fileClose == NULL)
     return false;
-  if(targetIf->fileRead == NULL)
+  if((targetIf->fileRead == NULL) && (targetIf->fileRead32 == NULL))
     return false;
-  if(targetIf->fileWrite == NULL)
+  if((targetIf->fileWrite == NULL) && (targetIf->fileWrite32 == NULL))
     return false;
   if(targetIf->sysGetMs == NULL)
     return false;
@@ -227,8 +455,36 @@ static void initializeParameters(thermitPrv_t *prv)
     params->version = THERMIT_VERSION;
     params->chunkSize = THERMIT_PAYLOAD_SIZE;
     params->maxFileSize = params->chunkSize * THERMIT_CHUNK_COUNT_MAX;
-    params->burstLength = 4;
+    params->burstLength = THERMIT_BURST_LENGTH_MAX;   /*the longest we can take, adapted at run time*/
     params->keepAliveMs = 1000;
+    params->checkType = (prv->targetIf.sysCrc32c ? THERMIT_CHECK_CRC32C : THERMIT_CHECK_CRC16);
+    params->maxFileSize64k = THERMIT_LARGE_FILE_SIZE_MAX_64K;
+    params->transferSlots = THERMIT_TRANSFER_SLOTS;
+    params->fecGroup = THERMIT_FEC_GROUP;
+    params->fecParity = THERMIT_FEC_PARITY;
+    params->compression = THERMIT_COMPRESSION;
+    params->dictionaryId = 0;
+    params->delta = (THERMIT_DELTA ? 1 : 0);
+
+#if (THERMIT_COMPRESSION & THERMIT_CODEC_LZ_DICT)
+    /*the dictionary is known by its checksum, so that both ends surely have the same one*/
+    if(prv->targetIf.sysDictionary)
+    {
+      uint16_t len = 0;
+      const uint8_t *data = prv->targetIf.sysDictionary(&len);
+
+      if(data && (len > 0))
+      {
+        lzDictionaryInit(&(prv->dictionary), data, len);
+        params->dictionaryId = prv->targetIf.sysCrc16(prv->dictionary.data, prv->dictionary.len);
+        params->dictionaryId = (params->dictionaryId ? params->dictionaryId : 1);
+      }
+    }
+#endif
+    if(params->dictionaryId == 0)
+    {
+      params->compression &= (uint16_t)~THERMIT_CODEC_LZ_DICT;
+    }
   }
 }
 
@@ -301,8 +557,8 @@ void thermitDelete(thermit_t *inst)
   {
     thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
     prv->comLink = tgt->devClose(prv->comLink);
-    releaseInstance(prv);
     DEBUG_INFO(prv, "instance deleted\r\n");
+    releaseInstance(prv);
   }
   else
   {
@@ -311,58 +567,230 @@ void thermitDelete(thermit_t *inst)
 }
 
 
-static int progressInitialize(thermitPrv_t *prv, thermitProgress_t *progress, uint16_t fileSize)
+/*file access through the 32 bit callbacks when the target has them. The 16 bit
+  ones can reach only the first 64k of a file.*/
+static thermitIoSlot_t fileOpen(thermitPrv_t *prv, uint8_t *fileName, thermitIoMode_t mode, uint32_t *fileSize)
+{
+  thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
+  thermitIoSlot_t ret = -1;
+
+  if(tgt->fileOpen32)
+  {
+    ret = tgt->fileOpen32(fileName, mode, fileSize);
+  }
+  else if(*fileSize <= 0xFFFF)
+  {
+    uint16_t size16 = (uint16_t)*fileSize;
+
+    ret = tgt->fileOpen(fileName, mode, &size16);
+    *fileSize = size16;
+  }
+  else
+  {
+    DEBUG_ERR(prv, "file size %lu needs the 32 bit file interface\r\n", (unsigned long)*fileSize);
+  }
+  return ret;
+}
+
+static int fileRead(thermitPrv_t *prv, thermitIoSlot_t slot, uint32_t offset, uint8_t *buf, int16_t maxLen)
+{
+  thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
+  int ret = -1;
+
+  if(tgt->fileRead32)
+  {
+    ret = tgt->fileRead32(slot, offset, buf, maxLen);
+  }
+  else if(offset <= 0xFFFF)
+  {
+    ret = tgt->fileRead(slot, (uint16_t)offset, buf, maxLen);
+  }
+  return ret;
+}
+
+static int fileWrite(thermitPrv_t *prv, thermitIoSlot_t slot, uint32_t offset, uint8_t *buf, int16_t len)
 {
+  thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
   int ret = -1;
 
-  if(prv && progress && (fileSize <= prv->parameters.maxFileSize) && (fileSize > 0))
+  if(tgt->fileWrite32)
   {
-    uint8_t fullBytes;
-    uint8_t extraBits;
-    uint8_t byteIdx, bitIdx;
-    uint8_t extraByteValue = 0;
+    ret = tgt->fileWrite32(slot, offset, buf, len);
+  }
+  else if(offset <= 0xFFFF)
+  {
+    ret = tgt->fileWrite(slot, (uint16_t)offset, buf, len);
+  }
+  return ret;
+}
+
+/*an incoming file that will not be completed. Without the callback it is only closed.*/
+static void fileDiscard(thermitPrv_t *prv, thermitIoSlot_t slot)
+{
+  thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
+
+  if(tgt->fileDiscard)
+  {
+    (void)tgt->fileDiscard(slot);
+  }
+  else
+  {
+    (void)tgt->fileClose(slot);
+  }
+}
 
-    memset(progress, 0, sizeof(thermitProgress_t));
+/*compressed length of the chunk with the negotiated codec, 0 if it does not get shorter*/
+static uint16_t chunkCompress(thermitPrv_t *prv, uint8_t *src, uint16_t len, uint8_t *dst)
+{
+  uint16_t ret = 0;
 
-    progress->fileSize = fileSize;
+  switch(prv->parameters.compression)
+  {
+    case THERMIT_CODEC_LZ:
+      ret = lzCompress(src, len, dst, len - 1);
+      break;
 
-    /*remember number of chunks needed for this file*/
-    progress->numberOfChunksNeeded = DIVISION_ROUNDED_UP(fileSize, prv->parameters.chunkSize);
+#if (THERMIT_COMPRESSION & THERMIT_CODEC_LZ_DICT)
+    case THERMIT_CODEC_LZ_DICT:
+      ret = lzCompressDict(&(prv->dictionary), src, len, dst, len - 1);
+      break;
+#endif
 
-    /*preparation*/
-    fullBytes = (progress->numberOfChunksNeeded / 8);
-    extraBits = (progress->numberOfChunksNeeded % 8);
+    default:
+      break;
+  }
+  return ret;
+}
 
-    /*mark all used chunks dirty. First, go through full bytes*/
-    for(byteIdx = 0; byteIdx < fullBytes; byteIdx++)
+/*chunk length, -1 if the compressed chunk is broken*/
+static int chunkDecompress(thermitPrv_t *prv, uint8_t *src, uint16_t len, uint8_t *dst, uint16_t maxLen)
+{
+  int ret = -1;
+
+  switch(prv->parameters.compression)
+  {
+    case THERMIT_CODEC_LZ:
+      ret = lzDecompress(src, len, dst, maxLen);
+      break;
+
+#if (THERMIT_COMPRESSION & THERMIT_CODEC_LZ_DICT)
+    case THERMIT_CODEC_LZ_DICT:
+      ret = lzDecompressDict(&(prv->dictionary), src, len, dst, maxLen);
+      break;
+#endif
+
+    default:
+      break;
+  }
+  return ret;
+}
+
+/*the files that do not fit into the compact header go in large file mode, if negotiated*/
+static bool fileNeedsLargeMode(thermitPrv_t *prv, uint32_t fileSize)
+{
+  return (fileSize > prv->parameters.maxFileSize);
+}
+
+static int progressInitialize(thermitPrv_t *prv, thermitProgress_t *progress, uint32_t fileSize)
+{
+  int ret = -1;
+
+  if(prv && progress && (fileSize > 0))
+  {
+    bool isLarge = fileNeedsLargeMode(prv, fileSize);
+
+    if(isLarge && ((prv->parameters.version < THERMIT_VERSION_LARGE_FILES) || (fileSize > ((uint32_t)prv->parameters.maxFileSize64k << 16))))
+    {
+      DEBUG_ERR(prv, "file size %lu not supported\r\n", (unsigned long)fileSize);
+    }
+    else
     {
-      progress->chunkStatus[byteIdx] = 0xFF; /*all bits marked dirty*/
+      memset(progress, 0, sizeof(thermitProgress_t));
+
+      progress->fileSize = fileSize;
+      progress->isLarge = isLarge;
+
+      /*the wide header takes its room from the chunk*/
+      progress->chunkSize = prv->parameters.chunkSize - (isLarge ? (THERMIT_HEADER_LENGTH_WIDE - THERMIT_HEADER_LENGTH) : 0);
+
+      /*remember number of chunks needed for this file*/
+      progress->numberOfChunksNeeded = DIVISION_ROUNDED_UP(fileSize, progress->chunkSize);
+
+      /*mark all chunks of the first window dirty*/
+      progress->windowStart = 0;
+      memset(progress->chunkStatus, 0, sizeof(progress->chunkStatus));
+      progressFillWindow(progress, 0);
+
+      /*calculate how many percents of the whole file is transferred in one chunk. Value 1234 means 12.34%*/
+      progress->oneChunkPercentScaled100 = ((100 * 100) / GET_MIN(progress->numberOfChunksNeeded, 100 * 100));
+
+      progress->running = true;
+
+      ret = 0;
     }
+  }
+  return ret;
+}
+
+/*mark the chunks of the window dirty, starting from status byte firstByte*/
+static void progressFillWindow(thermitProgress_t *progress, uint8_t firstByte)
+{
+  uint8_t byteIdx;
+
+  for(byteIdx = firstByte; byteIdx < THERMIT_PROGRESS_STATUS_LENGTH; byteIdx++)
+  {
+    uint32_t chunkNo = progress->windowStart + (uint32_t)byteIdx * 8;
+    uint8_t value = 0;
 
-    /*then, only the used bits in the highest byte will be marked dirty*/
-    for(bitIdx=0; bitIdx < extraBits; bitIdx++)
+    if(chunkNo + 8 <= progress->numberOfChunksNeeded)
     {
-      extraByteValue |= (1 << bitIdx);
+      value = 0xFF; /*all bits marked dirty*/
     }
-    progress->chunkStatus[fullBytes] = extraByteValue;
+    else if(chunkNo < progress->numberOfChunksNeeded)
+    {
+      /*only the used bits in the highest byte will be marked dirty*/
+      value = (uint8_t)((1 << (progress->numberOfChunksNeeded - chunkNo)) - 1);
+    }
+    progress->chunkStatus[byteIdx] = value;
+  }
+}
 
-    /*calculate how many percents of the whole file is transferred in one chunk. Value 1234 means 12.34%*/
-    progress->oneChunkPercentScaled100 = ((100 * 100) / progress->numberOfChunksNeeded);
+/*large file mode: drop the done bytes at the start of the window and bring in new dirty chunks*/
+static void progressSlideWindow(thermitProgress_t *progress)
+{
+  if(progress->isLarge)
+  {
+    uint8_t doneBytes = 0;
 
-    progress->running = true;
+    while((doneBytes < THERMIT_PROGRESS_STATUS_LENGTH) && (progress->chunkStatus[doneBytes] == 0) &&
+          (progress->windowStart + ((uint32_t)doneBytes + 1) * 8 < progress->numberOfChunksNeeded))
+    {
+      doneBytes++;
+    }
 
-    ret = 0;
+    if(doneBytes > 0)
+    {
+      memmove(progress->chunkStatus, &(progress->chunkStatus[doneBytes]), THERMIT_PROGRESS_STATUS_LENGTH - doneBytes);
+      progress->windowStart += (uint32_t)doneBytes * 8;
+      progressFillWindow(progress, THERMIT_PROGRESS_STATUS_LENGTH - doneBytes);
+    }
   }
-  return ret;
 }
 
-static int progressSetChunkStatus(thermitPrv_t *prv, thermitProgress_t *progress, uint8_t chunkNo, bool done)
+static bool progressChunkIsInWindow(thermitProgress_t *progress, uint32_t chunkNo)
+{
+  return (chunkNo >= progress->windowStart) && (chunkNo - progress->windowStart < THERMIT_PROGRESS_WINDOW_CHUNKS) &&
+         (chunkNo < progress->numberOfChunksNeeded);
+}
+
+static int progressSetChunkStatus(thermitPrv_t *prv, thermitProgress_t *progress, uint32_t chunkNo, bool done)
 {
   int ret = -1;
-  if(prv && progress && (chunkNo < progress->numberOfChunksNeeded))
+  if(prv && progress && progressChunkIsInWindow(progress, chunkNo))
   {
-    uint8_t byteIdx = THERMIT_PROGRESS_STATUS_BYTE_INDEX(chunkNo);
-    uint8_t bitIdx = THERMIT_PROGRESS_STATUS_BIT_INDEX(chunkNo);
+    uint32_t windowIdx = chunkNo - progress->windowStart;
+    uint8_t byteIdx = THERMIT_PROGRESS_STATUS_BYTE_INDEX(windowIdx);
+    uint8_t bitIdx = THERMIT_PROGRESS_STATUS_BIT_INDEX(windowIdx);
 
     if(done)
     {
@@ -373,277 +801,1676 @@ static int progressSetChunkStatus(thermitPrv_t *prv, thermitProgress_t *progress
       progress->chunkStatus[byteIdx] |= (1 << bitIdx);  /*set bit -> dirty*/
     } 
 
-    DEBUG_INFO(prv, "chunk %d = %s\r\n", chunkNo, done?"OK":"DIRTY");
+    DEBUG_INFO(prv, "chunk %lu = %s\r\n", (unsigned long)chunkNo, done?"OK":"DIRTY");
+
+    progressSlideWindow(progress);
 
     ret = 0;
   }
   return ret;
 }
 
-static bool progressGetChunkIsDone(thermitPrv_t *prv, thermitProgress_t *progress, uint8_t chunkNo)
+static bool progressGetChunkIsDone(thermitPrv_t *prv, thermitProgress_t *progress, uint32_t chunkNo)
 {
   bool chunkIsDone = false;
   if(prv && progress && (chunkNo < progress->numberOfChunksNeeded))
   {
-    uint8_t byteIdx = THERMIT_PROGRESS_STATUS_BYTE_INDEX(chunkNo);
-    uint8_t bitIdx = THERMIT_PROGRESS_STATUS_BIT_INDEX(chunkNo);
-
-    if((progress->chunkStatus[byteIdx] & (1 << bitIdx)) == 0)
+    if(chunkNo < progress->windowStart)
     {
       chunkIsDone = true;
-    } 
+    }
+    else if(progressChunkIsInWindow(progress, chunkNo))
+    {
+      uint32_t windowIdx = chunkNo - progress->windowStart;
+      uint8_t byteIdx = THERMIT_PROGRESS_STATUS_BYTE_INDEX(windowIdx);
+      uint8_t bitIdx = THERMIT_PROGRESS_STATUS_BIT_INDEX(windowIdx);
+
+      if((progress->chunkStatus[byteIdx] & (1 << bitIdx)) == 0)
+      {
+        chunkIsDone = true;
+      } 
+    }
   }
   return chunkIsDone;
 }
 
-static bool progressGetFirstDirty(thermitPrv_t *prv, thermitProgress_t *progress, uint8_t *dirtyChunk)
+static bool progressGetFirstDirty(thermitPrv_t *prv, thermitProgress_t *progress, uint32_t *dirtyChunk)
+{
+  return progressGetNextDirty(prv, progress, 0, dirtyChunk);
+}
+
+/*the highest dirty chunk before the given one, searched within the window*/
+static bool progressGetLastDirty(thermitPrv_t *prv, thermitProgress_t *progress, uint32_t beforeChunk, uint32_t *dirtyChunk)
 {
   bool ret = false;
 
   if(prv && progress && dirtyChunk)
   {
-    uint8_t bitIdx = 0;
-    uint8_t byteIdx = 0;
-    uint8_t chunksLeft = progress->numberOfChunksNeeded;
+    uint32_t chunkNo = GET_MIN(beforeChunk, progress->numberOfChunksNeeded);
 
-    while(chunksLeft--)
+    while(chunkNo > progress->windowStart)
     {
-      uint8_t walkedByte = progress->chunkStatus[byteIdx];
+      chunkNo--;
 
-      if(walkedByte == 0)
+      if(!progressGetChunkIsDone(prv, progress, chunkNo))
       {
-        /*there's no point in walking through this byte as it is full zeros. Jump to next if possible.*/
-        uint8_t jumps = 8 - bitIdx;
-
-        if(chunksLeft > jumps)
-        {
-          /*we are jumping to bit0 of the next byte*/
-          bitIdx = 0;
-          byteIdx++;
-          chunksLeft -= jumps;
-        }
-        else
-        {
-          /*there's no next byte available, quit*/
-          break;
-        }
+        *dirtyChunk = chunkNo;
+        ret = true;
+        break;
       }
-      else
+    }
+  }
+  return ret;
+}
+
+/*the chunks after the window are all dirty*/
+static bool progressGetNextDirty(thermitPrv_t *prv, thermitProgress_t *progress, uint32_t fromChunk, uint32_t *dirtyChunk)
+{
+  bool ret = false;
+
+  if(prv && progress && dirtyChunk)
+  {
+    uint32_t windowIdx = ((fromChunk > progress->windowStart) ? (fromChunk - progress->windowStart) : 0);
+
+    while(progress->windowStart + windowIdx < progress->numberOfChunksNeeded)
+    {
+      uint8_t bitIdx = THERMIT_PROGRESS_STATUS_BIT_INDEX(windowIdx);
+      uint8_t walkedByte;
+
+      if(windowIdx >= THERMIT_PROGRESS_WINDOW_CHUNKS)
       {
-        if(((walkedByte >> bitIdx) & 0x01) == 0x01)
-        {
-          /*found!*/
-          *dirtyChunk = (byteIdx * 8) + bitIdx;
+        /*found, outside of the window*/
+        *dirtyChunk = progress->windowStart + windowIdx;
+        ret = true;
+        break;
+      }
 
-          //DEBUG_INFO(prv, "first dirty chunk = %d\r\n", *dirtyChunk);
+      walkedByte = progress->chunkStatus[THERMIT_PROGRESS_STATUS_BYTE_INDEX(windowIdx)] >> bitIdx;
 
-          ret = true;
-          break;  /*stop searching*/
-        }
+      if(walkedByte == 0)
+      {
+        /*there's no point in walking through the rest of this byte as it is full zeros. Jump to bit0 of the next byte.*/
+        windowIdx += 8 - bitIdx;
+      }
+      else if((walkedByte & 0x01) == 0x01)
+      {
+        /*found!*/
+        *dirtyChunk = progress->windowStart + windowIdx;
 
+        ret = true;
+        break;  /*stop searching*/
+      }
+      else
+      {
         /*advance to next*/
-        bitIdx++;
-        if(bitIdx == 8)
-        {
-          byteIdx++;
-        }
+        windowIdx++;
       }
     }
   }
   return ret;
 }
 
-#if THERMIT_DEBUG >= THERMIT_DBG_LVL_INFO
-#define PROGRESS_DUMP_LINE_LENGTH   40
-static void debugDumpProgress(thermitPrv_t *prv, thermitProgress_t *prog, uint8_t *prefix, uint8_t *postfix)
+/*the peer has received all chunks before chunkNo*/
+static void progressSetDoneBefore(thermitPrv_t *prv, thermitProgress_t *progress, uint32_t chunkNo)
 {
-  uint8_t i;
-  uint8_t byteIdx = 0;
-  uint8_t bitIdx = 0;
-
-  if(prv && prog)
+  if(prv && progress && (chunkNo > progress->windowStart))
   {
-    uint8_t linesNeeded = DIVISION_ROUNDED_UP(prog->numberOfChunksNeeded, PROGRESS_DUMP_LINE_LENGTH);
-    uint8_t totalChunksToBeReported = prog->numberOfChunksNeeded;
-    bool finalRound = false;
+    uint32_t windowIdx = GET_MIN(chunkNo, progress->numberOfChunksNeeded) - progress->windowStart;
+    uint8_t byteIdx;
+    uint8_t fullBytes;
 
-    if (prefix)
+    windowIdx = GET_MIN(windowIdx, THERMIT_PROGRESS_WINDOW_CHUNKS);
+    fullBytes = THERMIT_PROGRESS_STATUS_BYTE_INDEX(windowIdx);
+
+    for(byteIdx = 0; byteIdx < fullBytes; byteIdx++)
     {
-      DEBUG_INFO(prv, "%s", prefix);
+      progress->chunkStatus[byteIdx] = 0;
     }
 
-    if(totalChunksToBeReported > 0)
+    if(THERMIT_PROGRESS_STATUS_BIT_INDEX(windowIdx) > 0)
     {
-      for(i = 0; i < linesNeeded; i++)
-      {
-        uint8_t line[PROGRESS_DUMP_LINE_LENGTH+1];
-        uint8_t cntr = PROGRESS_DUMP_LINE_LENGTH;
-        uint8_t *ptr = line;
+      progress->chunkStatus[fullBytes] &= (uint8_t)(0xFF << THERMIT_PROGRESS_STATUS_BIT_INDEX(windowIdx));
+    }
 
-        while(cntr--)
-        {
-          *(ptr++) = ((((prog->chunkStatus[byteIdx] >> bitIdx) & 0x01) == 0) ? 'G' : '-');
-          totalChunksToBeReported--;
-          if(totalChunksToBeReported == 0)
-          {
-            finalRound = true;  // force breaking out from for loop
-            break;            // break out from while loop
-          }
+    progressSlideWindow(progress);
+  }
+}
 
-          /*advance to next*/
-          bitIdx++;
-          if(bitIdx == 8)
-          {
-            bitIdx=0;
-            byteIdx++;
-          }
-        }
+/*the peer reports its dirty chunks from mapStart on: a chunk stays dirty only if both ends see it dirty.
+  This way an old, delayed report can not make already acknowledged chunks dirty again.*/
+static void progressMergeDirty(thermitPrv_t *prv, thermitProgress_t *progress, uint32_t mapStart, uint8_t *dirtyMap, uint8_t len)
+{
+  if(prv && progress && dirtyMap && ((mapStart % 8) == 0))
+  {
+    uint8_t i;
 
-        *(ptr++) = 0; //terminate
-        DEBUG_INFO(prv, "%03d: [", i*PROGRESS_DUMP_LINE_LENGTH);
-        DEBUG_INFO(prv, "%s]", line);
-        if(finalRound)
+    for(i = 0; i < len; i++)
+    {
+      uint32_t chunkNo = mapStart + (uint32_t)i * 8;
+
+      if(chunkNo >= progress->windowStart)
+      {
+        uint32_t byteIdx = THERMIT_PROGRESS_STATUS_BYTE_INDEX(chunkNo - progress->windowStart);
+
+        if(byteIdx >= THERMIT_PROGRESS_STATUS_LENGTH)
         {
-          break;  /*break out from for loop*/
+          break;
         }
-        DEBUG_INFO(prv, "\r\n");
+        progress->chunkStatus[byteIdx] &= dirtyMap[i];
       }
     }
 
-    if (postfix)
-    {
-      DEBUG_INFO(prv, "%s", postfix);
-    }
+    progressSlideWindow(progress);
   }
 }
-#else
-static void debugDumpProgress(thermitPrv_t *prv, thermitProgress_t *prog, uint8_t *prefix, uint8_t *postfix)
+
+/*remember a range of missing chunks. If the queue is full, the range is dropped
+  and the chunks are handled by the normal feedback at the end of the pass.*/
+static void gapQueuePut(thermitProgress_t *progress, uint32_t firstChunk, uint32_t count)
 {
-  (void)prv;
-  (void)prog;
-  (void)prefix;
-  (void)postfix;
+  if((progress->gapCount < THERMIT_GAP_QUEUE_LENGTH) && (count > 0))
+  {
+    progress->gapQueue[progress->gapCount].firstChunk = firstChunk;
+    progress->gapQueue[progress->gapCount].count = (uint16_t)GET_MIN(count, THERMIT_PROGRESS_WINDOW_CHUNKS);
+    progress->gapCount++;
+  }
 }
-#endif
 
+/*take the next chunk reported missing and still not acknowledged*/
+static bool resendQueueGet(thermitPrv_t *prv, thermitProgress_t *progress, uint32_t *chunkNo)
+{
+  bool ret = false;
 
+  while((progress->gapCount > 0) && !ret)
+  {
+    thermitGap_t *gap = &(progress->gapQueue[0]);
+    uint32_t candidate = gap->firstChunk;
 
+    gap->firstChunk++;
+    gap->count--;
+
+    if(gap->count == 0)
+    {
+      progress->gapCount--;
+      memmove(&(progress->gapQueue[0]), &(progress->gapQueue[1]), progress->gapCount * sizeof(thermitGap_t));
+    }
+
+    if(!progressGetChunkIsDone(prv, progress, candidate) && progressChunkIsInWindow(progress, candidate))
+    {
+      *chunkNo = candidate;
+      ret = true;
+    }
+  }
+  return ret;
+}
+
+/*rx: the chunks rebuilt from a parity frame are not reported missing*/
+static void gapQueueDropDone(thermitPrv_t *prv, thermitProgress_t *progress)
+{
+  uint8_t i = 0;
+
+  while(i < progress->gapCount)
+  {
+    thermitGap_t *gap = &(progress->gapQueue[i]);
+
+    while((gap->count > 0) && progressGetChunkIsDone(prv, progress, gap->firstChunk))
+    {
+      gap->firstChunk++;
+      gap->count--;
+    }
+    while((gap->count > 0) && progressGetChunkIsDone(prv, progress, gap->firstChunk + gap->count - 1))
+    {
+      gap->count--;
+    }
+
+    if(gap->count == 0)
+    {
+      progress->gapCount--;
+      memmove(gap, &(progress->gapQueue[i + 1]), (progress->gapCount - i) * sizeof(thermitGap_t));
+    }
+    else
+    {
+      i++;
+    }
+  }
+}
+
+/*chunks of a parity group: fecGroup, or less at the end of the file*/
+static uint32_t fecGroupLength(thermitPrv_t *prv, thermitProgress_t *progress, uint32_t groupStart)
+{
+  return GET_MIN((uint32_t)prv->parameters.fecGroup, progress->numberOfChunksNeeded - groupStart);
+}
+
+/*parity frames of the group. A small file has an 8 bit chunk number in the frame header,
+  the parity frames whose number does not fit there are left out.*/
+static uint16_t fecParityCount(thermitPrv_t *prv, thermitProgress_t *progress, uint32_t groupStart)
+{
+  uint16_t ret = prv->parameters.fecParity;
+
+  if(!progress->isLarge && (groupStart + ret > 0x100))
+  {
+    ret = (uint16_t)(0x100 - groupStart);
+  }
+  return ret;
+}
+
+/*coefficient of the chunk in the parity frame. The Cauchy matrix 1 / (x_j + y_i) with
+  x_j = 255 - parityNo and y_i = chunkIdx is scaled to have ones in the first row and
+  column: parity frame 0 stays the XOR of the group, and as every square submatrix is
+  still invertible, any K of the K + M frames of a group rebuild it.*/
+static uint8_t fecCoefficient(uint16_t parityNo, uint16_t chunkIdx)
+{
+  uint8_t x = (uint8_t)(255 - parityNo);
+  uint8_t y = (uint8_t)chunkIdx;
+
+  return gf256Div(gf256Mul(255 ^ y, x), gf256Mul(x ^ y, 255));
+}
+
+static void fecMulAdd(thermitPrv_t *prv, uint8_t *dst, const uint8_t *src, uint8_t coef, uint16_t len)
+{
+  thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
+
+  if(tgt->sysGf256MulAdd)
+  {
+    tgt->sysGf256MulAdd(dst, src, coef, len);
+  }
+  else
+  {
+    gf256MulAdd(dst, src, coef, len);
+  }
+}
+
+/*true if the parity of the group is being collected. A newer group, or any group when
+  nothing has been collected, starts over. An older one is left out.*/
+static bool fecGroupSelect(thermitProgress_t *progress, uint32_t groupStart)
+{
+  uint16_t j;
+  bool collecting = (progress->fecChunks > 0);
+
+  for(j = 0; j < THERMIT_FEC_PARITY_BUFFERS; j++)
+  {
+    collecting = collecting || progress->fecParityHeld[j];
+  }
+
+  if((groupStart > progress->fecGroupStart) || !collecting)
+  {
+    memset(progress->fecBuf, 0, sizeof(progress->fecBuf));
+    memset(progress->fecParityHeld, 0, sizeof(progress->fecParityHeld));
+    progress->fecGroupStart = groupStart;
+    progress->fecChunks = 0;
+  }
+
+  return (groupStart == progress->fecGroupStart);
+}
+
+/*add a chunk to the parity frames of its group*/
+static void fecAdd(thermitPrv_t *prv, thermitProgress_t *progress, uint32_t chunkNo, uint8_t *data, uint16_t len)
+{
+  uint16_t groupSize = prv->parameters.fecGroup;
+
+  if(groupSize > 0)
+  {
+    uint32_t groupStart = chunkNo - (chunkNo % groupSize);
+
+    if(fecGroupSelect(progress, groupStart))
+    {
+      uint16_t j;
+
+      for(j = 0; j < prv->parameters.fecParity; j++)
+      {
+        fecMulAdd(prv, progress->fecBuf[j], data, fecCoefficient(j, (uint16_t)(chunkNo - groupStart)), len);
+      }
+      progress->fecChunks++;
+
+      /*tx: all chunks of the group have been sent in order*/
+      if(progress->fecChunks == fecGroupLength(prv, progress, groupStart))
+      {
+        progress->fecPending = (uint8_t)fecParityCount(prv, progress, groupStart);
+        progress->fecParitySent = 0;
+      }
+    }
+  }
+}
+
+/*Gauss-Jordan elimination in GF(256). The matrix is destroyed.*/
+static bool fecInvert(uint8_t matrix[][THERMIT_FEC_PARITY_BUFFERS], uint8_t inverse[][THERMIT_FEC_PARITY_BUFFERS], uint16_t n)
+{
+  uint16_t row, col, k;
+
+  for(row = 0; row < n; row++)
+  {
+    for(col = 0; col < n; col++)
+    {
+      inverse[row][col] = (row == col) ? 1 : 0;
+    }
+  }
+
+  for(col = 0; col < n; col++)
+  {
+    uint16_t pivot = col;
+    uint8_t scale;
+
+    while((pivot < n) && (matrix[pivot][col] == 0))
+    {
+      pivot++;
+    }
+    if(pivot == n)
+    {
+      return false;
+    }
+
+    for(k = 0; k < n; k++)
+    {
+      uint8_t tmp = matrix[col][k];
+      matrix[col][k] = matrix[pivot][k];
+      matrix[pivot][k] = tmp;
+      tmp = inverse[col][k];
+      inverse[col][k] = inverse[pivot][k];
+      inverse[pivot][k] = tmp;
+    }
+
+    scale = matrix[col][col];
+    for(k = 0; k < n; k++)
+    {
+      matrix[col][k] = gf256Div(matrix[col][k], scale);
+      inverse[col][k] = gf256Div(inverse[col][k], scale);
+    }
+
+    for(row = 0; row < n; row++)
+    {
+      uint8_t factor = matrix[row][col];
+
+      if((row != col) && (factor != 0))
+      {
+        for(k = 0; k < n; k++)
+        {
+          matrix[row][k] ^= gf256Mul(factor, matrix[col][k]);
+          inverse[row][k] ^= gf256Mul(factor, inverse[col][k]);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+/*rx: rebuild the missing chunks of the group of chunkNo when there are no more of them
+  than parity frames received. With the received chunks taken out, each parity frame is
+  the sum of the missing chunks times their coefficients, and the inverse of those
+  coefficients gives the chunks. Returns the number of chunks rebuilt.*/
+static uint16_t fecRepair(thermitPrv_t *prv, thermitProgress_t *progress, uint32_t chunkNo)
+{
+  uint16_t ret = 0;
+  uint16_t groupSize = prv->parameters.fecGroup;
+
+  if((groupSize > 0) && (progress->fecGroupStart == chunkNo - (chunkNo % groupSize)))
+  {
+    uint32_t groupStart = progress->fecGroupStart;
+    uint32_t groupLen = fecGroupLength(prv, progress, groupStart);
+    uint32_t missingChunks[THERMIT_FEC_PARITY_BUFFERS] = {0};
+    uint16_t parityRows[THERMIT_FEC_PARITY_BUFFERS];
+    uint16_t missing = 0;
+    uint16_t rows = 0;
+    uint32_t i;
+    uint16_t j;
+
+    for(i = groupStart; i < groupStart + groupLen; i++)
+    {
+      if(!progressGetChunkIsDone(prv, progress, i))
+      {
+        if(missing < THERMIT_FEC_PARITY_BUFFERS)
+        {
+          missingChunks[missing] = i;
+        }
+        missing++;
+      }
+    }
+
+    for(j = 0; j < prv->parameters.fecParity; j++)
+    {
+      if(progress->fecParityHeld[j])
+      {
+        parityRows[rows++] = j;
+      }
+    }
+
+    /*all the chunks received must be in the parity collected, or it does not add up*/
+    if((missing > 0) && (missing <= rows) && (progress->fecChunks + missing == groupLen))
+    {
+      uint8_t matrix[THERMIT_FEC_PARITY_BUFFERS][THERMIT_FEC_PARITY_BUFFERS];
+      uint8_t inverse[THERMIT_FEC_PARITY_BUFFERS][THERMIT_FEC_PARITY_BUFFERS];
+      uint16_t r, c;
+
+      for(r = 0; r < missing; r++)
+      {
+        for(c = 0; c < missing; c++)
+        {
+          matrix[r][c] = fecCoefficient(parityRows[r], (uint16_t)(missingChunks[c] - groupStart));
+        }
+      }
+
+      if(fecInvert(matrix, inverse, missing))
+      {
+        for(c = 0; c < missing; c++)
+        {
+          uint8_t chunk[THERMIT_PAYLOAD_SIZE];
+          uint16_t length = THERMIT_CHUNK_LENGTH(missingChunks[c], progress);
+
+          memset(chunk, 0, sizeof(chunk));
+          for(r = 0; r < missing; r++)
+          {
+            fecMulAdd(prv, chunk, progress->fecBuf[parityRows[r]], inverse[c][r], length);
+          }
+
+          DEBUG_INFO(prv, "chunk %lu of file %d rebuilt from the parity frames.\r\n", (unsigned long)missingChunks[c], progress->fileId);
+
+          if(fileWrite(prv, progress->fileHandle, THERMIT_FILE_OFFSET(missingChunks[c], progress), chunk, length) == 0)
+          {
+            prv->diagnostics.fecRepairs++;
+            progressSetChunkStatus(prv, progress, missingChunks[c], true);
+            ret++;
+
+            /*the last chunk of the file: the sender waits for feedback*/
+            if(missingChunks[c] + 1 >= progress->numberOfChunksNeeded)
+            {
+              progress->feedbackNow = true;
+            }
+          }
+          else
+          {
+            DEBUG_INFO(prv, "file writing failed.\r\n");
+          }
+        }
+
+        /*the group is complete. After a failed write it does not add up anymore,
+          and the chunk left is resent.*/
+        progress->fecChunks = (uint16_t)((ret == missing) ? groupLen : 0);
+        memset(progress->fecParityHeld, 0, sizeof(progress->fecParityHeld));
+
+        gapQueueDropDone(prv, progress);
+        progress->chunkNo = GET_MAX(progress->chunkNo, groupStart + groupLen);
+      }
+    }
+  }
+  return ret;
+}
+
+/*rx: a gap in the latest group may still be rebuilt from its parity frame, report it
+  only after the parity frame or the next group has come*/
+static bool fecGapWaits(thermitPrv_t *prv, thermitProgress_t *progress)
+{
+  bool ret = false;
+  uint16_t groupSize = prv->parameters.fecGroup;
+
+  if((groupSize > 0) && (progress->gapCount > 0) && (progress->chunkNo > 0))
+  {
+    thermitGap_t *gap = &(progress->gapQueue[progress->gapCount - 1]);
+    uint32_t gapEnd = gap->firstChunk + gap->count - 1;
+    uint32_t latestGroup = (progress->chunkNo - 1) - ((progress->chunkNo - 1) % groupSize);
+
+    if((gapEnd >= latestGroup) && (latestGroup >= progress->fecParityNext))
+    {
+      ret = true;
+    }
+  }
+  return ret;
+}
+
+/*chunks per signed block of an outgoing file, 0 if it is sent as is. A file of one
+  chunk gains nothing.*/
+static uint16_t deltaBlockChunks(thermitPrv_t *prv, thermitProgress_t *txProgress)
+{
+  uint16_t ret = 0;
+
+  if((prv->parameters.delta > 0) && (txProgress->numberOfChunksNeeded > 1))
+  {
+    uint32_t chunks = DIVISION_ROUNDED_UP(deltaBlockLength(txProgress->fileSize), txProgress->chunkSize);
+
+    ret = (uint16_t)GET_MIN(GET_MAX(chunks, 1), THERMIT_DELTA_BLOCK_CHUNKS_MAX);
+  }
+  return ret;
+}
+
+/*tx: the blocks of the next signature frame. A round signs the blocks starting within
+  the status window, then waits for the report of the receiver.*/
+static void deltaFrameSelect(thermitProgress_t *txProgress, uint32_t chunkNo)
+{
+  uint16_t blockChunks = txProgress->deltaBlockChunks;
+
+  if((txProgress->deltaSignedEnd >= txProgress->deltaRoundEnd) || (chunkNo >= txProgress->deltaRoundEnd))
+  {
+    uint32_t windowEnd = txProgress->windowStart + THERMIT_PROGRESS_WINDOW_CHUNKS;
+
+    txProgress->deltaRoundStart = chunkNo - (chunkNo % blockChunks);
+    txProgress->deltaRoundEnd = txProgress->deltaRoundStart + DIVISION_ROUNDED_UP(windowEnd - txProgress->deltaRoundStart, blockChunks) * blockChunks;
+    txProgress->deltaRoundEnd = GET_MIN(txProgress->deltaRoundEnd, txProgress->numberOfChunksNeeded);
+    txProgress->deltaSignedEnd = txProgress->deltaRoundStart;
+    txProgress->resending = false;    /*none of these chunks has been sent*/
+  }
+  txProgress->deltaFrameStart = txProgress->deltaSignedEnd;
+}
+
+/*tx: the weak and strong checksum of each block of the frame, read a chunk at a time.
+  The chunks are added to the hash of the whole file on the way, the last frame of the
+  file carries it. Returns the payload length, 0 if the file could not be read.*/
+static uint8_t fillDeltaSignatures(thermitPrv_t *prv, thermitProgress_t *txProgress, uint8_t *plBuf, uint8_t capacity)
+{
+  uint8_t *p = plBuf + 1;   /*the block info byte is filled in last*/
+  bool finalRound = (txProgress->deltaRoundEnd >= txProgress->numberOfChunksNeeded);
+  uint8_t blocks = (capacity - 1 - (finalRound ? THERMIT_DELTA_FILE_HASH_LENGTH : 0)) / THERMIT_DELTA_SIGNATURE_LENGTH;
+  uint32_t chunkNo = txProgress->deltaFrameStart;
+  bool readOk = true;
+  uint8_t ret = 0;
+
+  while(readOk && (blocks > 0) && (chunkNo < txProgress->deltaRoundEnd))
+  {
+    uint32_t blockEnd = GET_MIN(chunkNo + txProgress->deltaBlockChunks, txProgress->deltaRoundEnd);
+    uint32_t strong = DELTA_STRONG_INIT;
+    deltaRolling_t weak;
+
+    deltaRollingInit(&weak);
+
+    while(readOk && (chunkNo < blockEnd))
+    {
+      uint8_t chunkBuf[THERMIT_PAYLOAD_SIZE];
+      uint16_t length = THERMIT_CHUNK_LENGTH(chunkNo, txProgress);
+
+      readOk = (fileRead(prv, txProgress->fileHandle, THERMIT_FILE_OFFSET(chunkNo, txProgress), chunkBuf, length) == length);
+      deltaRollingAdd(&weak, chunkBuf, length);
+      strong = deltaStrong(strong, chunkBuf, length);
+
+      /*the rounds follow each other, a repeated frame is not hashed again*/
+      if(readOk && (chunkNo == txProgress->deltaHashedEnd))
+      {
+        txProgress->deltaFileHash = deltaStrong(txProgress->deltaFileHash, chunkBuf, length);
+        txProgress->deltaHashedEnd++;
+      }
+      chunkNo++;
+    }
+
+    msgPutU32(&p, deltaRollingValue(&weak));
+    msgPutU32(&p, strong);
+    blocks--;
+  }
+
+  if(readOk)
+  {
+    bool isLast = (chunkNo >= txProgress->deltaRoundEnd);
+
+    plBuf[0] = (uint8_t)(txProgress->deltaBlockChunks | (isLast ? THERMIT_DELTA_LAST_FRAME : 0));
+    if(isLast && (txProgress->deltaHashedEnd >= txProgress->numberOfChunksNeeded))
+    {
+      plBuf[0] |= THERMIT_DELTA_FILE_HASH;
+      msgPutU32(&p, txProgress->deltaFileHash);
+    }
+    txProgress->deltaSignedEnd = chunkNo;
+    txProgress->chunkNo = chunkNo;
+    txProgress->lastSendMs = timeNow(prv);
+
+    if(isLast)
+    {
+      DEBUG_INFO(prv, "round signed, will wait for the delta report\r\n");
+      txProgress->deltaWaiting = true;
+      txProgress->waitForFeedback = true;
+    }
+    ret = msgLen(plBuf, p);
+  }
+  else
+  {
+    DEBUG_ERR(prv, "file read failed while signing chunk %lu.\r\n", (unsigned long)(chunkNo - 1));
+  }
+  return ret;
+}
+
+/*tx: the latest signature frame or the report was lost, the frame goes again*/
+static void deltaRewind(thermitProgress_t *txProgress)
+{
+  txProgress->deltaSignedEnd = txProgress->deltaFrameStart;
+  txProgress->chunkNo = txProgress->deltaFrameStart;
+  txProgress->deltaWaiting = false;
+  txProgress->waitForFeedback = false;
+}
+
+/*rx: byte of the old copy, -1 if it can not be read*/
+static int deltaReadByte(thermitPrv_t *prv, thermitProgress_t *rxProgress, thermitDeltaReader_t *reader, uint32_t pos)
+{
+  if((pos < reader->start) || (pos - reader->start >= reader->len))
+  {
+    int bytesRead = -1;
+
+    if(pos < rxProgress->deltaCopySize)
+    {
+      bytesRead = fileRead(prv, rxProgress->deltaCopy, pos, reader->buf, (int16_t)GET_MIN(sizeof(reader->buf), rxProgress->deltaCopySize - pos));
+    }
+    reader->start = pos;
+    reader->len = (uint16_t)((bytesRead > 0) ? bytesRead : 0);
+  }
+  return ((pos - reader->start < reader->len) ? reader->buf[pos - reader->start] : -1);
+}
+
+/*rx: the block is at this offset of the old copy*/
+static bool deltaBlockMatches(thermitPrv_t *prv, thermitProgress_t *rxProgress, uint32_t offset, thermitDeltaBlock_t *block)
+{
+  bool ret = false;
+
+  if((offset <= rxProgress->deltaCopySize) && (block->length <= rxProgress->deltaCopySize - offset))
+  {
+    uint8_t buf[THERMIT_PAYLOAD_SIZE];
+    uint32_t strong = DELTA_STRONG_INIT;
+    uint32_t done = 0;
+    deltaRolling_t weak;
+
+    deltaRollingInit(&weak);
+    ret = true;
+
+    while(ret && (done < block->length))
+    {
+      int16_t len = (int16_t)GET_MIN(sizeof(buf), block->length - done);
+
+      if(fileRead(prv, rxProgress->deltaCopy, offset + done, buf, len) == len)
+      {
+        deltaRollingAdd(&weak, buf, (uint16_t)len);
+        strong = deltaStrong(strong, buf, (uint16_t)len);
+        done += (uint32_t)len;
+      }
+      else
+      {
+        ret = false;
+      }
+    }
+
+    ret = ret && (deltaRollingValue(&weak) == block->weak) && (strong == block->strong);
+  }
+  return ret;
+}
+
+/*rx: take the chunks of the block from the old copy. The chunks received already, or
+  past the status window, are left as they are.*/
+static void deltaBlockCopy(thermitPrv_t *prv, thermitProgress_t *rxProgress, uint32_t offset, thermitDeltaBlock_t *block)
+{
+  uint32_t fileOffset = THERMIT_FILE_OFFSET(block->firstChunk, rxProgress);
+  uint32_t chunkNo = block->firstChunk;
+  uint32_t blockOffset = 0;
+
+  while(blockOffset < block->length)
+  {
+    uint16_t length = THERMIT_CHUNK_LENGTH(chunkNo, rxProgress);
+
+    if(progressChunkIsInWindow(rxProgress, chunkNo) && !progressGetChunkIsDone(prv, rxProgress, chunkNo))
+    {
+      uint8_t buf[THERMIT_PAYLOAD_SIZE];
+
+      if((fileRead(prv, rxProgress->deltaCopy, offset + blockOffset, buf, length) == length) &&
+         (fileWrite(prv, rxProgress->fileHandle, fileOffset + blockOffset, buf, length) == 0))
+      {
+        progressSetChunkStatus(prv, rxProgress, chunkNo, true);
+        prv->diagnostics.deltaCopiedChunks++;
+      }
+      else
+      {
+        DEBUG_INFO(prv, "copying chunk %lu from the old copy failed.\r\n", (unsigned long)chunkNo);
+      }
+    }
+    blockOffset += length;
+    chunkNo++;
+  }
+
+  DEBUG_INFO(prv, "chunks %lu..%lu found at offset %lu of the old copy.\r\n", (unsigned long)block->firstChunk, (unsigned long)(chunkNo - 1), (unsigned long)offset);
+
+  /*the next blocks are looked for after this one first*/
+  rxProgress->deltaShift = (int32_t)(offset - fileOffset);
+  block->found = true;
+}
+
+/*rx: the block at its place in the file, or where the latest block was found, or at
+  the end of the old copy if it is the short last block*/
+static bool deltaBlockFind(thermitPrv_t *prv, thermitProgress_t *rxProgress, thermitDeltaBlock_t *block, uint32_t blockLength)
+{
+  uint32_t fileOffset = THERMIT_FILE_OFFSET(block->firstChunk, rxProgress);
+  int64_t shifted = (int64_t)fileOffset + rxProgress->deltaShift;
+
+  if((rxProgress->deltaShift != 0) && (shifted >= 0) && (shifted <= 0xFFFFFFFF) && deltaBlockMatches(prv, rxProgress, (uint32_t)shifted, block))
+  {
+    deltaBlockCopy(prv, rxProgress, (uint32_t)shifted, block);
+  }
+  else if(deltaBlockMatches(prv, rxProgress, fileOffset, block))
+  {
+    deltaBlockCopy(prv, rxProgress, fileOffset, block);
+  }
+  else if((block->length < blockLength) && (block->length <= rxProgress->deltaCopySize) &&
+          deltaBlockMatches(prv, rxProgress, rxProgress->deltaCopySize - block->length, block))
+  {
+    deltaBlockCopy(prv, rxProgress, rxProgress->deltaCopySize - block->length, block);
+  }
+  return block->found;
+}
+
+/*rx: the full blocks not found at the expected places are searched byte by byte within
+  THERMIT_DELTA_SEARCH_RANGE of them: the weak checksum rolls over the old copy, and
+  its matches are confirmed with the strong one*/
+static void deltaSearch(thermitPrv_t *prv, thermitProgress_t *rxProgress, thermitDeltaBlock_t *blocks, uint8_t count, uint32_t blockLength)
+{
+  thermitDeltaReader_t head;
+  thermitDeltaReader_t tail;
+  deltaRolling_t weak;
+  int64_t firstOffset = (int64_t)THERMIT_FILE_OFFSET(blocks[0].firstChunk, rxProgress);
+  int64_t lastOffset = (int64_t)THERMIT_FILE_OFFSET(blocks[count - 1].firstChunk, rxProgress);
+  int64_t low = GET_MIN(firstOffset, firstOffset + rxProgress->deltaShift) - THERMIT_DELTA_SEARCH_RANGE;
+  int64_t high = GET_MAX(lastOffset, lastOffset + rxProgress->deltaShift) + THERMIT_DELTA_SEARCH_RANGE;
+  uint8_t missing = 0;
+  uint32_t pos;
+  uint8_t i;
+
+  for(i = 0; i < count; i++)
+  {
+    missing += ((!blocks[i].found && (blocks[i].length == blockLength)) ? 1 : 0);
+  }
+
+  low = GET_MAX(low, 0);
+  high = GET_MIN(high, (int64_t)rxProgress->deltaCopySize - blockLength);
+
+  if((missing > 0) && (low <= high))
+  {
+    memset(&head, 0, sizeof(head));
+    memset(&tail, 0, sizeof(tail));
+    deltaRollingInit(&weak);
+
+    for(pos = (uint32_t)low; (pos < (uint32_t)low + blockLength) && (missing > 0); pos++)
+    {
+      int in = deltaReadByte(prv, rxProgress, &tail, pos);
+      uint8_t byte = (uint8_t)in;
+
+      if(in < 0)
+      {
+        missing = 0;    /*the old copy can not be read, give up*/
+      }
+      deltaRollingAdd(&weak, &byte, 1);
+    }
+
+    for(pos = (uint32_t)low; missing > 0; pos++)
+    {
+      uint32_t value = deltaRollingValue(&weak);
+      int out;
+      int in;
+
+      for(i = 0; (i < count) && (missing > 0); i++)
+      {
+        thermitDeltaBlock_t *block = &(blocks[i]);
+
+        if(!block->found && (block->length == blockLength) && (block->weak == value) && deltaBlockMatches(prv, rxProgress, pos, block))
+        {
+          deltaBlockCopy(prv, rxProgress, pos, block);
+          missing--;
+        }
+      }
+
+      if(pos >= (uint32_t)high)
+      {
+        break;
+      }
+
+      out = deltaReadByte(prv, rxProgress, &head, pos);
+      in = deltaReadByte(prv, rxProgress, &tail, pos + blockLength);
+      if((out < 0) || (in < 0))
+      {
+        break;
+      }
+      deltaRollingRoll(&weak, (uint8_t)out, (uint8_t)in);
+    }
+  }
+}
+
+static void deltaCopyClose(thermitPrv_t *prv, thermitProgress_t *rxProgress)
+{
+  if(rxProgress->deltaCopyOpen)
+  {
+    (void)prv->targetIf.fileClose(rxProgress->deltaCopy);
+    rxProgress->deltaCopyOpen = false;
+  }
+}
+
+/*rx: the received file, read back, against the hash of the sender. The blocks taken from
+  the old copy are only as good as their checksums.*/
+static bool deltaFileHashMatches(thermitPrv_t *prv, thermitProgress_t *rxProgress)
+{
+  uint8_t buf[THERMIT_PAYLOAD_SIZE];
+  uint32_t strong = DELTA_STRONG_INIT;
+  uint32_t offset = 0;
+
+  while(offset < rxProgress->fileSize)
+  {
+    int16_t len = (int16_t)GET_MIN(sizeof(buf), rxProgress->fileSize - offset);
+
+    if(fileRead(prv, rxProgress->fileHandle, offset, buf, len) != len)
+    {
+      DEBUG_ERR(prv, "reading back the received file failed at offset %lu.\r\n", (unsigned long)offset);
+      return false;
+    }
+    strong = deltaStrong(strong, buf, (uint16_t)len);
+    offset += (uint32_t)len;
+  }
+  return (strong == rxProgress->deltaFileHash);
+}
+
+static thermitProgress_t *rxSlotWithDeltaReport(thermitPrv_t *prv)
+{
+  thermitProgress_t *ret = NULL;
+  uint8_t i;
+
+  for(i = 0; i < prv->parameters.transferSlots; i++)
+  {
+    if(prv->rxSlots[i].running && prv->rxSlots[i].deltaReportDue)
+    {
+      ret = &(prv->rxSlots[i]);
+      break;
+    }
+  }
+  return ret;
+}
+
+/*running slot of the file, NULL if there is none*/
+static thermitProgress_t *slotFind(thermitPrv_t *prv, thermitProgress_t *slots, uint8_t fileId)
+{
+  thermitProgress_t *ret = NULL;
+  uint8_t i;
+
+  if(fileId != THERMIT_FILEID_INACTIVE)
+  {
+    for(i = 0; i < prv->parameters.transferSlots; i++)
+    {
+      if(slots[i].running && (slots[i].fileId == fileId))
+      {
+        ret = &(slots[i]);
+        break;
+      }
+    }
+  }
+  return ret;
+}
+
+/*only the negotiated number of slots is used*/
+static thermitProgress_t *slotFindFree(thermitPrv_t *prv, thermitProgress_t *slots)
+{
+  thermitProgress_t *ret = NULL;
+  uint8_t i;
+
+  for(i = 0; i < prv->parameters.transferSlots; i++)
+  {
+    if(!slots[i].running)
+    {
+      ret = &(slots[i]);
+      break;
+    }
+  }
+  return ret;
+}
+
+/*the outgoing files take turns, one chunk each*/
+static thermitProgress_t *txSlotNextToSend(thermitPrv_t *prv)
+{
+  thermitProgress_t *ret = NULL;
+  uint8_t slots = prv->parameters.transferSlots;
+  uint8_t i;
+
+  for(i = 0; i < slots; i++)
+  {
+    thermitProgress_t *prog = &(prv->txSlots[(prv->txSlotNext + i) % slots]);
+
+    if(prog->running && ((prog->gapCount > 0) || !prog->waitForFeedback))
+    {
+      ret = prog;
+      prv->txSlotNext = (prv->txSlotNext + i + 1) % slots;
+      break;
+    }
+  }
+  return ret;
+}
+
+/*a file waiting long for its feedback holds back new files, so that the receiver
+  still remembers it*/
+static bool txWindowOpen(thermitPrv_t *prv)
+{
+  uint8_t i;
+
+  for(i = 0; i < prv->parameters.transferSlots; i++)
+  {
+    thermitProgress_t *prog = &(prv->txSlots[i]);
+    uint8_t distance = (prv->nextOutgoingFileId + THERMIT_FILEID_MAX - prog->fileId) % THERMIT_FILEID_MAX;
+
+    if(prog->running && (distance >= THERMIT_TX_WINDOW_FILES(prv->parameters.transferSlots)))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static thermitProgress_t *rxSlotWithGaps(thermitPrv_t *prv)
+{
+  thermitProgress_t *ret = NULL;
+  uint8_t i;
+
+  for(i = 0; i < prv->parameters.transferSlots; i++)
+  {
+    if(prv->rxSlots[i].running && (prv->rxSlots[i].gapCount > 0) && !fecGapWaits(prv, &(prv->rxSlots[i])))
+    {
+      ret = &(prv->rxSlots[i]);
+      break;
+    }
+  }
+  return ret;
+}
+
+/*the file the sender waits for gets the bitmap first, or else its plain feedback*/
+static thermitProgress_t *rxSlotNeedingSelectiveAck(thermitPrv_t *prv)
+{
+  thermitProgress_t *ret = NULL;
+  bool feedbackWaits = false;
+  uint8_t i;
+
+  for(i = 0; (i < prv->parameters.transferSlots) && !feedbackWaits; i++)
+  {
+    if(prv->rxSlots[i].running && prv->rxSlots[i].feedbackNow)
+    {
+      feedbackWaits = true;
+      ret = (selectiveAckNeeded(prv, &(prv->rxSlots[i])) ? &(prv->rxSlots[i]) : NULL);
+    }
+  }
+  for(i = 0; (i < prv->parameters.transferSlots) && !feedbackWaits && (ret == NULL); i++)
+  {
+    if(selectiveAckNeeded(prv, &(prv->rxSlots[i])))
+    {
+      ret = &(prv->rxSlots[i]);
+    }
+  }
+  return ret;
+}
+
+/*the sender frees its slot only when it hears that the file is ready*/
+static void readyFileAdd(thermitPrv_t *prv, uint8_t fileId)
+{
+  prv->readyFileIds[prv->readyNext] = fileId;
+  prv->readyReports[prv->readyNext] = THERMIT_READY_REPORTS;
+  prv->readyNext = THERMIT_ADVANCE_TO_NEXT(prv->readyNext, THERMIT_READY_FILES);
+}
+
+/*a new file reuses the file ID: the old file with that ID is history*/
+static void readyFilesPrune(thermitPrv_t *prv, uint8_t newFileId)
+{
+  uint8_t i;
+
+  for(i = 0; i < THERMIT_READY_FILES; i++)
+  {
+    if(prv->readyFileIds[i] == newFileId)
+    {
+      prv->readyFileIds[i] = THERMIT_FILEID_INACTIVE;
+      prv->readyReports[i] = 0;
+    }
+  }
+}
+
+/*something to report about the incoming files*/
+static bool feedbackPending(thermitPrv_t *prv)
+{
+  uint8_t i;
+
+  for(i = 0; i < prv->parameters.transferSlots; i++)
+  {
+    if(prv->rxSlots[i].running)
+    {
+      return true;
+    }
+  }
+  for(i = 0; i < THERMIT_READY_FILES; i++)
+  {
+    if(prv->readyReports[i] > 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*the sender waits for these reports: they may take the rest of the burst*/
+static bool feedbackUrgent(thermitPrv_t *prv)
+{
+  uint8_t i;
+
+  for(i = 0; i < prv->parameters.transferSlots; i++)
+  {
+    if(prv->rxSlots[i].running && prv->rxSlots[i].feedbackNow)
+    {
+      return true;
+    }
+  }
+  for(i = 0; i < THERMIT_READY_FILES; i++)
+  {
+    if(prv->readyReports[i] == THERMIT_READY_REPORTS)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*the sender still sends something of a file that has been received: it has not heard
+  that the file is ready. Report it again, next.*/
+static bool readyFileRemind(thermitPrv_t *prv, uint8_t fileId)
+{
+  uint8_t i;
+
+  for(i = 0; i < THERMIT_READY_FILES; i++)
+  {
+    if((fileId != THERMIT_FILEID_INACTIVE) && (prv->readyFileIds[i] == fileId))
+    {
+      prv->readyReports[i] = THERMIT_READY_REPORTS;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*the feedback fields of the outgoing frame: the incoming file selected for the frame, or
+  the running incoming files and the received ones in turns*/
+static void feedbackSelect(thermitPrv_t *prv)
+{
+  thermitPacket_t *pkt = &(prv->packet);
+  uint8_t slots = prv->parameters.transferSlots;
+  uint8_t entries = slots + THERMIT_READY_FILES;
+  uint8_t i;
+
+  pkt->recFileId = THERMIT_FILEID_INACTIVE;
+
+  /*first the files the sender waits for, then the rest in turns*/
+  for(i = 0; (i < slots) && (prv->rxProgress == NULL); i++)
+  {
+    if(prv->rxSlots[i].running && prv->rxSlots[i].feedbackNow)
+    {
+      prv->rxProgress = &(prv->rxSlots[i]);
+    }
+  }
+  for(i = 0; (i < THERMIT_READY_FILES) && (prv->rxProgress == NULL) && (pkt->recFileId == THERMIT_FILEID_INACTIVE); i++)
+  {
+    if(prv->readyReports[i] == THERMIT_READY_REPORTS)
+    {
+      prv->readyReports[i]--;
+      pkt->recFileId = prv->readyFileIds[i];
+    }
+  }
+
+  if((prv->rxProgress == NULL) && (pkt->recFileId == THERMIT_FILEID_INACTIVE))
+  {
+    if(prv->feedbackNext >= entries)
+    {
+      prv->feedbackNext = 0;
+    }
+
+    for(i = 0; i < entries; i++)
+    {
+      uint8_t idx = prv->feedbackNext;
+
+      prv->feedbackNext = THERMIT_ADVANCE_TO_NEXT(prv->feedbackNext, entries);
+
+      if(idx < slots)
+      {
+        if(prv->rxSlots[idx].running)
+        {
+          prv->rxProgress = &(prv->rxSlots[idx]);
+          break;
+        }
+      }
+      else if(prv->readyReports[idx - slots] > 0)
+      {
+        prv->readyReports[idx - slots]--;
+        pkt->recFileId = prv->readyFileIds[idx - slots];
+        break;
+      }
+    }
+  }
+
+  if(prv->rxProgress)
+  {
+    pkt->recFileId = prv->rxProgress->fileId;
+    prv->rxProgress->feedbackNow = false;
+  }
+  pkt->recFeedback = getFeedback(prv);
+}
+
+#if THERMIT_DEBUG >= THERMIT_DBG_LVL_INFO
+#define PROGRESS_DUMP_LINE_LENGTH   40
+static void debugDumpProgress(thermitPrv_t *prv, thermitProgress_t *prog, uint8_t *prefix, uint8_t *postfix)
+{
+  uint8_t i;
+  uint8_t byteIdx = 0;
+  uint8_t bitIdx = 0;
+
+  if(prv && prog)
+  {
+    /*only the chunks of the status window are shown*/
+    uint16_t totalChunksToBeReported = (uint16_t)GET_MIN(prog->numberOfChunksNeeded - prog->windowStart, THERMIT_PROGRESS_WINDOW_CHUNKS);
+    uint8_t linesNeeded = DIVISION_ROUNDED_UP(totalChunksToBeReported, PROGRESS_DUMP_LINE_LENGTH);
+    bool finalRound = false;
+
+    if (prefix)
+    {
+      DEBUG_INFO(prv, "%s", prefix);
+    }
+
+    if(totalChunksToBeReported > 0)
+    {
+      for(i = 0; i < linesNeeded; i++)
+      {
+        uint8_t line[PROGRESS_DUMP_LINE_LENGTH+1];
+        uint8_t cntr = PROGRESS_DUMP_LINE_LENGTH;
+        uint8_t *ptr = line;
+
+        while(cntr--)
+        {
+          *(ptr++) = ((((prog->chunkStatus[byteIdx] >> bitIdx) & 0x01) == 0) ? 'G' : '-');
+          totalChunksToBeReported--;
+          if(totalChunksToBeReported == 0)
+          {
+            finalRound = true;  // force breaking out from for loop
+            break;            // break out from while loop
+          }
+
+          /*advance to next*/
+          bitIdx++;
+          if(bitIdx == 8)
+          {
+            bitIdx=0;
+            byteIdx++;
+          }
+        }
+
+        *(ptr++) = 0; //terminate
+        DEBUG_INFO(prv, "%03lu: [", (unsigned long)(prog->windowStart + i*PROGRESS_DUMP_LINE_LENGTH));
+        DEBUG_INFO(prv, "%s]", line);
+        if(finalRound)
+        {
+          break;  /*break out from for loop*/
+        }
+        DEBUG_INFO(prv, "\r\n");
+      }
+    }
+
+    if (postfix)
+    {
+      DEBUG_INFO(prv, "%s", postfix);
+    }
+  }
+}
+#else
+static void debugDumpProgress(thermitPrv_t *prv, thermitProgress_t *prog, uint8_t *prefix, uint8_t *postfix)
+{
+  (void)prv;
+  (void)prog;
+  (void)prefix;
+  (void)postfix;
+}
+#endif
 
-#if THERMIT_DEBUG >= THERMIT_DBG_LVL_INFO
-static void debugDumpFrame(thermitPrv_t *prv, uint8_t *buf, uint8_t *prefix)
-{
-  int i;
-  int pLen = (int)buf[5];
+
+
+
+#if THERMIT_DEBUG >= THERMIT_DBG_LVL_INFO
+static void debugDumpFrame(thermitPrv_t *prv, uint8_t *buf, uint8_t *prefix)
+{
+  int i;
+  int hLen = frameHeaderLength(buf[THERMIT_FCODE_OFFSET]);
+  int pLen = (int)buf[hLen - 1];
 
   if (prefix)
   {
     DEBUG_INFO(prv, "%s ", prefix);
   }
 
-  DEBUG_INFO(prv, "FC:%02X RFId:%02X Feedback:%02X SFId:%02X Chunk:%02X DataLen:%02X(%d) [", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], buf[5]);
+  if(hLen == THERMIT_HEADER_LENGTH_WIDE)
+  {
+    uint8_t *fb = &(buf[THERMIT_REC_FEEDBACK_OFFSET]);
+    uint8_t *cn = &(buf[THERMIT_SND_CHUNKNO_OFFSET_WIDE]);
+    uint32_t feedback = msgGetU32(&fb);
+    uint32_t chunkNo = msgGetU32(&cn);
+
+    DEBUG_INFO(prv, "FC:%02X RFId:%02X Feedback:%08lX SFId:%02X Chunk:%08lX DataLen:%02X(%d) [", buf[0], buf[1], (unsigned long)feedback, buf[6], (unsigned long)chunkNo, pLen, pLen);
+  }
+  else
+  {
+    DEBUG_INFO(prv, "FC:%02X RFId:%02X Feedback:%02X SFId:%02X Chunk:%02X DataLen:%02X(%d) [", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], buf[5]);
+  }
 
   for (i = 0; i < pLen; i++)
   {
-    DEBUG_INFO(prv, "%02X%s", buf[6 + i], (i == (pLen - 1) ? "" : " "));
+    DEBUG_INFO(prv, "%02X%s", buf[hLen + i], (i == (pLen - 1) ? "" : " "));
+  }
+
+  DEBUG_INFO(prv, "] CRC:%04X\r\n", (((uint16_t)buf[hLen + pLen]) << 8) | ((uint16_t)buf[hLen + pLen + 1]));
+}
+#else
+static void debugDumpFrame(thermitPrv_t *prv, uint8_t *buf, uint8_t *prefix)
+{
+  (void)buf;
+  (void)prefix;
+}
+#endif
+
+#if THERMIT_DEBUG >= THERMIT_DBG_LVL_INFO
+static void debugDumpParameters(thermitPrv_t *prv, uint8_t *prefix, uint8_t *postfix)
+{
+  int i;
+
+  if(prv)
+  {
+    thermitParameters_t *par = &(prv->parameters);
+
+    if (prefix)
+    {
+      DEBUG_INFO(prv, "%s", prefix);
+    }
+
+    DEBUG_INFO(prv, "version = %d, ", par->version);
+    DEBUG_INFO(prv, "chunkSize = %d, ", par->chunkSize);
+    DEBUG_INFO(prv, "maxFileSize = %d, ", par->maxFileSize);
+    DEBUG_INFO(prv, "keepAliveMs = %d, ", par->keepAliveMs);
+    DEBUG_INFO(prv, "burstLength = %d, ", par->burstLength);
+    DEBUG_INFO(prv, "checkType = %s, ", (par->checkType == THERMIT_CHECK_CRC32C ? "CRC-32C" : "CRC16"));
+    DEBUG_INFO(prv, "maxFileSize64k = %d, ", par->maxFileSize64k);
+    DEBUG_INFO(prv, "transferSlots = %d, ", par->transferSlots);
+    DEBUG_INFO(prv, "fecGroup = %d, ", par->fecGroup);
+    DEBUG_INFO(prv, "fecParity = %d, ", par->fecParity);
+    DEBUG_INFO(prv, "compression = 0x%X, ", par->compression);
+    DEBUG_INFO(prv, "dictionaryId = 0x%04X, ", par->dictionaryId);
+    DEBUG_INFO(prv, "delta = %d", par->delta);
+
+    if (postfix)
+    {
+      DEBUG_INFO(prv, "%s", postfix);
+    }
+  }
+}
+#else
+static void debugDumpParameters(thermitPrv_t *prv, uint8_t *prefix, uint8_t *postfix)
+{
+  (void)prv;
+  (void)prefix;
+  (void)postfix;
+}
+#endif
+
+
+#if THERMIT_DEBUG >= THERMIT_DBG_LVL_INFO
+static void debugDumpState(thermitPrv_t *prv, uint8_t *prefix, uint8_t *postfix)
+{
+  int i;
+
+  if(prv)
+  {
+    thermitState_t state = prv->state;
+
+    if (prefix)
+    {
+      DEBUG_INFO(prv, "%s", prefix);
+    }
+
+    switch(state)
+    {
+      case THERMIT_WAITING_FOR_CALLBACK_CONFIGURATION:
+        DEBUG_INFO(prv, "THERMIT_WAITING_FOR_CALLBACK_CONFIGURATION");
+        break;
+      case THERMIT_SYNC_FIRST:
+        DEBUG_INFO(prv, "THERMIT_SYNC_FIRST");
+        break;
+      case THERMIT_SYNC_SECOND:
+        DEBUG_INFO(prv, "THERMIT_SYNC_SECOND");
+        break;
+      case THERMIT_RUNNING:
+        DEBUG_INFO(prv, "THERMIT_RUNNING");
+        break;
+      case THERMIT_OUT_OF_SYNC:
+        DEBUG_INFO(prv, "THERMIT_OUT_OF_SYNC");
+        break;
+      default:
+        DEBUG_INFO(prv, "Illegal state = %d", state);
+        break;
+    }
+
+    if (postfix)
+    {
+      DEBUG_INFO(prv, "%s", postfix);
+    }
+  }
+}
+#else
+static void debugDumpState(thermitPrv_t *prv, uint8_t *prefix, uint8_t *postfix)
+{
+  (void)prv;
+  (void)prefix;
+  (void)postfix;
+}
+#endif
+
+
+static void burstRecordHistory(thermitPrv_t *prv)
+{
+  thermitDiagnostics_t *diag = &(prv->diagnostics);
+
+  diag->burstHistory[diag->burstHistoryIdx] = (uint8_t)diag->burstLength;
+  diag->burstHistoryIdx = THERMIT_ADVANCE_TO_NEXT(diag->burstHistoryIdx, THERMIT_BURST_HISTORY_LENGTH);
+}
+
+/*start each session from the default burst, not above the negotiated one*/
+static void burstInitialize(thermitPrv_t *prv)
+{
+  thermitDiagnostics_t *diag = &(prv->diagnostics);
+
+  diag->burstLength = GET_MIN(THERMIT_BURST_LENGTH_DEFAULT, prv->parameters.burstLength);
+  prv->burstLastCrcErrors = diag->crcErrors;
+  prv->burstLastLossEvents = prv->burstLossEvents;
+  burstRecordHistory(prv);
+}
+
+/*
+AIMD adaptation of the burst length, called before each sending step:
+ - halve the burst if frames were lost or broken since the previous round,
+   or if the device still holds more than a frame of the previous burst
+ - grow it by one if the previous burst was full, the link was clean and
+   the device has sent everything, up to the negotiated burstLength
+*/
+static void burstAdapt(thermitPrv_t *prv)
+{
+  thermitDiagnostics_t *diag = &(prv->diagnostics);
+  thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
+  uint16_t burst = diag->burstLength;
+  int txPending = 0;
+  bool lossy;
+
+  lossy = (diag->crcErrors != prv->burstLastCrcErrors) || (prv->burstLossEvents != prv->burstLastLossEvents);
+  prv->burstLastCrcErrors = diag->crcErrors;
+  prv->burstLastLossEvents = prv->burstLossEvents;
+
+  if(tgt->devTxPending)
+  {
+    txPending = tgt->devTxPending(prv->comLink);
+  }
+
+  if(lossy || (txPending > THERMIT_MSG_SIZE_MAX))
+  {
+    burst = GET_MAX(burst / 2, 1);
+  }
+  else if((prv->burstLastCount >= burst) && (txPending <= 0))
+  {
+    burst = GET_MIN(burst + 1, prv->parameters.burstLength);
   }
 
-  DEBUG_INFO(prv, "] CRC:%04X\r\n", (((uint16_t)buf[6 + pLen]) << 8) | ((uint16_t)buf[6 + pLen + 1]));
+  if(burst != diag->burstLength)
+  {
+    DEBUG_INFO(prv, "burst length %d -> %d\r\n", diag->burstLength, burst);
+    diag->burstLength = burst;
+    burstRecordHistory(prv);
+  }
+}
+
+static uint32_t timeNow(thermitPrv_t *prv)
+{
+  prv->timeMaxMs = 0xFFFFFFFF;   /*in case the callback does not tell*/
+
+  return prv->targetIf.sysGetMs(&(prv->timeMaxMs));
+}
+
+/*milliseconds since the timestamp, the clock wraps after timeMaxMs*/
+static uint32_t timeElapsed(thermitPrv_t *prv, uint32_t sinceMs)
+{
+  uint32_t now = timeNow(prv);
+  uint32_t ret;
+
+  if(now >= sinceMs)
+  {
+    ret = now - sinceMs;
+  }
+  else
+  {
+    ret = (prv->timeMaxMs - sinceMs) + now + 1;
+  }
+  return ret;
 }
-#else
-static void debugDumpFrame(thermitPrv_t *prv, uint8_t *buf, uint8_t *prefix)
+
+/*no round trip samples yet: start from the conservative timeout*/
+static void rttInitialize(thermitPrv_t *prv)
 {
-  (void)buf;
-  (void)prefix;
+  prv->rttValid = false;
+  prv->diagnostics.rttMs = 0;
+  prv->diagnostics.rtoMs = THERMIT_RTO_INITIAL_MS;
 }
-#endif
 
-#if THERMIT_DEBUG >= THERMIT_DBG_LVL_INFO
-static void debugDumpParameters(thermitPrv_t *prv, uint8_t *prefix, uint8_t *postfix)
+/*
+Jacobson/Karels round trip estimation, in the scaled integer form:
+  srtt   += (rtt - srtt) / 8
+  rttvar += (|rtt - srtt| - rttvar) / 4
+  rto     = srtt + 4 * rttvar
+*/
+static void rttUpdate(thermitPrv_t *prv, uint32_t rttMs)
 {
-  int i;
+  thermitDiagnostics_t *diag = &(prv->diagnostics);
+  uint32_t rto;
 
-  if(prv)
+  if(!prv->rttValid)
   {
-    thermitParameters_t *par = &(prv->parameters);
+    prv->rttSmoothed8 = rttMs << 3;
+    prv->rttVariance4 = rttMs << 1;   /*rttvar = rtt / 2*/
+    prv->rttValid = true;
+  }
+  else
+  {
+    int32_t delta = (int32_t)rttMs - (int32_t)(prv->rttSmoothed8 >> 3);
 
-    if (prefix)
+    prv->rttSmoothed8 += delta;
+    if(delta < 0)
     {
-      DEBUG_INFO(prv, "%s", prefix);
+      delta = -delta;
     }
+    prv->rttVariance4 += delta - (int32_t)(prv->rttVariance4 >> 2);
+  }
 
-    DEBUG_INFO(prv, "version = %d, ", par->version);
-    DEBUG_INFO(prv, "chunkSize = %d, ", par->chunkSize);
-    DEBUG_INFO(prv, "maxFileSize = %d, ", par->maxFileSize);
-    DEBUG_INFO(prv, "keepAliveMs = %d, ", par->keepAliveMs);
-    DEBUG_INFO(prv, "burstLength = %d", par->burstLength);
+  rto = (prv->rttSmoothed8 >> 3) + prv->rttVariance4;
+  diag->rttMs = prv->rttSmoothed8 >> 3;
+  diag->rtoMs = GET_MIN(GET_MAX(rto, THERMIT_RTO_MIN_MS), THERMIT_RTO_MAX_MS);
+}
 
-    if (postfix)
+/*a chunk of the file was sent: restart the timer. The round trip is measured for one chunk
+  at a time, and never for a resent one: its feedback may be for either copy (Karn).*/
+static void rttChunkSent(thermitPrv_t *prv, thermitProgress_t *prog, uint32_t chunkNo, bool resent)
+{
+  uint32_t now = timeNow(prv);
+
+  prog->lastSendMs = now;
+
+  if(resent)
+  {
+    if(prog->rttTiming && (prog->rttChunk == chunkNo))
     {
-      DEBUG_INFO(prv, "%s", postfix);
+      prog->rttTiming = false;
     }
   }
+  else if(!prog->rttTiming)
+  {
+    prog->rttTiming = true;
+    prog->rttChunk = chunkNo;
+    prog->rttSentMs = now;
+  }
 }
-#else
-static void debugDumpParameters(thermitPrv_t *prv, uint8_t *prefix, uint8_t *postfix)
+
+static void rttFeedbackReceived(thermitPrv_t *prv, thermitProgress_t *prog, bool fileIsReady)
 {
-  (void)prv;
-  (void)prefix;
-  (void)postfix;
+  prog->feedbackSeen = true;
+  prog->rtoBackoff = 0;
+
+  if(prog->rttTiming && (fileIsReady || progressGetChunkIsDone(prv, prog, prog->rttChunk)))
+  {
+    prog->rttTiming = false;
+    rttUpdate(prv, timeElapsed(prv, prog->rttSentMs));
+  }
 }
-#endif
 
+/*the feedback can tell about the latest chunk sent only a round trip after it was sent.
+  Earlier feedback was sent while the chunk was still on its way. The round trip is taken
+  as short as it has been lately: srtt - rttvar.*/
+static bool rttFeedbackIsCurrent(thermitPrv_t *prv, thermitProgress_t *prog)
+{
+  uint32_t srtt = prv->rttSmoothed8 >> 3;
+  uint32_t rttvar = prv->rttVariance4 >> 2;
 
-#if THERMIT_DEBUG >= THERMIT_DBG_LVL_INFO
-static void debugDumpState(thermitPrv_t *prv, uint8_t *prefix, uint8_t *postfix)
+  return (!prv->rttValid || (timeElapsed(prv, prog->lastSendMs) >= srtt - GET_MIN(srtt, rttvar)));
+}
+
+/*a file waiting for feedback longer than the timeout is resent from the first missing
+  chunk. If the receiver has never reported the file, the file info is sent first.*/
+static void txSlotsTimerCheck(thermitPrv_t *prv)
 {
-  int i;
+  thermitDiagnostics_t *diag = &(prv->diagnostics);
+  uint8_t i;
 
-  if(prv)
+  for(i = 0; i < prv->parameters.transferSlots; i++)
   {
-    thermitState_t state = prv->state;
+    thermitProgress_t *prog = &(prv->txSlots[i]);
 
-    if (prefix)
+    if(!prog->waitForFeedback)
     {
-      DEBUG_INFO(prv, "%s", prefix);
+      prog->probeSent = false;    /*each wait for feedback gets one probe*/
     }
+    else if(prog->running && (prog->gapCount == 0))
+    {
+      uint32_t timeout = GET_MIN(diag->rtoMs << prog->rtoBackoff, THERMIT_RTO_MAX_MS);
+      uint32_t probeTimeout = GET_MAX(2 * diag->rttMs, THERMIT_PROBE_MIN_MS);
+      uint32_t elapsed = timeElapsed(prv, prog->lastSendMs);
 
-    switch(state)
+      if(elapsed >= timeout)
+      {
+        uint32_t dirtyChunk;
+
+        DEBUG_INFO(prv, "no feedback for file %d in %lu ms\r\n", prog->fileId, (unsigned long)timeout);
+        diag->timeouts++;
+        prog->rtoBackoff = GET_MIN(prog->rtoBackoff + 1, THERMIT_RTO_BACKOFF_MAX);
+        prog->lastSendMs = timeNow(prv);
+        prog->rttTiming = false;
+
+        if(!prog->feedbackSeen && (prv->parameters.version >= THERMIT_VERSION_RETRANSMIT_TIMER))
+        {
+          prog->resendInfo = true;
+        }
+
+        if(prog->deltaWaiting)
+        {
+          /*the report of the delta transfer is still missing*/
+          deltaRewind(prog);
+        }
+        else if(progressGetFirstDirty(prv, prog, &dirtyChunk))
+        {
+          prog->chunkNo = dirtyChunk;
+          prog->resendEnd = 0;
+          prog->resending = true;
+          prog->waitForFeedback = false;
+          prv->burstLossEvents++;
+        }
+        else
+        {
+          /*every chunk has been acknowledged, so the receiver has the whole file*/
+          DEBUG_INFO(prv, "file sending finished, the file ready report was lost\r\n");
+          prog->running = false;
+          (void)prv->targetIf.fileClose(prog->fileHandle);
+        }
+      }
+      else if(!prog->probeSent && prv->rttValid && (elapsed >= probeTimeout) && (probeTimeout < timeout))
+      {
+        uint32_t dirtyChunk;
+
+        /*tail loss probe: the last chunk or its feedback may have been lost. Resend the
+          last unacknowledged chunk well before the timeout, its arrival asks for feedback.*/
+        prog->probeSent = true;
+
+        if(!prog->feedbackSeen && (prv->parameters.version >= THERMIT_VERSION_RETRANSMIT_TIMER))
+        {
+          /*the receiver may not know the file at all*/
+          DEBUG_INFO(prv, "tail loss probe for file %d: file info\r\n", prog->fileId);
+          diag->probes++;
+          prog->resendInfo = true;
+        }
+        else if(prog->deltaWaiting)
+        {
+          DEBUG_INFO(prv, "tail loss probe for file %d: signatures from chunk %lu\r\n", prog->fileId, (unsigned long)prog->deltaFrameStart);
+          diag->probes++;
+          deltaRewind(prog);
+        }
+        else if(progressGetLastDirty(prv, prog, prog->chunkNo, &dirtyChunk))
+        {
+          DEBUG_INFO(prv, "tail loss probe for file %d: chunk %lu\r\n", prog->fileId, (unsigned long)dirtyChunk);
+          diag->probes++;
+          gapQueuePut(prog, dirtyChunk, 1);
+        }
+      }
+    }
+  }
+}
+
+static thermitProgress_t *txSlotInfoToResend(thermitPrv_t *prv)
+{
+  thermitProgress_t *ret = NULL;
+  uint8_t i;
+
+  for(i = 0; i < prv->parameters.transferSlots; i++)
+  {
+    if(prv->txSlots[i].running && prv->txSlots[i].resendInfo)
     {
-      case THERMIT_WAITING_FOR_CALLBACK_CONFIGURATION:
-        DEBUG_INFO(prv, "THERMIT_WAITING_FOR_CALLBACK_CONFIGURATION");
-        break;
-      case THERMIT_SYNC_FIRST:
-        DEBUG_INFO(prv, "THERMIT_SYNC_FIRST");
-        break;
-      case THERMIT_SYNC_SECOND:
-        DEBUG_INFO(prv, "THERMIT_SYNC_SECOND");
-        break;
-      case THERMIT_RUNNING:
-        DEBUG_INFO(prv, "THERMIT_RUNNING");
-        break;
-      case THERMIT_OUT_OF_SYNC:
-        DEBUG_INFO(prv, "THERMIT_OUT_OF_SYNC");
-        break;
-      default:
-        DEBUG_INFO(prv, "Illegal state = %d", state);
-        break;
+      ret = &(prv->txSlots[i]);
+      ret->resendInfo = false;
+      break;
     }
+  }
+  return ret;
+}
 
-    if (postfix)
+/*the parity frames follow the last chunk of their group, even at the end of the file*/
+static thermitProgress_t *txSlotParityToSend(thermitPrv_t *prv)
+{
+  thermitProgress_t *ret = NULL;
+  uint8_t i;
+
+  for(i = 0; i < prv->parameters.transferSlots; i++)
+  {
+    if(prv->txSlots[i].running && prv->txSlots[i].fecPending)
     {
-      DEBUG_INFO(prv, "%s", postfix);
+      ret = &(prv->txSlots[i]);
+      ret->fecPending--;
+      break;
     }
   }
+  return ret;
 }
-#else
-static void debugDumpState(thermitPrv_t *prv, uint8_t *prefix, uint8_t *postfix)
+
+/*the link has been quiet for the keep-alive time: any frame that went out resets it*/
+static bool keepAliveDue(thermitPrv_t *prv)
 {
-  (void)prv;
-  (void)prefix;
-  (void)postfix;
+  bool ret = false;
+  uint16_t keepAliveMs = prv->parameters.keepAliveMs;
+
+  if((keepAliveMs > 0) && (timeElapsed(prv, prv->lastTxMs) >= keepAliveMs))
+  {
+    ret = true;
+  }
+  return ret;
 }
-#endif
 
+/*the peer sends at least a keep-alive after each keepAliveMs of silence. Nothing
+  heard for several of those means the peer has gone or restarted.*/
+static bool keepAlivePeerLost(thermitPrv_t *prv)
+{
+  bool ret = false;
+  uint32_t limitMs = (uint32_t)prv->parameters.keepAliveMs * THERMIT_KEEP_ALIVE_LOST;
+
+  if((limitMs > 0) && (timeElapsed(prv, prv->lastRxMs) >= limitMs))
+  {
+    ret = true;
+  }
+  return ret;
+}
 
 static int changeState(thermitPrv_t *prv, thermitState_t newState)
 {
@@ -652,6 +2479,16 @@ static int changeState(thermitPrv_t *prv, thermitState_t newState)
   {
     if((newState > THERMIT_FIRST_DUMMY_STATE) && (newState < THERMIT_LAST_DUMMY_STATE))
     {
+      if((newState == THERMIT_RUNNING) && (prv->state != THERMIT_RUNNING))
+      {
+        burstInitialize(prv);
+        rttInitialize(prv);
+        memset(prv->readyFileIds, THERMIT_FILEID_INACTIVE, sizeof(prv->readyFileIds));
+        memset(prv->readyReports, 0, sizeof(prv->readyReports));
+        prv->lastTxMs = timeNow(prv);
+        prv->lastRxMs = prv->lastTxMs;
+      }
+
       prv->state = newState;
       debugDumpState(prv, "changeState: ", "\r\n");
       ret = 0;
@@ -661,6 +2498,69 @@ static int changeState(thermitPrv_t *prv, thermitState_t newState)
 }
 
 
+/*the SYNC and OUT_OF_SYNC frames are always protected by the 16bit CRC, because
+  the other end may not know the negotiated parameters yet (or anymore).*/
+/*the data transfer frames of large files carry 32 bit chunk numbers and feedback*/
+static bool frameAllowsWideHeader(uint8_t fCode)
+{
+  bool ret = false;
+
+  switch (fCode)
+  {
+  case THERMIT_FCODE_DATA_TRANSFER:
+  case THERMIT_FCODE_NEW_FILE_START:
+  case THERMIT_FCODE_SELECTIVE_ACK:
+  case THERMIT_FCODE_NACK:
+  case THERMIT_FCODE_PARITY:
+  case THERMIT_FCODE_DATA_COMPRESSED:
+  case THERMIT_FCODE_DELTA_SIGNATURE:
+  case THERMIT_FCODE_DELTA_REPORT:
+    ret = true;
+    break;
+
+  default:
+    break;
+  }
+
+  return ret;
+}
+
+/*header length of a frame, by the function code byte on the wire*/
+static uint8_t frameHeaderLength(uint8_t wireFCode)
+{
+  uint8_t ret = THERMIT_HEADER_LENGTH;
+
+  if ((wireFCode & THERMIT_FCODE_WIDE_HEADER) && frameAllowsWideHeader(wireFCode & ~THERMIT_FCODE_WIDE_HEADER))
+  {
+    ret = THERMIT_HEADER_LENGTH_WIDE;
+  }
+
+  return ret;
+}
+
+static thermitCheckType_t frameCheckType(thermitPrv_t *prv, uint8_t fCode)
+{
+  thermitCheckType_t ret = THERMIT_CHECK_CRC16;
+
+  switch (fCode)
+  {
+  case THERMIT_FCODE_SYNC_PROPOSAL:
+  case THERMIT_FCODE_SYNC_RESPONSE:
+  case THERMIT_FCODE_SYNC_ACK:
+  case THERMIT_FCODE_OUT_OF_SYNC:
+    break;
+
+  default:
+    if (prv->state == THERMIT_RUNNING)
+    {
+      ret = (thermitCheckType_t)prv->parameters.checkType;
+    }
+    break;
+  }
+
+  return ret;
+}
+
 static int parsePacketContent(thermitPrv_t *prv)
 {
   int ret = -1;
@@ -672,27 +2572,97 @@ static int parsePacketContent(thermitPrv_t *prv)
     if ((pkt->rawLen > 0) && (pkt->rawLen <= THERMIT_MSG_SIZE_MAX))
     {
       uint8_t *p = pkt->rawBuf;
-      uint8_t plLen = p[THERMIT_PAYLOAD_LEN_OFFSET];
+      uint8_t hLen = frameHeaderLength(p[THERMIT_FCODE_OFFSET]);
+      uint8_t wireLen = ((pkt->rawLen >= hLen) ? p[hLen - 1] : 0xFF);
 
-      if ((plLen <= THERMIT_PAYLOAD_SIZE) && (THERMIT_EXPECTED_LENGHT(plLen) == pkt->rawLen))
+      if ((wireLen <= (THERMIT_MSG_SIZE_MAX - hLen - THERMIT_FOOTER_LENGTH)) && (hLen + wireLen + THERMIT_FOOTER_LENGTH == pkt->rawLen))
       {
-        uint8_t *crcPtr = &(p[THERMIT_CRC_OFFSET(plLen)]);
-        uint16_t calculatedCrc;
-        uint16_t receivedCrc;
         thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
+        uint8_t plLen = wireLen;
+        bool crcIsValid = false;
+
+        if (frameCheckType(prv, p[THERMIT_FCODE_OFFSET]) == THERMIT_CHECK_CRC32C)
+        {
+          if (wireLen >= THERMIT_CRC32C_EXTRA_LENGTH)
+          {
+            plLen = wireLen - THERMIT_CRC32C_EXTRA_LENGTH;
+
+            switch (pkt->check)
+            {
+            case THERMIT_FRAME_CRC32C_OK:
+              /*already verified by the device while receiving*/
+              crcIsValid = true;
+              break;
+
+            case THERMIT_FRAME_UNCHECKED:
+              {
+                uint8_t *crcPtr = &(p[hLen + plLen]);
+
+                crcIsValid = (msgGetU32(&crcPtr) == tgt->sysCrc32c(p, hLen + plLen));
+              }
+              break;
+
+            default:
+              break;
+            }
+          }
+        }
+        else
+        {
+          switch (pkt->check)
+          {
+          case THERMIT_FRAME_CRC16_OK:
+            /*already verified by the device while receiving*/
+            crcIsValid = true;
+            break;
 
-        receivedCrc = msgGetU16(&crcPtr);
-        calculatedCrc = tgt->sysCrc16(p, THERMIT_CRC_OFFSET(plLen));
+          case THERMIT_FRAME_UNCHECKED:
+            {
+              uint8_t *crcPtr = &(p[hLen + plLen]);
+
+              crcIsValid = (msgGetU16(&crcPtr) == tgt->sysCrc16(p, hLen + plLen));
+            }
+            break;
+
+          default:
+            break;
+          }
+        }
 
-        if (receivedCrc == calculatedCrc)
+        if (crcIsValid)
         {
-          pkt->fCode = p[THERMIT_FCODE_OFFSET];
+          pkt->headerLen = hLen;
           pkt->recFileId = p[THERMIT_REC_FILEID_OFFSET];
-          pkt->recFeedback = p[THERMIT_REC_FEEDBACK_OFFSET];
-          pkt->sndFileId = p[THERMIT_SND_FILEID_OFFSET];
-          pkt->sndChunkNo = p[THERMIT_SND_CHUNKNO_OFFSET];
+
+          if (hLen == THERMIT_HEADER_LENGTH_WIDE)
+          {
+            uint8_t *fieldPtr = &(p[THERMIT_REC_FEEDBACK_OFFSET]);
+
+            pkt->fCode = p[THERMIT_FCODE_OFFSET] & (uint8_t)~THERMIT_FCODE_WIDE_HEADER;
+            pkt->recFeedback = msgGetU32(&fieldPtr);
+            pkt->sndFileId = p[THERMIT_SND_FILEID_OFFSET_WIDE];
+            fieldPtr = &(p[THERMIT_SND_CHUNKNO_OFFSET_WIDE]);
+            pkt->sndChunkNo = msgGetU32(&fieldPtr);
+          }
+          else
+          {
+            pkt->fCode = p[THERMIT_FCODE_OFFSET];
+            pkt->recFeedback = p[THERMIT_REC_FEEDBACK_OFFSET];
+            pkt->sndFileId = p[THERMIT_SND_FILEID_OFFSET];
+            pkt->sndChunkNo = p[THERMIT_SND_CHUNKNO_OFFSET];
+
+            if (pkt->recFeedback == THERMIT_FEEDBACK_FILE_IS_READY_SHORT)
+            {
+              pkt->recFeedback = THERMIT_FEEDBACK_FILE_IS_READY;
+            }
+            else if (pkt->recFeedback == THERMIT_FEEDBACK_UNKNOWN_SHORT)
+            {
+              pkt->recFeedback = THERMIT_FEEDBACK_UNKNOWN;
+            }
+          }
+
           pkt->payloadLen = plLen;
-          pkt->payloadPtr = ((plLen > 0) ? &(p[THERMIT_PAYLOAD_OFFSET]) : NULL);
+          pkt->payloadPtr = ((plLen > 0) ? &(p[hLen]) : NULL);
 
           ret = 0;
         }
@@ -707,47 +2677,82 @@ static int parsePacketContent(thermitPrv_t *prv)
   return ret;
 }
 
+/*feedback in the compact header: no chunk numbers past 8 bits*/
+static uint8_t compactFeedback(uint32_t feedback)
+{
+  uint8_t ret = (uint8_t)feedback;
+
+  if(feedback == THERMIT_FEEDBACK_FILE_IS_READY)
+  {
+    ret = THERMIT_FEEDBACK_FILE_IS_READY_SHORT;
+  }
+  else if(feedback >= THERMIT_CHUNK_COUNT_MAX)
+  {
+    ret = THERMIT_FEEDBACK_UNKNOWN_SHORT;
+  }
+  return ret;
+}
+
 static uint8_t* framePrepare(thermitPrv_t *prv)
 {
   uint8_t *p = NULL;
 
   if(prv)
   {
-    thermitProgress_t *rx = &(prv->rxProgress);
-    thermitProgress_t *tx = &(prv->txProgress);
+    thermitProgress_t *rx = prv->rxProgress;
+    thermitProgress_t *tx = prv->txProgress;
     thermitPacket_t *pkt = &(prv->packet);
     p = pkt->rawBuf;
 
-    if(rx->running)
+    /*recFileId comes with the feedback, see feedbackSelect()*/
+    if(tx && tx->running)
     {
-      pkt->recFileId = rx->fileId;
+      pkt->sndFileId = tx->fileId;
     }
     else
     {
-      pkt->recFileId = 0;
+      pkt->sndFileId = THERMIT_FILEID_INACTIVE;
     }
 
-    if(tx->running)
+
+    /*the wide header is used when the file the frame is about is a large one.
+      A chunk of a small file always goes with the compact header, as its size is fixed by that.*/
+    if(frameAllowsWideHeader(pkt->fCode) &&
+       ((tx && tx->running && tx->isLarge) || (rx && rx->running && rx->isLarge && !pkt->carriesChunk)))
     {
-      pkt->sndFileId = tx->fileId;
+      pkt->headerLen = THERMIT_HEADER_LENGTH_WIDE;
+
+      msgPutU8(&p, pkt->fCode | THERMIT_FCODE_WIDE_HEADER);
+      msgPutU8(&p, pkt->recFileId);
+      msgPutU32(&p, pkt->recFeedback);
+      msgPutU8(&p, pkt->sndFileId);
+      msgPutU32(&p, pkt->sndChunkNo);
+      msgPutU8(&p, pkt->payloadLen);
     }
     else
     {
-      pkt->sndFileId = 0;
+      pkt->headerLen = THERMIT_HEADER_LENGTH;
+
+      msgPutU8(&p, pkt->fCode);
+      msgPutU8(&p, pkt->recFileId);
+      msgPutU8(&p, compactFeedback(pkt->recFeedback));
+      msgPutU8(&p, pkt->sndFileId);
+      msgPutU8(&p, (uint8_t)pkt->sndChunkNo);
+      msgPutU8(&p, pkt->payloadLen);
     }
-
-
-    msgPutU8(&p, pkt->fCode);
-    msgPutU8(&p, pkt->recFileId);
-    msgPutU8(&p, pkt->recFeedback);
-    msgPutU8(&p, pkt->sndFileId);
-    msgPutU8(&p, pkt->sndChunkNo);
-    msgPutU8(&p, pkt->payloadLen);
   }
 
   return p;
 }
 
+/*payload room of a frame with the compact header*/
+static uint8_t frameCapacity(thermitPrv_t *prv)
+{
+  thermitPacket_t *pkt = &(prv->packet);
+
+  return ((frameCheckType(prv, pkt->fCode) == THERMIT_CHECK_CRC32C) ? THERMIT_PAYLOAD_SIZE_CRC32C : THERMIT_PAYLOAD_SIZE);
+}
+
 static int frameFinalize(thermitPrv_t *prv, uint8_t len)
 {
   int ret = -1;
@@ -756,21 +2761,28 @@ static int frameFinalize(thermitPrv_t *prv, uint8_t len)
   {
     thermitPacket_t *pkt = &(prv->packet);
 
-    if(len <= THERMIT_PAYLOAD_SIZE)
+    thermitCheckType_t checkType = frameCheckType(prv, pkt->fCode);
+
+    if(len <= (frameCapacity(prv) - (pkt->headerLen - THERMIT_HEADER_LENGTH)))
     {
       uint8_t *p = pkt->rawBuf;
       uint8_t *crcPtr;
       uint8_t bytesToCover;
-      uint16_t calculatedCrc;
       thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
 
-      p[THERMIT_PAYLOAD_LEN_OFFSET] = len;
-      bytesToCover = THERMIT_CRC_OFFSET(len);
+      bytesToCover = pkt->headerLen + len;
       crcPtr = &(p[bytesToCover]);
 
-      calculatedCrc = tgt->sysCrc16(pkt->rawBuf, (uint16_t)bytesToCover); 
-
-      msgPutU16(&crcPtr, calculatedCrc);
+      if(checkType == THERMIT_CHECK_CRC32C)
+      {
+        p[pkt->headerLen - 1] = len + THERMIT_CRC32C_EXTRA_LENGTH;
+        msgPutU32(&crcPtr, tgt->sysCrc32c(pkt->rawBuf, (uint16_t)bytesToCover));
+      }
+      else
+      {
+        p[pkt->headerLen - 1] = len;
+        msgPutU16(&crcPtr, tgt->sysCrc16(pkt->rawBuf, (uint16_t)bytesToCover));
+      }
 
       pkt->rawLen = msgLen(pkt->rawBuf, crcPtr);
 
@@ -787,14 +2799,63 @@ static int deSerializeParameterStruct(uint8_t *buf, uint8_t len, thermitParamete
 
   if (buf && params)
   {
-    uint8_t expectedLen = sizeof(uint16_t) * 5;
-    if (len == expectedLen)
+    /*a newer peer sends more fields: the ones not known here are left out, the common
+      version keeps their features off*/
+    if ((len >= sizeof(uint16_t) * THERMIT_PARAMETER_COUNT_LEGACY) && ((len % sizeof(uint16_t)) == 0))
     {
       params->version = msgGetU16(&buf);
       params->chunkSize = msgGetU16(&buf);
       params->maxFileSize = msgGetU16(&buf);
       params->keepAliveMs = msgGetU16(&buf);
       params->burstLength = msgGetU16(&buf);
+      params->checkType = THERMIT_CHECK_CRC16;
+      params->maxFileSize64k = 0;
+      params->transferSlots = 1;
+      params->fecGroup = 0;
+      params->fecParity = 1;
+      params->compression = 0;
+      params->dictionaryId = 0;
+      params->delta = 0;
+
+      if (len >= sizeof(uint16_t) * THERMIT_PARAMETER_COUNT_V2)
+      {
+        params->checkType = msgGetU16(&buf);
+      }
+
+      if (len >= sizeof(uint16_t) * THERMIT_PARAMETER_COUNT_V3)
+      {
+        params->maxFileSize64k = msgGetU16(&buf);
+      }
+
+      if (len >= sizeof(uint16_t) * THERMIT_PARAMETER_COUNT_V6)
+      {
+        params->transferSlots = msgGetU16(&buf);
+      }
+
+      if (len >= sizeof(uint16_t) * THERMIT_PARAMETER_COUNT_V7)
+      {
+        params->fecGroup = msgGetU16(&buf);
+      }
+
+      if (len >= sizeof(uint16_t) * THERMIT_PARAMETER_COUNT_V8)
+      {
+        params->fecParity = msgGetU16(&buf);
+      }
+
+      if (len >= sizeof(uint16_t) * THERMIT_PARAMETER_COUNT_V9)
+      {
+        params->compression = msgGetU16(&buf);
+      }
+
+      if (len >= sizeof(uint16_t) * THERMIT_PARAMETER_COUNT_V10)
+      {
+        params->dictionaryId = msgGetU16(&buf);
+      }
+
+      if (len >= sizeof(uint16_t) * THERMIT_PARAMETER_COUNT)
+      {
+        params->delta = msgGetU16(&buf);
+      }
 
       ret = 0;
     }
@@ -805,7 +2866,7 @@ static int deSerializeParameterStruct(uint8_t *buf, uint8_t len, thermitParamete
 static int serializeParameterStruct(uint8_t *buf, uint8_t *len, thermitParameters_t *params)
 {
   int ret = -1;
-  uint8_t expectedLen = sizeof(uint16_t) * 5;
+  uint8_t expectedLen = sizeof(uint16_t) * THERMIT_PARAMETER_COUNT;
   uint8_t *bufStart = buf;
 
   if (buf && len && params && (*len >= expectedLen))
@@ -815,6 +2876,14 @@ static int serializeParameterStruct(uint8_t *buf, uint8_t *len, thermitParameter
     msgPutU16(&buf, params->maxFileSize);
     msgPutU16(&buf, params->keepAliveMs);
     msgPutU16(&buf, params->burstLength);
+    msgPutU16(&buf, params->checkType);
+    msgPutU16(&buf, params->maxFileSize64k);
+    msgPutU16(&buf, params->transferSlots);
+    msgPutU16(&buf, params->fecGroup);
+    msgPutU16(&buf, params->fecParity);
+    msgPutU16(&buf, params->compression);
+    msgPutU16(&buf, params->dictionaryId);
+    msgPutU16(&buf, params->delta);
 
     *len = msgLen(bufStart, buf);
 
@@ -824,8 +2893,6 @@ static int serializeParameterStruct(uint8_t *buf, uint8_t *len, thermitParameter
   return ret;
 }
 
-#define GET_MAX(_a, _b) ((_a) > (_b) ? (_a) : (_b))
-#define GET_MIN(_a, _b) ((_a) < (_b) ? (_a) : (_b))
 
 static int findBestCommonParameterSet(thermitParameters_t *p1, thermitParameters_t *p2, thermitParameters_t *result)
 {
@@ -839,12 +2906,83 @@ static int findBestCommonParameterSet(thermitParameters_t *p1, thermitParameters
     result->maxFileSize = GET_MIN(p1->maxFileSize, p2->maxFileSize);
     result->keepAliveMs = GET_MIN(p1->keepAliveMs, p2->keepAliveMs);
     result->burstLength = GET_MIN(p1->burstLength, p2->burstLength);
+    result->checkType = GET_MIN(p1->checkType, p2->checkType);
+    result->maxFileSize64k = GET_MIN(p1->maxFileSize64k, p2->maxFileSize64k);
+
+    result->transferSlots = GET_MIN(p1->transferSlots, p2->transferSlots);
+
+    if(result->version < THERMIT_VERSION_LARGE_FILES)
+    {
+      result->maxFileSize64k = 0;
+    }
+
+    if(result->version < THERMIT_VERSION_TRANSFER_SLOTS)
+    {
+      result->transferSlots = 1;
+    }
+    result->transferSlots = GET_MIN(GET_MAX(result->transferSlots, 1), THERMIT_TRANSFER_SLOTS);
+
+    /*both ends must want the parity frames*/
+    result->fecGroup = GET_MIN(p1->fecGroup, p2->fecGroup);
+    if(result->version < THERMIT_VERSION_FEC)
+    {
+      result->fecGroup = 0;
+    }
+    result->fecGroup = GET_MIN(result->fecGroup, THERMIT_CHUNK_COUNT_MAX);
+
+    /*the parity frame number is added to the first chunk number of the group, so there
+      are at most as many parity frames as chunks. The Cauchy matrix of the erasure code
+      needs a different GF(256) element for each chunk and each parity frame.*/
+    result->fecParity = GET_MIN(p1->fecParity, p2->fecParity);
+    if(result->version < THERMIT_VERSION_ERASURE_CODE)
+    {
+      result->fecParity = GET_MIN(result->fecParity, 1);
+    }
+    result->fecParity = GET_MIN(result->fecParity, result->fecGroup);
+    result->fecParity = GET_MIN(result->fecParity, 256 - result->fecGroup);
+    if(result->fecParity == 0)
+    {
+      result->fecGroup = 0;
+    }
+
+    /*the best codec offered by both ends: the highest common bit. The dictionary
+      codec needs the same dictionary at both ends.*/
+    result->compression = p1->compression & p2->compression;
+    if(result->version < THERMIT_VERSION_COMPRESSION)
+    {
+      result->compression = 0;
+    }
+    result->dictionaryId = ((p1->dictionaryId == p2->dictionaryId) ? p1->dictionaryId : 0);
+    if((result->version < THERMIT_VERSION_DICTIONARY) || (result->dictionaryId == 0))
+    {
+      result->dictionaryId = 0;
+      result->compression &= (uint16_t)~THERMIT_CODEC_LZ_DICT;
+    }
+    while(result->compression & (result->compression - 1))
+    {
+      result->compression &= (uint16_t)(result->compression - 1);
+    }
+
+    /*each end may be the receiver: both must know the signature and report frames*/
+    result->delta = GET_MIN(p1->delta, p2->delta);
+    if(result->version < THERMIT_VERSION_DELTA)
+    {
+      result->delta = 0;
+    }
+
+    /*the wider frame check takes its room from the payload*/
+    if(result->checkType == THERMIT_CHECK_CRC32C)
+    {
+      result->chunkSize = GET_MIN(result->chunkSize, THERMIT_PAYLOAD_SIZE_CRC32C);
+    }
 
     /*check that the max file size still makes sense*/
     result->maxFileSize = GET_MIN(result->maxFileSize, result->chunkSize * THERMIT_CHUNK_COUNT_MAX);
 
     /*there is no point sending longer bursts than the max file size allows*/
     result->burstLength = GET_MIN(p1->burstLength, result->maxFileSize / result->chunkSize);
+    result->burstLength = GET_MIN(result->burstLength, THERMIT_BURST_LENGTH_MAX);
+    result->burstLength = GET_MAX(result->burstLength, 1);
 
     ret = 0;
   }
@@ -956,6 +3094,7 @@ static int waitForSyncResponse(thermitPrv_t *prv)
           if(compareParameterSet(&params, &result) == 0)
           {
             /*now we agree on the parameter set. It will be sent to master at tx stage.*/
+            memcpy(&(prv->parameters), &result, sizeof(thermitParameters_t));
             ret = changeState(prv, THERMIT_SYNC_SECOND);
           }
         }      
@@ -977,7 +3116,7 @@ static int waitForSyncResponse(thermitPrv_t *prv)
 }
 
 
-static uint8_t fillFileInfoMessage(uint8_t *plBuf, uint8_t *fileName, uint16_t fileSize)
+static uint8_t fillFileInfoMessage(uint8_t *plBuf, uint8_t *fileName, uint32_t fileSize, bool isLarge)
 {
   uint8_t bytesWritten = 0;
 
@@ -990,11 +3129,18 @@ static uint8_t fillFileInfoMessage(uint8_t *plBuf, uint8_t *fileName, uint16_t f
     uint8_t fnBytesMax = THERMIT_FILENAME_MAX;
 
     /*
-    uint16_t size
+    uint16_t size (uint32_t for large files)
     uint8_t fileNameLen
     uint8_t fileName[fileNameLen]    
     */
-    msgPutU16(&plBuf, fileSize);
+    if(isLarge)
+    {
+      msgPutU32(&plBuf, fileSize);
+    }
+    else
+    {
+      msgPutU16(&plBuf, (uint16_t)fileSize);
+    }
     lenBytePtr = plBuf++; /*store this as we need to update it later*/
     while(fnBytesMax--)
     {
@@ -1019,84 +3165,468 @@ static void handleDataMessage(thermitPrv_t *prv)
 {
   if(prv->state == THERMIT_RUNNING)
   {
-    thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
-    thermitProgress_t *rxProgress = &(prv->rxProgress);
-    thermitProgress_t *txProgress = &(prv->txProgress);
     thermitPacket_t *pkt = &(prv->packet);
+    thermitProgress_t *rxProgress = slotFind(prv, prv->rxSlots, pkt->sndFileId);
+    uint8_t unpackedBuf[THERMIT_PAYLOAD_SIZE];
+    uint8_t *chunkPtr = pkt->payloadPtr;
+    int chunkLen = pkt->payloadLen;
+
+    prv->rxProgress = rxProgress;
+
+    if(rxProgress && (pkt->fCode == THERMIT_FCODE_DATA_COMPRESSED))
+    {
+      chunkPtr = unpackedBuf;
+      chunkLen = chunkDecompress(prv, pkt->payloadPtr, pkt->payloadLen, unpackedBuf, sizeof(unpackedBuf));
+    }
 
-    if(rxProgress->running)
+    if(pkt->sndFileId != THERMIT_FILEID_INACTIVE)
     {
-      if(pkt->sndFileId == rxProgress->fileId)
+      if(rxProgress == NULL)
+      {
+        if(!readyFileRemind(prv, pkt->sndFileId))
+        {
+          DEBUG_INFO(prv, "RX: no incoming file with FileID %d.\r\n", pkt->sndFileId);
+        }
+      }
+      else if(!progressChunkIsInWindow(rxProgress, pkt->sndChunkNo) || (chunkLen < 0) ||
+              ((uint32_t)chunkLen != THERMIT_CHUNK_LENGTH(pkt->sndChunkNo, rxProgress)))
+      {
+        /*no chunk in this frame, or a chunk we can not take now*/
+      }
+      else
       {
-        uint16_t offset = THERMIT_FILE_OFFSET(pkt->sndChunkNo, prv);
-        int16_t length = pkt->payloadLen;
+        uint32_t offset = THERMIT_FILE_OFFSET(pkt->sndChunkNo, rxProgress);
+        int16_t length = (int16_t)chunkLen;
+        bool isNew = !progressGetChunkIsDone(prv, rxProgress, pkt->sndChunkNo);
 
-        DEBUG_INFO(prv, "Chunk %d of file %d received.\r\n", pkt->sndChunkNo, pkt->sndFileId);
-        DEBUG_INFO(prv, "writing offset=%d, length=%d.\r\n", offset, length);
+        DEBUG_INFO(prv, "Chunk %lu of file %d received.\r\n", (unsigned long)pkt->sndChunkNo, pkt->sndFileId);
+        DEBUG_INFO(prv, "writing offset=%lu, length=%d.\r\n", (unsigned long)offset, length);
 
-        if(tgt->fileWrite(rxProgress->fileHandle, offset, pkt->payloadPtr, length) == 0)
+        if(fileWrite(prv, rxProgress->fileHandle, offset, chunkPtr, length) == 0)
         {
-          uint8_t dirtyChunk;
+          if(isNew)
+          {
+            fecAdd(prv, rxProgress, pkt->sndChunkNo, chunkPtr, length);
+          }
 
           progressSetChunkStatus(prv, rxProgress, pkt->sndChunkNo, true);
           debugDumpProgress(prv, rxProgress, "", "\r\n");
 
-          /*check if the file is ready*/
-          if(progressGetFirstDirty(prv, rxProgress, &dirtyChunk) == false)
-          {
-            thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
-            DEBUG_INFO(prv, "successfully received file, closing rx file transfer.\r\n");
+          /*the sender waits for feedback after the last chunk, and a chunk from an
+            earlier pass or a tail loss probe tells that it is waiting already*/
+          if((pkt->sndChunkNo + 1 >= rxProgress->numberOfChunksNeeded) || (pkt->sndChunkNo < rxProgress->chunkNo))
+          {
+            rxProgress->feedbackNow = true;
+          }
+
+          /*the chunks taken from the old copy are no gap*/
+          while((rxProgress->chunkNo < pkt->sndChunkNo) && progressGetChunkIsDone(prv, rxProgress, rxProgress->chunkNo))
+          {
+            rxProgress->chunkNo++;
+          }
+
+          if(pkt->sndChunkNo >= rxProgress->chunkNo)
+          {
+            if((pkt->sndChunkNo > rxProgress->chunkNo) && (prv->parameters.version >= THERMIT_VERSION_EARLY_NACK))
+            {
+              DEBUG_INFO(prv, "chunks %lu..%lu missing, sending nack.\r\n", (unsigned long)rxProgress->chunkNo, (unsigned long)(pkt->sndChunkNo - 1));
+              gapQueuePut(rxProgress, rxProgress->chunkNo, pkt->sndChunkNo - rxProgress->chunkNo);
+            }
+            rxProgress->chunkNo = pkt->sndChunkNo + 1;
+          }
+
+          /*a chunk arriving after the parity frames may be the one still needed*/
+          if(isNew)
+          {
+            (void)fecRepair(prv, rxProgress, pkt->sndChunkNo);
+          }
+
+          rxFileCheckReady(prv, rxProgress);
+        }
+        else
+        {
+          DEBUG_INFO(prv, "file writing failed.\r\n");
+        }
+      }
+    }
+
+    handleFeedback(prv);
+  }
+}
+
+static void rxFileCheckReady(thermitPrv_t *prv, thermitProgress_t *rxProgress)
+{
+  uint32_t dirtyChunk;
+
+  if(progressGetFirstDirty(prv, rxProgress, &dirtyChunk) == false)
+  {
+    thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
+
+    if(rxProgress->deltaFileHashValid && !deltaFileHashMatches(prv, rxProgress))
+    {
+      /*a block taken from the old copy was not the one signed: drop the file*/
+      DEBUG_ERR(prv, "received file does not match its hash, sending error frame\r\n");
+      prv->diagnostics.deltaHashFailures++;
+      fileDiscard(prv, rxProgress->fileHandle);
+      deltaCopyClose(prv, rxProgress);
+      rxProgress->running = false;
+      prv->sendWTF = true;
+    }
+    else
+    {
+      DEBUG_INFO(prv, "successfully received file, closing rx file transfer.\r\n");
+
+      tgt->fileClose(rxProgress->fileHandle);
+      deltaCopyClose(prv, rxProgress);
+      rxProgress->running = false;
+      readyFileAdd(prv, rxProgress->fileId);
+    }
+  }
+}
+
+/*parity frame: add it to the parity collected for the group, and rebuild the missing
+  chunks if it was the one still needed*/
+static void handleParity(thermitPrv_t *prv)
+{
+  if(prv->state == THERMIT_RUNNING)
+  {
+    thermitPacket_t *pkt = &(prv->packet);
+    thermitProgress_t *rxProgress = slotFind(prv, prv->rxSlots, pkt->sndFileId);
+    uint16_t groupSize = prv->parameters.fecGroup;
+
+    prv->rxProgress = rxProgress;
+
+    if(rxProgress && (groupSize > 0))
+    {
+      uint16_t parityNo = (uint16_t)(pkt->sndChunkNo % groupSize);
+      uint32_t groupStart = pkt->sndChunkNo - parityNo;
+
+      if((parityNo < prv->parameters.fecParity) && progressChunkIsInWindow(rxProgress, groupStart) &&
+         (pkt->payloadLen == THERMIT_CHUNK_LENGTH(groupStart, rxProgress)))
+      {
+        if(fecGroupSelect(rxProgress, groupStart) && !rxProgress->fecParityHeld[parityNo])
+        {
+          fecMulAdd(prv, rxProgress->fecBuf[parityNo], pkt->payloadPtr, 1, pkt->payloadLen);
+          rxProgress->fecParityHeld[parityNo] = true;
+        }
+
+        if(fecRepair(prv, rxProgress, groupStart) > 0)
+        {
+          rxFileCheckReady(prv, rxProgress);
+        }
+
+        /*the gaps left in the group are reported after its last parity frame*/
+        if(parityNo + 1 >= fecParityCount(prv, rxProgress, groupStart))
+        {
+          rxProgress->fecParityNext = groupStart + groupSize;
+        }
+      }
+    }
+
+    handleFeedback(prv);
+  }
+}
+
+/*feedback for our outgoing file: recFeedback of any data frame, completed by the selective ack bitmap*/
+static void handleFeedback(thermitPrv_t *prv)
+{
+  thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
+  thermitPacket_t *pkt = &(prv->packet);
+  thermitProgress_t *txProgress = slotFind(prv, prv->txSlots, pkt->recFileId);
+
+  if(pkt->recFileId != THERMIT_FILEID_INACTIVE)
+  {
+    if(txProgress)
+    {
+      if(txProgress->infoHeld)
+      {
+        /*the receiver knows the file: the rest of the pass follows the first burst*/
+        txProgress->infoHeld = false;
+        txProgress->waitForFeedback = false;
+      }
+
+      switch(pkt->recFeedback)
+      {
+        case THERMIT_FEEDBACK_FILE_IS_READY:
+          rttFeedbackReceived(prv, txProgress, true);
+          txProgress->running = false;
+          DEBUG_INFO(prv, "file sending finished successfully\r\n");
+          (void)tgt->fileClose(txProgress->fileHandle);
+          break;
+
+        case THERMIT_FEEDBACK_UNKNOWN:
+          /*the feedback did not fit into the compact header*/
+          rttFeedbackReceived(prv, txProgress, false);
+          break;
+
+        default:
+          prv->firstDirtyChunk = pkt->recFeedback;
+
+          /*everything before the first dirty chunk has been received*/
+          progressSetDoneBefore(prv, txProgress, prv->firstDirtyChunk);
+          rttFeedbackReceived(prv, txProgress, false);
+
+          /*a round of signatures waits for its report, not for this. The chunks still on
+            their way are not missing: stale feedback is left to the probe and the timeout.*/
+          if(txProgress->waitForFeedback && !txProgress->deltaWaiting && rttFeedbackIsCurrent(prv, txProgress))
+          {
+            uint32_t dirtyChunk;
+
+            txProgress->waitForFeedback = false;
+
+            if(progressGetFirstDirty(prv, txProgress, &dirtyChunk))
+            {
+              txProgress->chunkNo = dirtyChunk;
+
+              /*the chunks past the signed ones have not been sent at all*/
+              if((txProgress->deltaBlockChunks == 0) || (dirtyChunk < txProgress->deltaSignedEnd))
+              {
+                if(prv->parameters.fecGroup > 0)
+                {
+                  /*the parity frames have rebuilt most of the losses: resend only the chunks the
+                    receiver reports missing, the first dirty one even without a bitmap*/
+                  txProgress->resendEnd = GET_MAX(txProgress->ackedEnd, dirtyChunk + 1);
+                }
+                txProgress->resending = true;
+                prv->burstLossEvents++;
+                DEBUG_INFO(prv, "first round of file transfer was completed, now resending dirty chunk %lu.\r\n", (unsigned long)txProgress->chunkNo);
+              }
+            }
+            else
+            {
+              /*nothing to resend: the file is ready once the receiver says so*/
+              txProgress->waitForFeedback = true;
+            }
+          }
+
+          break;
+      }
+    }
+    else
+    {
+      DEBUG_INFO(prv, "TX: no outgoing file with FileID %d.\r\n", pkt->recFileId);
+    }
+  }
+}
+
+static void handleSelectiveAck(thermitPrv_t *prv)
+{
+  if(prv->state == THERMIT_RUNNING)
+  {
+    thermitPacket_t *pkt = &(prv->packet);
+    thermitProgress_t *txProgress = slotFind(prv, prv->txSlots, pkt->recFileId);
+
+    if(txProgress)
+    {
+      (void)mergeSelectiveAck(prv, txProgress, pkt->payloadPtr, pkt->payloadLen);
+    }
+
+    handleFeedback(prv);
+  }
+}
+
+/*the chunk status bitmap of the selective ack and the delta report. False if it does not match the file.*/
+static bool mergeSelectiveAck(thermitPrv_t *prv, thermitProgress_t *txProgress, uint8_t *map, uint8_t len)
+{
+  bool ret = true;
+  uint32_t mapStart = 0;
+
+  if(txProgress->isLarge && (len > sizeof(uint32_t)))
+  {
+    /*large file: the bitmap covers the receiver's window*/
+    mapStart = msgGetU32(&map);
+    len -= sizeof(uint32_t);
+  }
+  else if(!txProgress->isLarge && (len == DIVISION_ROUNDED_UP(txProgress->numberOfChunksNeeded, 8)))
+  {
+    /*the bitmap covers the whole file*/
+  }
+  else
+  {
+    DEBUG_INFO(prv, "selective ack length %d does not match the file.\r\n", len);
+    ret = false;
+  }
+
+  if(ret)
+  {
+    uint32_t chunkNo = GET_MIN(mapStart + (uint32_t)len * 8, txProgress->numberOfChunksNeeded);
+
+    progressMergeDirty(prv, txProgress, mapStart, map, len);
+
+    /*the dirty chunks before the highest one received are missing, not on their way*/
+    while((chunkNo > mapStart) && (map[(chunkNo - 1 - mapStart) / 8] & (1 << ((chunkNo - 1 - mapStart) % 8))))
+    {
+      chunkNo--;
+    }
+    txProgress->ackedEnd = GET_MAX(txProgress->ackedEnd, chunkNo);
+  }
+  return ret;
+}
+
+static void handleNack(thermitPrv_t *prv)
+{
+  if(prv->state == THERMIT_RUNNING)
+  {
+    thermitPacket_t *pkt = &(prv->packet);
+    thermitProgress_t *txProgress = slotFind(prv, prv->txSlots, pkt->recFileId);
+
+    if(txProgress)
+    {
+      uint8_t *p = pkt->payloadPtr;
+      bool isWide = (pkt->headerLen == THERMIT_HEADER_LENGTH_WIDE);
+      uint8_t gaps = pkt->payloadLen / (isWide ? THERMIT_NACK_GAP_LENGTH_WIDE : THERMIT_NACK_GAP_LENGTH);
+
+      while(gaps--)
+      {
+        uint32_t firstChunk = (isWide ? msgGetU32(&p) : msgGetU8(&p));
+        uint16_t count = (isWide ? msgGetU16(&p) : msgGetU8(&p));
+
+        gapQueuePut(txProgress, firstChunk, count);
+      }
+    }
+
+    handleFeedback(prv);
+  }
+}
+
+/*delta transfer: take the signed blocks from the old copy of the file, where they are found.
+  The report goes after the last frame of the round, or at once if there is no old copy.*/
+static void handleDeltaSignatures(thermitPrv_t *prv)
+{
+  if(prv->state == THERMIT_RUNNING)
+  {
+    thermitPacket_t *pkt = &(prv->packet);
+    thermitProgress_t *rxProgress = slotFind(prv, prv->rxSlots, pkt->sndFileId);
+
+    prv->rxProgress = rxProgress;
+
+    if((rxProgress == NULL) && (pkt->sndFileId != THERMIT_FILEID_INACTIVE))
+    {
+      (void)readyFileRemind(prv, pkt->sndFileId);
+    }
+    else if(rxProgress && (pkt->payloadLen > 0))
+    {
+      uint8_t *p = pkt->payloadPtr;
+      uint8_t blockInfo = msgGetU8(&p);
+      uint16_t blockChunks = blockInfo & (uint8_t)~(THERMIT_DELTA_LAST_FRAME | THERMIT_DELTA_FILE_HASH);
+      uint8_t signaturesLen = pkt->payloadLen - 1;
+
+      if((blockInfo & THERMIT_DELTA_FILE_HASH) && (signaturesLen >= THERMIT_DELTA_FILE_HASH_LENGTH))
+      {
+        uint8_t *hashPtr = pkt->payloadPtr + pkt->payloadLen - THERMIT_DELTA_FILE_HASH_LENGTH;
+
+        signaturesLen -= THERMIT_DELTA_FILE_HASH_LENGTH;
+        rxProgress->deltaFileHash = msgGetU32(&hashPtr);
+        rxProgress->deltaFileHashValid = true;
+      }
+
+      if(rxProgress->deltaCopyOpen && (blockChunks > 0) && (blockChunks <= THERMIT_DELTA_BLOCK_CHUNKS_MAX))
+      {
+        thermitDeltaBlock_t blocks[THERMIT_PAYLOAD_SIZE / THERMIT_DELTA_SIGNATURE_LENGTH];
+        uint32_t blockLength = (uint32_t)blockChunks * rxProgress->chunkSize;
+        uint8_t signatures = (uint8_t)GET_MIN((uint32_t)signaturesLen / THERMIT_DELTA_SIGNATURE_LENGTH, sizeof(blocks) / sizeof(blocks[0]));
+        uint8_t count = 0;
+        bool searchNeeded = false;
+
+        while(count < signatures)
+        {
+          thermitDeltaBlock_t *block = &(blocks[count]);
+          uint32_t dirtyChunk;
+
+          block->firstChunk = pkt->sndChunkNo + (uint32_t)count * blockChunks;
+          block->weak = msgGetU32(&p);
+          block->strong = msgGetU32(&p);
+
+          if(block->firstChunk >= rxProgress->numberOfChunksNeeded)
+          {
+            break;
+          }
+          block->length = GET_MIN(blockLength, rxProgress->fileSize - THERMIT_FILE_OFFSET(block->firstChunk, rxProgress));
+          count++;
+
+          /*a repeated frame: the block may be done already*/
+          block->found = !progressGetNextDirty(prv, rxProgress, block->firstChunk, &dirtyChunk) || (dirtyChunk >= block->firstChunk + blockChunks);
+
+          if(!block->found && !deltaBlockFind(prv, rxProgress, block, blockLength))
+          {
+            searchNeeded = searchNeeded || (block->length == blockLength);
+          }
+        }
+
+        if(searchNeeded)
+        {
+          deltaSearch(prv, rxProgress, blocks, count, blockLength);
+        }
+      }
+
+      if(!rxProgress->deltaCopyOpen || (blockInfo & THERMIT_DELTA_LAST_FRAME))
+      {
+        rxProgress->deltaReportDue = true;
+      }
+
+      rxFileCheckReady(prv, rxProgress);
+    }
+
+    handleFeedback(prv);
+  }
+}
+
+/*delta transfer: the receiver has taken what it found in its old copy. The chunks it
+  did not find go next, then the next round is signed.*/
+static void handleDeltaReport(thermitPrv_t *prv)
+{
+  if(prv->state == THERMIT_RUNNING)
+  {
+    thermitPacket_t *pkt = &(prv->packet);
+    thermitProgress_t *txProgress = slotFind(prv, prv->txSlots, pkt->recFileId);
+
+    if(txProgress && (txProgress->deltaBlockChunks > 0) && (pkt->payloadLen > 0))
+    {
+      uint8_t *p = pkt->payloadPtr;
+      uint8_t flags = msgGetU8(&p);
+
+      if(flags & THERMIT_DELTA_REPORT_NO_COPY)
+      {
+        DEBUG_INFO(prv, "no old copy of file %d at the receiver, sending it as is\r\n", txProgress->fileId);
+        txProgress->deltaBlockChunks = 0;
+        txProgress->deltaWaiting = false;
+        txProgress->waitForFeedback = false;
+        txProgress->chunkNo = txProgress->deltaRoundStart;
+      }
+      else if(mergeSelectiveAck(prv, txProgress, p, pkt->payloadLen - 1) && txProgress->deltaWaiting)
+      {
+        uint32_t dirtyChunk;
+
+        txProgress->deltaWaiting = false;
+        txProgress->waitForFeedback = false;
+        txProgress->chunkNo = txProgress->deltaSignedEnd;
 
-            tgt->fileClose(rxProgress->fileHandle);
-            rxProgress->running = false;
-          }
-        }
-        else
+        if(progressGetNextDirty(prv, txProgress, txProgress->deltaRoundStart, &dirtyChunk))
         {
-          DEBUG_INFO(prv, "file writing failed.\r\n");
+          txProgress->chunkNo = GET_MIN(dirtyChunk, txProgress->deltaSignedEnd);
         }
       }
-      else
-      {
-        DEBUG_INFO(prv, "RX: FileID does not match, expected %d, got %d.\r\n", rxProgress->fileId, pkt->sndFileId);
-      }
     }
 
-    if(txProgress->running)
-    {
-      if(pkt->recFileId == txProgress->fileId)
-      {
-        switch(pkt->recFeedback)
-        {
-          case THERMIT_FEEDBACK_FILE_IS_READY:
-            txProgress->running = false;
-            DEBUG_INFO(prv, "file sending finished successfully\r\n");
-            (void)tgt->fileClose(txProgress->fileHandle);
-            break;
-
-          default:
-            prv->firstDirtyChunk = pkt->recFeedback;
+    handleFeedback(prv);
+  }
+}
 
-            if(txProgress->waitForFeedback)
-            {
-              txProgress->waitForFeedback = false;
+/*the receiver has got chunks after a missing one, and the peer understands the bitmap*/
+static bool selectiveAckNeeded(thermitPrv_t *prv, thermitProgress_t *rxProgress)
+{
+  bool ret = false;
 
-              if(prv->firstDirtyChunk < (txProgress->numberOfChunksNeeded))
-              {
-                txProgress->chunkNo = prv->firstDirtyChunk;
-                DEBUG_INFO(prv, "first round of file transfer was completed, now resending dirty chunk %d.\r\n", txProgress->chunkNo);
-              }
-            }
+  if((prv->parameters.version >= THERMIT_VERSION_SELECTIVE_ACK) && rxProgress->running)
+  {
+    uint32_t dirtyChunk;
 
-            break;
-        }
-      }
-      else
-      {
-        DEBUG_INFO(prv, "TX: FileID does not match, expected %d, got %d.\r\n", txProgress->fileId, pkt->recFileId);
-      }
+    if(progressGetFirstDirty(prv, rxProgress, &dirtyChunk) && (dirtyChunk < rxProgress->chunkNo))
+    {
+      ret = true;
     }
   }
+  return ret;
 }
 
 
@@ -1107,19 +3637,50 @@ typedef enum
   THERMIT_OUT_KEEP_ALIVE,
   THERMIT_OUT_FILE_INFO,
   THERMIT_OUT_CHUNK,
+  THERMIT_OUT_PARITY,
   THERMIT_OUT_EMPTY_DATA,
+  THERMIT_OUT_SELECTIVE_ACK,
+  THERMIT_OUT_NACK,
+  THERMIT_OUT_DELTA_REPORT,
   THERMIT_OUT_WRITE_TERMINATED_FORCEFULLY
 } outMsgClass_t;
 
 
+/*the chunk status bitmap of an incoming file, for the selective ack and the delta report.
+  The frame header must be prepared already.*/
+static uint8_t fillSelectiveAck(thermitPrv_t *prv, thermitProgress_t *rxProgress, uint8_t *plBuf)
+{
+  thermitPacket_t *pkt = &(prv->packet);
+  uint8_t plLen;
+
+  if(rxProgress->isLarge)
+  {
+    /*large file: the bitmap of the window, as much as fits*/
+    uint8_t room = frameCapacity(prv) - (pkt->headerLen - THERMIT_HEADER_LENGTH) - (uint8_t)(plBuf - &(pkt->rawBuf[pkt->headerLen]));
+    uint8_t mapLen = (uint8_t)GET_MIN(DIVISION_ROUNDED_UP(rxProgress->numberOfChunksNeeded - rxProgress->windowStart, 8), THERMIT_PROGRESS_STATUS_LENGTH);
+
+    mapLen = GET_MIN(mapLen, room - sizeof(uint32_t));
+    msgPutU32(&plBuf, rxProgress->windowStart);
+    memcpy(plBuf, rxProgress->chunkStatus, mapLen);
+    plLen = sizeof(uint32_t) + mapLen;
+  }
+  else
+  {
+    plLen = DIVISION_ROUNDED_UP(rxProgress->numberOfChunksNeeded, 8);
+    memcpy(plBuf, rxProgress->chunkStatus, plLen);
+  }
+  return plLen;
+}
+
 static outMsgClass_t updateOutGoingState(thermitPrv_t *prv)
 {
   outMsgClass_t whatToSend = THERMIT_OUT_NOTHING;
 
   if(prv)
   {
-    thermitProgress_t *txProgress = &(prv->txProgress);
     thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
+    thermitProgress_t *freeSlot = slotFindFree(prv, prv->txSlots);
+    bool burstGoingOn = (prv->burstCount > 0);  /*the rest of a burst is for file data only*/
 
     /*send error message in case of recent failure*/
     if(prv->sendWTF)
@@ -1129,39 +3690,49 @@ static outMsgClass_t updateOutGoingState(thermitPrv_t *prv)
       return THERMIT_OUT_WRITE_TERMINATED_FORCEFULLY;
     }
 
-    /*check if outgoing file transfer is currently active. If not, check
-    if a new file is available for sending. If yes, open it and start sending.*/
-    if(txProgress->running)
+    if(!burstGoingOn)
     {
-      /*send next chunk*/
-      whatToSend = THERMIT_OUT_CHUNK;
+      txSlotsTimerCheck(prv);
     }
-    else
+
+    /*report new gaps in the incoming files before anything else*/
+    if((prv->rxProgress = rxSlotWithGaps(prv)) != NULL)
+    {
+      return THERMIT_OUT_NACK;
+    }
+
+    /*the sender waits for the report to go on with the file*/
+    if((prv->rxProgress = rxSlotWithDeltaReport(prv)) != NULL)
+    {
+      return THERMIT_OUT_DELTA_REPORT;
+    }
+
+    /*start a new outgoing file whenever a slot is free, so that the next file
+      does not wait for the previous one to be acknowledged*/
+    if(freeSlot && txWindowOpen(prv))
     {
       /*open new file for sending if available*/
-      uint16_t fileSize;
+      uint16_t availableSize;
       uint8_t fName[THERMIT_FILENAME_MAX+1];
 
 #if THERMIT_EASY_MODE
       //easy mode: only master sends, slave receives
-      if((prv->isMaster) && tgt->fileAvailableForSending(fName, &fileSize))
+      if((prv->isMaster) && tgt->fileAvailableForSending(fName, &availableSize))
 #else
-      if(tgt->fileAvailableForSending(fName, &fileSize))
+      //the slave sends only to a peer that takes files from both ends
+      if((prv->isMaster || (prv->parameters.version >= THERMIT_VERSION_BIDIRECTIONAL)) && tgt->fileAvailableForSending(fName, &availableSize))
 #endif        
       {
         thermitIoSlot_t fileHandle;
+        uint32_t fileSize = availableSize;   /*fileOpen tells the real size*/
 
-        fileHandle = tgt->fileOpen(fName, THERMIT_READ, &fileSize);
+        fileHandle = fileOpen(prv, fName, THERMIT_READ, &fileSize);
         if(fileHandle >= 0)
         {
-          thermitProgress_t *txProgress = &(prv->txProgress);
+          thermitProgress_t *txProgress = freeSlot;
 
           if(progressInitialize(prv, txProgress, fileSize) >= 0)
           {
-            uint8_t *plBuf;
-            uint16_t fileInfoLen;
-            thermitPacket_t *pkt = &(prv->packet);
-
             DEBUG_INFO(prv, "starting new file transfer\r\n");
 
             txProgress->running = true;
@@ -1169,9 +3740,12 @@ static outMsgClass_t updateOutGoingState(thermitPrv_t *prv)
             txProgress->fileHandle = fileHandle;
             txProgress->fileId = prv->nextOutgoingFileId;
             txProgress->chunkNo = 0;
+            txProgress->deltaBlockChunks = deltaBlockChunks(prv, txProgress);
+            txProgress->deltaFileHash = DELTA_STRONG_INIT;
             strncpy(txProgress->fileName, fName, THERMIT_FILENAME_MAX);   /*todo optimize*/
             prv->nextOutgoingFileId = THERMIT_ADVANCE_TO_NEXT(prv->nextOutgoingFileId, THERMIT_FILEID_MAX);
 
+            prv->txProgress = txProgress;
             whatToSend = THERMIT_OUT_FILE_INFO;
           }
           else
@@ -1181,10 +3755,48 @@ static outMsgClass_t updateOutGoingState(thermitPrv_t *prv)
           }
         }
       }
-      else
+    }
+
+    if(whatToSend == THERMIT_OUT_NOTHING)
+    {
+      if((prv->txProgress = txSlotInfoToResend(prv)) != NULL)
+      {
+        /*the file info may have been lost*/
+        whatToSend = THERMIT_OUT_FILE_INFO;
+      }
+      else if((prv->txProgress = txSlotParityToSend(prv)) != NULL)
+      {
+        whatToSend = THERMIT_OUT_PARITY;
+      }
+      else if((prv->txProgress = txSlotNextToSend(prv)) != NULL)
+      {
+        /*send next chunk*/
+        whatToSend = THERMIT_OUT_CHUNK;
+      }
+      else if(burstGoingOn)
+      {
+        if(feedbackUrgent(prv))
+        {
+          /*several files are waiting for their feedback*/
+          whatToSend = THERMIT_OUT_EMPTY_DATA;
+        }
+      }
+      else if((prv->rxProgress = rxSlotNeedingSelectiveAck(prv)) != NULL)
+      {
+        whatToSend = THERMIT_OUT_SELECTIVE_ACK;
+      }
+      else if(feedbackPending(prv))
       {
+        /*the peer's files wait for our feedback*/
         whatToSend = THERMIT_OUT_EMPTY_DATA;
-        DEBUG_INFO(prv, "waiting for new file to be sent\r\n");
+      }
+      else if(keepAliveDue(prv))
+      {
+        whatToSend = THERMIT_OUT_KEEP_ALIVE;
+      }
+      else
+      {
+        /*idle or waiting for feedback: the link stays quiet*/
       }
     }
   }
@@ -1198,16 +3810,16 @@ static outMsgClass_t updateOutGoingState(thermitPrv_t *prv)
 }
 
 
-uint8_t getFeedback(thermitPrv_t *prv)
+uint32_t getFeedback(thermitPrv_t *prv)
 {
-  uint8_t fb = THERMIT_FEEDBACK_FILE_IS_READY;
+  uint32_t fb = THERMIT_FEEDBACK_FILE_IS_READY;
 
   if(prv)
   {
-    thermitProgress_t *rxProgress = &(prv->rxProgress);
-    if(rxProgress->running)
+    thermitProgress_t *rxProgress = prv->rxProgress;
+    if(rxProgress && rxProgress->running)
     {
-      uint8_t dirtyChunk = 0;
+      uint32_t dirtyChunk = 0;
       if(progressGetFirstDirty(prv, rxProgress, &dirtyChunk))
       {
         fb = dirtyChunk;
@@ -1225,63 +3837,161 @@ static int sendDataMessage(thermitPrv_t *prv)
 
   if(prv)
   {
-    thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
     thermitPacket_t *pkt = &(prv->packet);
-    thermitProgress_t *txProgress = &(prv->txProgress);
-    thermitProgress_t *rxProgress = &(prv->rxProgress);
+    thermitProgress_t *txProgress;
+    thermitProgress_t *rxProgress;
+    outMsgClass_t whatToSend;
     uint8_t *plPtr;
     uint8_t plLen;
-    uint16_t offset;
+    uint32_t offset;
     uint16_t length;
-    uint16_t readLen;
     int bytesRead;
 
-    pkt->recFeedback = getFeedback(prv);
-    pkt->recFileId = rxProgress->fileId;
-    pkt->sndChunkNo = txProgress->chunkNo;
-    pkt->sndFileId = txProgress->fileId;
+    pkt->carriesChunk = false;
+    prv->txProgress = NULL;
+    prv->rxProgress = NULL;
+
+    whatToSend = updateOutGoingState(prv);
 
-    switch(updateOutGoingState(prv))
+    /*the frame tells about the files selected for it, the feedback is picked if none was*/
+    if(whatToSend != THERMIT_OUT_NOTHING)
     {
-      case THERMIT_OUT_CHUNK:
-        offset = THERMIT_FILE_OFFSET(txProgress->chunkNo, prv);
-        length = THERMIT_CHUNK_LENGTH_TX(txProgress->chunkNo, prv);
+      feedbackSelect(prv);
+    }
+    txProgress = prv->txProgress;
+    rxProgress = prv->rxProgress;
+    pkt->sndChunkNo = (txProgress ? txProgress->chunkNo : 0);
 
-        if(!txProgress->waitForFeedback)
+    switch(whatToSend)
+    {
+      case THERMIT_OUT_CHUNK:
         {
-          pkt->fCode = THERMIT_FCODE_DATA_TRANSFER;
-          plPtr = framePrepare(prv);
-          plLen = 0;
+          uint32_t chunkNo;
+          bool fromQueue = resendQueueGet(prv, txProgress, &chunkNo);
+          bool chunkFound;
+          uint8_t chunkBuf[THERMIT_PAYLOAD_SIZE];
+          uint8_t packedBuf[THERMIT_PAYLOAD_SIZE];
+
+          if(!fromQueue)
+          {
+            if(txProgress->waitForFeedback)
+            {
+              break;
+            }
+
+            /*the receiver drops the chunks of a file it does not know: without its report
+              the file info may have been lost, so no more than a burst goes*/
+            if(!txProgress->feedbackSeen && (prv->parameters.version >= THERMIT_VERSION_RETRANSMIT_TIMER) &&
+               (txProgress->chunkNo >= prv->diagnostics.burstLength))
+            {
+              DEBUG_INFO(prv, "file %d not reported yet, will wait for feedback\r\n", txProgress->fileId);
+              txProgress->infoHeld = true;
+              txProgress->waitForFeedback = true;
+              break;
+            }
+
+            /*skip the chunks that the receiver has already acknowledged*/
+            chunkFound = progressGetNextDirty(prv, txProgress, txProgress->chunkNo, &chunkNo);
+
+            if(chunkFound && (txProgress->resendEnd > 0) && (chunkNo >= txProgress->resendEnd))
+            {
+              /*the chunks past the reported ones may still be on their way: go on with the
+                chunks not sent yet*/
+              txProgress->resendEnd = 0;
+              txProgress->resending = false;
+              chunkFound = progressGetNextDirty(prv, txProgress, GET_MAX(chunkNo, txProgress->fecSentEnd), &chunkNo);
+            }
+
+            if(!chunkFound)
+            {
+              DEBUG_INFO(prv, "no dirty chunks left, will wait for feedback\r\n");
+              txProgress->waitForFeedback = true;
+              break;
+            }
+            else if(!progressChunkIsInWindow(txProgress, chunkNo))
+            {
+              /*the receiver can not take chunks past its window: handle like the end of the pass*/
+              DEBUG_INFO(prv, "window full at chunk %lu, will wait for feedback\r\n", (unsigned long)chunkNo);
+              txProgress->waitForFeedback = true;
+              break;
+            }
+            else if((txProgress->deltaBlockChunks > 0) && (chunkNo >= txProgress->deltaSignedEnd))
+            {
+              /*the receiver may have these chunks in its old copy: send their signatures first*/
+              deltaFrameSelect(txProgress, chunkNo);
+              pkt->fCode = THERMIT_FCODE_DELTA_SIGNATURE;
+              pkt->sndChunkNo = txProgress->deltaFrameStart;
+              plPtr = framePrepare(prv);
+              plLen = fillDeltaSignatures(prv, txProgress, plPtr, frameCapacity(prv) - (pkt->headerLen - THERMIT_HEADER_LENGTH));
+
+              if((plLen > 0) && (frameFinalize(prv, plLen) == 0))
+              {
+                DEBUG_INFO(prv, "signatures of chunks %lu..%lu\r\n", (unsigned long)pkt->sndChunkNo, (unsigned long)(txProgress->deltaSignedEnd - 1));
+                prv->diagnostics.deltaSignatures++;
+                ret = 0;
+              }
+              break;
+            }
+            txProgress->chunkNo = chunkNo;
+          }
 
-          bytesRead = tgt->fileRead(txProgress->fileHandle, offset, plPtr, length);
+          offset = THERMIT_FILE_OFFSET(chunkNo, txProgress);
+          length = THERMIT_CHUNK_LENGTH(chunkNo, txProgress);
+          pkt->sndChunkNo = chunkNo;
+          pkt->carriesChunk = true;
+
+          bytesRead = fileRead(prv, txProgress->fileHandle, offset, chunkBuf, length);
           if(bytesRead >= 0)
           {
             if((uint16_t)bytesRead == length)
             {
-              plLen = length;
+              uint16_t packedLen = chunkCompress(prv, chunkBuf, length, packedBuf);
+
+              /*the chunk goes compressed only if it gets shorter*/
+              pkt->fCode = ((packedLen > 0) ? THERMIT_FCODE_DATA_COMPRESSED : THERMIT_FCODE_DATA_TRANSFER);
+              plPtr = framePrepare(prv);
+              plLen = (uint8_t)((packedLen > 0) ? packedLen : length);
+              memcpy(plPtr, ((packedLen > 0) ? packedBuf : chunkBuf), plLen);
 
               /*check if frame was correctly prepared, if yes, then advance to next chunk to be sent on the next round*/
               if(frameFinalize(prv, plLen) == 0)
               {
-                if(txProgress->chunkNo < txProgress->numberOfChunksNeeded)
+                DEBUG_INFO(prv, "%s chunk %lu: offset=%lu, length=%d\r\n", (fromQueue ? "resending" : "sending"), (unsigned long)chunkNo, (unsigned long)offset, length);
+                if(fromQueue || txProgress->resending)
+                {
+                  prv->diagnostics.retransmits++;
+                }
+                if(packedLen > 0)
                 {
-                  uint8_t nextChunk = txProgress->chunkNo+1;
-                  DEBUG_INFO(prv, "sending chunk %d: offset=%d, length=%d\r\n", txProgress->chunkNo, offset, length);
+                  prv->diagnostics.compressedChunks++;
+                  prv->diagnostics.compressionSavedBytes += length - packedLen;
+                }
+                rttChunkSent(prv, txProgress, chunkNo, (fromQueue || txProgress->resending));
+
+                if(chunkNo >= txProgress->fecSentEnd)
+                {
+                  fecAdd(prv, txProgress, chunkNo, chunkBuf, length);
+                  txProgress->fecSentEnd = chunkNo + 1;
+                }
+
+                if(!fromQueue)
+                {
+                  uint32_t nextChunk = chunkNo+1;
                   txProgress->chunkNo = nextChunk;
-  
+
                   if(nextChunk >= txProgress->numberOfChunksNeeded)
                   {
                     DEBUG_INFO(prv, "last chunk, will wait for feedback\r\n");
                     txProgress->waitForFeedback = true;
                   }
-
-                  ret = 0;
                 }
+
+                ret = 0;
               }
             }
             else
             {
-              DEBUG_ERR(prv, "file read failed: expected %d bytes, got %d.\r\n", length, readLen);
+              DEBUG_ERR(prv, "file read failed: expected %d bytes, got %d.\r\n", length, bytesRead);
             }
           }
           else
@@ -1291,19 +4001,84 @@ static int sendDataMessage(thermitPrv_t *prv)
         }
         break;
 
+      case THERMIT_OUT_PARITY:
+        pkt->sndChunkNo = txProgress->fecGroupStart + txProgress->fecParitySent;
+        pkt->carriesChunk = true;
+        pkt->fCode = THERMIT_FCODE_PARITY;
+        plPtr = framePrepare(prv);
+        plLen = (uint8_t)THERMIT_CHUNK_LENGTH(txProgress->fecGroupStart, txProgress);
+        memcpy(plPtr, txProgress->fecBuf[txProgress->fecParitySent], plLen);
+        ret = frameFinalize(prv, plLen);
+        if(ret == 0)
+        {
+          DEBUG_INFO(prv, "sending parity %d of chunks %lu..%lu\r\n", txProgress->fecParitySent, (unsigned long)txProgress->fecGroupStart,
+                     (unsigned long)(txProgress->fecGroupStart + fecGroupLength(prv, txProgress, txProgress->fecGroupStart) - 1));
+          prv->diagnostics.fecParities++;
+          txProgress->fecParitySent++;
+        }
+        break;
+
       case THERMIT_OUT_FILE_INFO:
         pkt->fCode = THERMIT_FCODE_NEW_FILE_START;
         plPtr = framePrepare(prv);
-        plLen = fillFileInfoMessage(plPtr, txProgress->fileName, txProgress->fileSize);
+        plLen = fillFileInfoMessage(plPtr, txProgress->fileName, txProgress->fileSize, (pkt->headerLen == THERMIT_HEADER_LENGTH_WIDE));
         ret = frameFinalize(prv, plLen);
+        txProgress->lastSendMs = timeNow(prv);
         break;
 
+      case THERMIT_OUT_KEEP_ALIVE:
+        /*the keep-alive is an empty data frame*/
+        DEBUG_INFO(prv, "sending keep-alive\r\n");
+        /* fall through */
       case THERMIT_OUT_EMPTY_DATA:
         pkt->fCode = THERMIT_FCODE_DATA_TRANSFER;
         (void)framePrepare(prv);
         ret = frameFinalize(prv, 0);
         break;
 
+      case THERMIT_OUT_SELECTIVE_ACK:
+        pkt->fCode = THERMIT_FCODE_SELECTIVE_ACK;
+        plPtr = framePrepare(prv);
+        plLen = fillSelectiveAck(prv, rxProgress, plPtr);
+        ret = frameFinalize(prv, plLen);
+        break;
+
+      case THERMIT_OUT_DELTA_REPORT:
+        pkt->fCode = THERMIT_FCODE_DELTA_REPORT;
+        plPtr = framePrepare(prv);
+        msgPutU8(&plPtr, (rxProgress->deltaCopyOpen ? 0 : THERMIT_DELTA_REPORT_NO_COPY));
+        plLen = 1 + fillSelectiveAck(prv, rxProgress, plPtr);
+        rxProgress->deltaReportDue = false;
+        ret = frameFinalize(prv, plLen);
+        break;
+
+      case THERMIT_OUT_NACK:
+        pkt->fCode = THERMIT_FCODE_NACK;
+        plPtr = framePrepare(prv);
+        plLen = 0;
+        {
+          uint8_t i;
+
+          for(i = 0; i < rxProgress->gapCount; i++)
+          {
+            if(pkt->headerLen == THERMIT_HEADER_LENGTH_WIDE)
+            {
+              msgPutU32(&plPtr, rxProgress->gapQueue[i].firstChunk);
+              msgPutU16(&plPtr, rxProgress->gapQueue[i].count);
+              plLen += THERMIT_NACK_GAP_LENGTH_WIDE;
+            }
+            else
+            {
+              msgPutU8(&plPtr, (uint8_t)rxProgress->gapQueue[i].firstChunk);
+              msgPutU8(&plPtr, (uint8_t)rxProgress->gapQueue[i].count);
+              plLen += THERMIT_NACK_GAP_LENGTH;
+            }
+          }
+        }
+        rxProgress->gapCount = 0;
+        ret = frameFinalize(prv, plLen);
+        break;
+
       case THERMIT_OUT_WRITE_TERMINATED_FORCEFULLY:
         pkt->fCode = THERMIT_FCODE_WRITE_TERMINATED_FORCEFULLY;
 
@@ -1311,9 +4086,6 @@ static int sendDataMessage(thermitPrv_t *prv)
         ret = frameFinalize(prv, 0);
         break;
 
-      case THERMIT_OUT_KEEP_ALIVE:
-        break;
-
       case THERMIT_OUT_NOTHING:
         break;
 
@@ -1326,7 +4098,7 @@ static int sendDataMessage(thermitPrv_t *prv)
 }
 
 
-static int parseFileInfoMessage(thermitPrv_t *prv, uint8_t *fileName, uint8_t fileNameMaxLen, uint16_t *fileSizePtr)
+static int parseFileInfoMessage(thermitPrv_t *prv, uint8_t *fileName, uint8_t fileNameMaxLen, uint32_t *fileSizePtr)
 {
   int ret = -1;
 
@@ -1338,18 +4110,18 @@ static int parseFileInfoMessage(thermitPrv_t *prv, uint8_t *fileName, uint8_t fi
     uint8_t len = pkt->payloadLen;
 
     /*
-    uint16_t size
+    uint16_t size (uint32_t in the wide header frame)
     uint8_t fileNameLen
     uint8_t fileName[fileNameLen]    
     */
+    bool isWide = (pkt->headerLen == THERMIT_HEADER_LENGTH_WIDE);
 
-
-    if(len > 3)
+    if(len > (isWide ? 5 : 3))
     {
       uint8_t fnLen;
       uint8_t *fnPtr = fileName;
 
-      *fileSizePtr = msgGetU16(&p);
+      *fileSizePtr = (isWide ? msgGetU32(&p) : msgGetU16(&p));
       fnLen = msgGetU8(&p);
       fnLen = ((fnLen < fileNameMaxLen) ? fnLen : fileNameMaxLen-1);
 
@@ -1360,7 +4132,7 @@ static int parseFileInfoMessage(thermitPrv_t *prv, uint8_t *fileName, uint8_t fi
 
       *fnPtr = 0;
 
-      DEBUG_INFO(prv, "file info: name='%s', size=%d\r\n", fileName, *fileSizePtr);
+      DEBUG_INFO(prv, "file info: name='%s', size=%lu\r\n", fileName, (unsigned long)*fileSizePtr);
 
       ret = 0;
     }
@@ -1372,37 +4144,106 @@ static int waitForDataMessage(thermitPrv_t *prv)
 {
   int ret = -1;
   thermitPacket_t *pkt = &(prv->packet);
-  thermitProgress_t *rxProgress = &(prv->rxProgress);
 
   switch (pkt->fCode)
   {
   case THERMIT_FCODE_DATA_TRANSFER:
+  case THERMIT_FCODE_DATA_COMPRESSED:
     handleDataMessage(prv);
     ret = 0;
     break;
 
+  case THERMIT_FCODE_SELECTIVE_ACK:
+    handleSelectiveAck(prv);
+    ret = 0;
+    break;
+
+  case THERMIT_FCODE_NACK:
+    handleNack(prv);
+    ret = 0;
+    break;
+
+  case THERMIT_FCODE_PARITY:
+    handleParity(prv);
+    ret = 0;
+    break;
+
+  case THERMIT_FCODE_DELTA_SIGNATURE:
+    handleDeltaSignatures(prv);
+    ret = 0;
+    break;
+
+  case THERMIT_FCODE_DELTA_REPORT:
+    handleDeltaReport(prv);
+    ret = 0;
+    break;
+
   case THERMIT_FCODE_NEW_FILE_START:
-    if(!rxProgress->running)
+    if((prv->rxProgress = slotFind(prv, prv->rxSlots, pkt->sndFileId)) != NULL)
+    {
+      /*the sender has not heard of us yet and repeats the file info*/
+      DEBUG_INFO(prv, "file info of file %d repeated\r\n", pkt->sndFileId);
+      prv->rxProgress->feedbackNow = true;
+      ret = 0;
+    }
+    else if(readyFileRemind(prv, pkt->sndFileId))
     {
+      DEBUG_INFO(prv, "file info of received file %d repeated\r\n", pkt->sndFileId);
+      ret = 0;
+    }
+    else if(slotFindFree(prv, prv->rxSlots) != NULL)
+    {
+      thermitProgress_t *rxProgress = slotFindFree(prv, prv->rxSlots);
       uint8_t fName[THERMIT_FILENAME_MAX+1];
-      uint16_t fileSize;
+      uint32_t fileSize;
 
       if(parseFileInfoMessage(prv, fName, THERMIT_FILENAME_MAX, &fileSize) == 0)
       {
         thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
-        thermitIoSlot_t fileHandle = tgt->fileOpen(rxProgress->fileName, THERMIT_WRITE, &fileSize);
+        thermitIoSlot_t copyHandle = -1;
+        uint32_t copySize = 0;
+        thermitIoSlot_t fileHandle;
 
-        if(fileHandle >= 0)
+        /*the old copy is opened first, the new file may take its name*/
+        if((prv->parameters.delta > 0) && tgt->fileOpenPrevious)
         {
-          ret = progressInitialize(prv, rxProgress, fileSize);
+          copyHandle = tgt->fileOpenPrevious(fName, &copySize);
+        }
 
-          rxProgress->running = true;
-          rxProgress->fileId = pkt->sndFileId;
-          strncpy(rxProgress->fileName, fName, THERMIT_FILENAME_MAX);
+        fileHandle = fileOpen(prv, fName, THERMIT_WRITE, &fileSize);
+
+        if(fileHandle >= 0)
+        {
+          if(progressInitialize(prv, rxProgress, fileSize) == 0)
+          {
+            ret = 0;
+            rxProgress->running = true;
+            rxProgress->fileHandle = fileHandle;
+            rxProgress->fileId = pkt->sndFileId;
+            rxProgress->deltaCopyOpen = (copyHandle >= 0);
+            rxProgress->deltaCopy = copyHandle;
+            rxProgress->deltaCopySize = copySize;
+            rxProgress->feedbackNow = true;   /*the sender holds the file after its first burst*/
+            strncpy(rxProgress->fileName, fName, THERMIT_FILENAME_MAX);
+            readyFilesPrune(prv, rxProgress->fileId);
+            copyHandle = -1;
+          }
+          else
+          {
+            DEBUG_ERR(prv, "file size %lu not supported, sending error frame\r\n", (unsigned long)fileSize);
+            fileDiscard(prv, fileHandle);
+            prv->sendWTF = true;
+          }
         }
         else
         {
-          DEBUG_ERR(prv, "opening new rx file failed\r\n");
+          DEBUG_ERR(prv, "opening new rx file failed, sending error frame\r\n");
+          prv->sendWTF = true;
+        }
+
+        if(copyHandle >= 0)
+        {
+          (void)tgt->fileClose(copyHandle);
         }
       }
       else
@@ -1414,10 +4255,13 @@ static int waitForDataMessage(thermitPrv_t *prv)
     }
     else
     {
-      /*cannot accept new file info during transfer, send "write terminated forcefully" frame.*/
+      /*cannot accept new file info when all slots are in use, send "write terminated forcefully" frame.*/
       DEBUG_ERR(prv, "remote tried to start new file during transfer, sending error frame\r\n");
       prv->sendWTF = true;
     }
+
+    /*the file info frame carries the feedback for our outgoing file as well*/
+    handleFeedback(prv);
     break;
 
   default:
@@ -1540,29 +4384,51 @@ static int handleIncoming(thermitPrv_t *prv)
     thermitPacket_t *pkt = &(prv->packet);
     thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
 
-    ret = 1; /*return positive non-zero if parameters are valid but there's nothing to do*/
+    uint8_t framesLeft = THERMIT_BURST_LENGTH_MAX + 1;  /*a burst of data and one more*/
 
-    /*check communication device for incoming messages*/
-    pkt->rawLen = tgt->devRead(prv->comLink, pkt->rawBuf, THERMIT_MSG_SIZE_MAX);
+    ret = 1; /*return positive non-zero if parameters are valid but there's nothing to do*/
 
-    if (parsePacketContent(prv) == 0)
+    /*check communication device for incoming messages. While running, the other end
+      may have sent a burst of frames: take all of them, but one by one during SYNC.*/
+    do
     {
-      /*message was received*/
-      debugDumpFrame(prv, pkt->rawBuf, "RECV:");
-
-      /*master and slave mode have different states, therefore the handling is separated here*/
-      if(prv->isMaster)
+      if(tgt->devReadChecked)
       {
-        #if THERMIT_MASTER_MODE_SUPPORT        
-        ret = masterRx(prv);
-        #endif
+        pkt->rawLen = tgt->devReadChecked(prv->comLink, pkt->rawBuf, THERMIT_MSG_SIZE_MAX, &(pkt->check));
       }
       else
       {
-        #if THERMIT_SLAVE_MODE_SUPPORT        
-        ret = slaveRx(prv);
-        #endif
+        pkt->check = THERMIT_FRAME_UNCHECKED;
+        pkt->rawLen = tgt->devRead(prv->comLink, pkt->rawBuf, THERMIT_MSG_SIZE_MAX);
+      }
+
+      if (parsePacketContent(prv) == 0)
+      {
+        /*message was received*/
+        debugDumpFrame(prv, pkt->rawBuf, "RECV:");
+        prv->lastRxMs = timeNow(prv);
+
+        /*master and slave mode have different states, therefore the handling is separated here*/
+        if(prv->isMaster)
+        {
+          #if THERMIT_MASTER_MODE_SUPPORT        
+          ret = masterRx(prv);
+          #endif
+        }
+        else
+        {
+          #if THERMIT_SLAVE_MODE_SUPPORT        
+          ret = slaveRx(prv);
+          #endif
+        }
       }
+    } while((pkt->rawLen > 0) && (prv->state == THERMIT_RUNNING) && (--framesLeft > 0));
+
+    /*not even keep-alives from the other end: start over with a new sync*/
+    if((prv->state == THERMIT_RUNNING) && keepAlivePeerLost(prv))
+    {
+      DEBUG_ERR(prv, "peer silent for %d keep-alive periods, resync\r\n", THERMIT_KEEP_ALIVE_LOST);
+      (void)changeState(prv, THERMIT_OUT_OF_SYNC);
     }
   }
 
@@ -1773,6 +4639,77 @@ static int slaveTx(thermitPrv_t *prv)
 
 
 
+/*send the prepared frame now, or keep it for devWriteBatch if available.
+  Returns non-zero if the link did not accept the frame.*/
+static int queueOutgoing(thermitPrv_t *prv)
+{
+  int ret = -1;
+  thermitPacket_t *pkt = &(prv->packet);
+  thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
+
+  if(tgt->devWriteBatch)
+  {
+    if(prv->burstCount < THERMIT_BURST_LENGTH_MAX)
+    {
+      memcpy(prv->burstBuf[prv->burstCount], pkt->rawBuf, pkt->rawLen);
+      prv->burstLen[prv->burstCount] = pkt->rawLen;
+      prv->burstCount++;
+      ret = 0;
+    }
+  }
+  else
+  {
+    ret = tgt->devWrite(prv->comLink, pkt->rawBuf, pkt->rawLen);
+    prv->burstCount++;
+  }
+
+  debugDumpFrame(prv, pkt->rawBuf, "SEND:");
+
+  return ret;
+}
+
+static void flushOutgoing(thermitPrv_t *prv)
+{
+  thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
+
+  if(tgt->devWriteBatch && (prv->burstCount > 0))
+  {
+    uint8_t *bufs[THERMIT_BURST_LENGTH_MAX];
+    uint8_t i;
+
+    for(i = 0; i < prv->burstCount; i++)
+    {
+      bufs[i] = prv->burstBuf[i];
+    }
+
+    (void)tgt->devWriteBatch(prv->comLink, bufs, prv->burstLen, prv->burstCount);
+  }
+  prv->burstLastCount = prv->burstCount;
+  prv->burstCount = 0;
+}
+
+/*the first frame of the step has been sent: fill the rest of the burst with
+  data chunks as long as there are chunks to send and the link accepts them*/
+static void continueBurst(thermitPrv_t *prv)
+{
+  thermitPacket_t *pkt = &(prv->packet);
+
+  while((prv->state == THERMIT_RUNNING) && (prv->burstCount < prv->diagnostics.burstLength))
+  {
+    if(prv->sendWTF)
+    {
+      break;  /*the error frame goes alone*/
+    }
+
+    pkt->rawLen = 0;
+
+    if((sendDataMessage(prv) != 0) || (pkt->rawLen == 0) || (queueOutgoing(prv) != 0))
+    {
+      break;
+    }
+  }
+}
+
 static int handleOutgoing(thermitPrv_t *prv)
 {
   int ret = -1;
@@ -1807,10 +4744,18 @@ static int handleOutgoing(thermitPrv_t *prv)
 
       if(pkt->rawLen > 0)
       {
-        thermitTargetAdaptationInterface_t *tgt = &(prv->targetIf);
-  
-        (void)tgt->devWrite(prv->comLink, pkt->rawBuf, pkt->rawLen);
-        debugDumpFrame(prv, pkt->rawBuf, "SEND:");
+        if(prv->state == THERMIT_RUNNING)
+        {
+          burstAdapt(prv);
+          prv->lastTxMs = timeNow(prv);
+        }
+        prv->burstCount = 0;
+
+        if(queueOutgoing(prv) == 0)
+        {
+          continueBurst(prv);
+        }
+        flushOutgoing(prv);
       }
     }
 
@@ -1823,7 +4768,7 @@ static int handleOutgoing(thermitPrv_t *prv)
 static thermitState_t mStep(thermit_t *inst)
 {
   thermitPrv_t *prv = (thermitPrv_t *)inst;
-  thermitState_t ret;
+  thermitState_t ret = THERMIT_FIRST_DUMMY_STATE;
 
   if (prv)
   {
@@ -1832,6 +4777,7 @@ static thermitState_t mStep(thermit_t *inst)
 
     rxRet = handleIncoming(prv);
     txRet = handleOutgoing(prv);
+    ret = prv->state;
   }
 
   return ret;
@@ -1849,3 +4795,17 @@ static int mReset(thermit_t *inst)
 
   return ret;
 }
+
+static int mGetDiagnostics(thermit_t *inst, thermitDiagnostics_t *diagnostics)
+{
+  thermitPrv_t *prv = (thermitPrv_t *)inst;
+  int ret = -1;
+
+  if (prv && diagnostics)
+  {
+    memcpy(diagnostics, &(prv->diagnostics), sizeof(thermitDiagnostics_t));
+    ret = 0;
+  }
+
+  return ret;
+}
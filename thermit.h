@@ -9,7 +9,18 @@
 #define DIVISION_ROUNDED_UP(value, divider) ((value) % (divider) == 0 ? (value) / (divider) : ((value) / (divider)) +1)
 
 
-#define THERMIT_VERSION                   0
+#define THERMIT_VERSION                   11
+#define THERMIT_VERSION_SELECTIVE_ACK     1   /*first version with the selective ack frame*/
+#define THERMIT_VERSION_EARLY_NACK        2   /*first version with the nack frame*/
+#define THERMIT_VERSION_LARGE_FILES       3   /*first version with the wide header for large files*/
+#define THERMIT_VERSION_TRANSFER_SLOTS    4   /*first version with several files in transfer at the same time*/
+#define THERMIT_VERSION_BIDIRECTIONAL     5   /*first version sending files from both ends at the same time*/
+#define THERMIT_VERSION_RETRANSMIT_TIMER  6   /*first version ignoring a repeated file info*/
+#define THERMIT_VERSION_FEC               7   /*first version with the parity frame*/
+#define THERMIT_VERSION_ERASURE_CODE      8   /*first version with more than one parity frame per group*/
+#define THERMIT_VERSION_COMPRESSION       9   /*first version with the compressed data frame*/
+#define THERMIT_VERSION_DICTIONARY        10  /*first version with the shared dictionary*/
+#define THERMIT_VERSION_DELTA             11  /*first version with the delta transfer*/
 
 #define THERMIT_FILENAME_MAX              32
 
@@ -22,13 +33,67 @@
 #define L2_PAYLOAD_SIZE (L2_MTU - L2_HEADER_SIZE - L2_FOOTER_SIZE)
 
 #define THERMIT_HEADER_LENGTH 6
+#define THERMIT_HEADER_LENGTH_WIDE 12   /*32 bit feedback and chunk number, used for large files*/
 #define THERMIT_FOOTER_LENGTH 2
+#define THERMIT_FOOTER_LENGTH_CRC32C 4
 #define THERMIT_PAYLOAD_SIZE (L2_PAYLOAD_SIZE - THERMIT_HEADER_LENGTH - THERMIT_FOOTER_LENGTH)
+#define THERMIT_PAYLOAD_SIZE_CRC32C (THERMIT_PAYLOAD_SIZE - (THERMIT_FOOTER_LENGTH_CRC32C - THERMIT_FOOTER_LENGTH))
 #define THERMIT_MSG_SIZE_MAX L2_PAYLOAD_SIZE
 
 
 #define THERMIT_MAX_REQUIRED_FILE_SIZE      512
 
+#ifndef THERMIT_BURST_LENGTH_MAX
+#define THERMIT_BURST_LENGTH_MAX    8       /*data frames sent at one step at most*/
+#endif
+#ifndef THERMIT_BURST_LENGTH_DEFAULT
+#define THERMIT_BURST_LENGTH_DEFAULT 4
+#endif
+
+#ifndef THERMIT_RTO_INITIAL_MS
+#define THERMIT_RTO_INITIAL_MS      1000    /*retransmission timeout before the first round trip sample*/
+#endif
+#ifndef THERMIT_RTO_MIN_MS
+#define THERMIT_RTO_MIN_MS          50
+#endif
+#ifndef THERMIT_RTO_MAX_MS
+#define THERMIT_RTO_MAX_MS          10000
+#endif
+#define THERMIT_RTO_BACKOFF_MAX     6       /*the timeout doubles after each timeout in a row, up to 64 times*/
+#ifndef THERMIT_PROBE_MIN_MS
+#define THERMIT_PROBE_MIN_MS        20      /*tail loss probe after two round trips, but not sooner than this*/
+#endif
+#define THERMIT_KEEP_ALIVE_LOST     3       /*the peer is lost after this many keep-alive periods without a frame*/
+
+#ifndef THERMIT_TRANSFER_SLOTS
+#define THERMIT_TRANSFER_SLOTS      4       /*files in transfer at the same time, per direction*/
+#endif
+
+#ifndef THERMIT_FEC_GROUP
+#define THERMIT_FEC_GROUP           0       /*forward error correction: 0 = off, K = a parity frame after each K chunks*/
+#endif
+
+/*parity frames per group, the redundancy is THERMIT_FEC_PARITY / THERMIT_FEC_GROUP.
+  1: XOR of the group, more: Reed-Solomon erasure code, any K of the K + M frames rebuild the group*/
+#ifndef THERMIT_FEC_PARITY
+#define THERMIT_FEC_PARITY          1
+#endif
+
+/*chunk compression codecs, bits of the compression parameter*/
+#define THERMIT_CODEC_LZ            0x0001  /*LZ77 within the chunk, see lz.h*/
+#define THERMIT_CODEC_LZ_DICT       0x0002  /*LZ77 against a dictionary both ends have, see sysDictionary*/
+
+#ifndef THERMIT_COMPRESSION
+#define THERMIT_COMPRESSION         0       /*codecs offered for compressing the chunks, 0 = off*/
+#endif
+
+/*delta transfer: the receiver rebuilds the unchanged blocks of a file from its old copy, see fileOpenPrevious*/
+#ifndef THERMIT_DELTA
+#define THERMIT_DELTA               0       /*0 = off, 1 = on*/
+#endif
+#define THERMIT_DELTA_BLOCK_CHUNKS_MAX  32      /*chunks per signed block at most*/
+#define THERMIT_DELTA_SEARCH_RANGE      16384   /*bytes the blocks are looked for around their expected place in the old copy*/
+
 #define THERMIT_CHUNK_COUNT_MAX     250//(DIVISION_ROUNDED_UP(THERMIT_MAX_REQUIRED_FILE_SIZE, THERMIT_PAYLOAD_SIZE))   //when adjusting this, please take a look at the THERMIT_FEEDBACK definitions
 
 #define THERMIT_FCODE_OFFSET 0
@@ -38,10 +103,23 @@
 #define THERMIT_SND_CHUNKNO_OFFSET 4
 #define THERMIT_PAYLOAD_LEN_OFFSET 5
 #define THERMIT_PAYLOAD_OFFSET 6
+#define THERMIT_SND_FILEID_OFFSET_WIDE 6
+#define THERMIT_SND_CHUNKNO_OFFSET_WIDE 7
 #define THERMIT_CRC_OFFSET(_PLLEN) ((_PLLEN) + THERMIT_PAYLOAD_OFFSET)
 #define THERMIT_EXPECTED_LENGHT(_PLLEN) ((_PLLEN) + THERMIT_PAYLOAD_OFFSET + 2)
 
-#define THERMIT_FEEDBACK_FILE_IS_READY 0xFF
+/*with CRC-32C, the PayloadLength byte also counts the two extra check bytes*/
+#define THERMIT_CRC32C_EXTRA_LENGTH (THERMIT_FOOTER_LENGTH_CRC32C - THERMIT_FOOTER_LENGTH)
+
+#define THERMIT_FEEDBACK_FILE_IS_READY        0xFFFFFFFF
+#define THERMIT_FEEDBACK_UNKNOWN              0xFFFFFFFE  /*the feedback did not fit into the compact header*/
+#define THERMIT_FEEDBACK_FILE_IS_READY_SHORT  0xFF        /*values in the compact header*/
+#define THERMIT_FEEDBACK_UNKNOWN_SHORT        0xFE
+
+/*files larger than maxFileSize are sent in large file mode, up to this many 64k blocks*/
+#ifndef THERMIT_LARGE_FILE_SIZE_MAX_64K
+#define THERMIT_LARGE_FILE_SIZE_MAX_64K       0xFFFF
+#endif
 
 #define THERMIT_FILEID_MAX         250
 #define THERMIT_FILEID_MAX         250
@@ -55,8 +133,16 @@ typedef enum
   THERMIT_FCODE_SYNC_ACK = 3,      //master acknowledges the parameter set
   THERMIT_FCODE_DATA_TRANSFER = 4, //data transfer frame. If file is to be sent, this frame contains one chunk. The frame can also be sent as feedback frame with empty data.
   THERMIT_FCODE_NEW_FILE_START = 5,//contains file info about next file to be sent
+  THERMIT_FCODE_SELECTIVE_ACK = 6, //feedback frame from the receiver. Payload is the chunk status bitmap of the incoming file, 1=dirty 0=done.
+  THERMIT_FCODE_NACK = 7,          //sent by the receiver as soon as it sees a gap in the chunk order. Payload is a list of (first chunk, count) pairs of missing chunks.
+  THERMIT_FCODE_PARITY = 8,        //forward error correction: parity frame J of a group of chunks, SndChunkNo is the first chunk of the group + J. Parity frame 0 is the XOR of the group. The receiver rebuilds as many lost chunks of the group as it has parity frames.
+  THERMIT_FCODE_DATA_COMPRESSED = 9, //data transfer frame with a compressed chunk. Chunks that do not get shorter go in the data transfer frame as they are.
+  THERMIT_FCODE_DELTA_SIGNATURE = 10, //delta transfer: checksums of the blocks starting from SndChunkNo. Payload is the chunks per block (0x80 = last frame of the round) and a (weak, strong) pair for each block.
+  THERMIT_FCODE_DELTA_REPORT = 11,  //delta transfer: the chunks the receiver could not find in its old copy, sent after the last signature frame of the round. Payload as in the selective ack frame.
   THERMIT_FCODE_WRITE_TERMINATED_FORCEFULLY = 0xFE, //sent if wrong file/illegal chunk is received
-  THERMIT_FCODE_OUT_OF_SYNC = 0xFF //error frame. Can be sent if the incoming frame is not supported in active protocol state.
+  THERMIT_FCODE_OUT_OF_SYNC = 0xFF, //error frame. Can be sent if the incoming frame is not supported in active protocol state.
+
+  THERMIT_FCODE_WIDE_HEADER = 0x40 //flag in the data, file info, selective ack, nack, parity and delta frames: the header has 32 bit feedback and chunk number fields
 } thermitFCode_t;
 
 
@@ -69,20 +155,37 @@ typedef enum
 } thermitIoMode_t;
 
 
+typedef enum
+{
+  THERMIT_CHECK_CRC16 = 0,       //16bit CRC, always used for the SYNC frames
+  THERMIT_CHECK_CRC32C = 1       //CRC-32C, used for the other frames when both ends support it
+} thermitCheckType_t;
+
+typedef enum
+{
+  THERMIT_FRAME_UNCHECKED = 0,   //the device delivers the frame as is, the protocol checks the CRC
+  THERMIT_FRAME_CRC16_OK,        //the device has verified the 16bit CRC while receiving the frame
+  THERMIT_FRAME_CRC32C_OK,       //the device has verified the CRC-32C while receiving the frame
+  THERMIT_FRAME_CHECK_FAILED     //the device has found the frame check to be wrong
+} thermitFrameCheck_t;
+
 typedef struct
 {
   /*raw data: This buffer will be used for both incoming and outgoing messages*/
   uint8_t rawBuf[THERMIT_MSG_SIZE_MAX];
   int16_t rawLen;
+  thermitFrameCheck_t check;
 
   /*parsed data:*/
   thermitFCode_t fCode;
   uint8_t recFileId;
-  uint8_t recFeedback;
+  uint32_t recFeedback;
   uint8_t sndFileId;
-  uint8_t sndChunkNo;
+  uint32_t sndChunkNo;
   uint8_t payloadLen;
   uint8_t *payloadPtr;
+  uint8_t headerLen;
+  bool carriesChunk;          //outgoing frame has a file chunk as payload
 } thermitPacket_t;
 
 typedef enum
@@ -103,20 +206,58 @@ typedef struct
   const struct thermitMethodTable_t *m;
 } thermit_t;
 
+#define THERMIT_BURST_HISTORY_LENGTH  16
+
+typedef struct
+{
+  uint32_t receivedFiles;
+  uint32_t receivedBytes;
+  uint32_t sentFiles;
+  uint32_t sentBytes;
+  uint32_t crcErrors;
+  uint32_t retransmits;
+  uint32_t reconnections;
+  uint16_t burstLength;                                 /*current, adapted burst length*/
+  uint8_t burstHistory[THERMIT_BURST_HISTORY_LENGTH];   /*latest burst length changes, ring buffer*/
+  uint8_t burstHistoryIdx;                              /*next write position in burstHistory*/
+  uint32_t rttMs;                                       /*smoothed round trip time*/
+  uint32_t rtoMs;                                       /*retransmission timeout*/
+  uint32_t timeouts;                                    /*files resent after the timeout*/
+  uint32_t probes;                                      /*tail loss probes sent*/
+  uint32_t fecParities;                                 /*parity frames sent*/
+  uint32_t fecRepairs;                                  /*lost chunks rebuilt from the parity frames*/
+  uint32_t compressedChunks;                            /*chunks sent compressed*/
+  uint32_t compressionSavedBytes;                       /*payload bytes saved by the compression*/
+  uint32_t deltaSignatures;                             /*delta signature frames sent*/
+  uint32_t deltaCopiedChunks;                           /*chunks taken from the old copy of a file*/
+  uint32_t deltaHashFailures;                           /*incoming files dropped because they did not match the hash of the sender*/
+} thermitDiagnostics_t;
+
 
 typedef thermitIoSlot_t (*cbDeviceOpen_t)(uint8_t *devName, thermitIoMode_t mode);
 typedef int (*cbDeviceClose_t)(thermitIoSlot_t slot);
 typedef int (*cbDeviceRead_t)(thermitIoSlot_t slot, uint8_t *buf, int16_t maxLen);
 typedef int (*cbDeviceWrite_t)(thermitIoSlot_t slot, uint8_t *buf, int16_t len);
+typedef int (*cbDeviceReadChecked_t)(thermitIoSlot_t slot, uint8_t *buf, int16_t maxLen, thermitFrameCheck_t *check);
+typedef int (*cbDeviceWriteBatch_t)(thermitIoSlot_t slot, uint8_t **bufs, int16_t *lens, uint16_t count);
+typedef int (*cbDeviceTxPending_t)(thermitIoSlot_t slot);
 typedef thermitIoSlot_t (*cbFileOpen_t)(uint8_t *fileName, thermitIoMode_t mode, uint16_t *fileSize);
 typedef int (*cbFileClose_t)(thermitIoSlot_t slot);
 typedef int (*cbFileRead_t)(thermitIoSlot_t slot, uint16_t offset, uint8_t *buf, int16_t maxLen);
 typedef int (*cbFileWrite_t)(thermitIoSlot_t slot, uint16_t offset, uint8_t *buf, int16_t len);
 typedef bool (*cbFileAvailableForSending_t)(uint8_t *fileNamePtr, uint16_t *sizePtr);
+typedef thermitIoSlot_t (*cbFileOpen32_t)(uint8_t *fileName, thermitIoMode_t mode, uint32_t *fileSize);
+typedef int (*cbFileRead32_t)(thermitIoSlot_t slot, uint32_t offset, uint8_t *buf, int16_t maxLen);
+typedef int (*cbFileWrite32_t)(thermitIoSlot_t slot, uint32_t offset, uint8_t *buf, int16_t len);
+typedef thermitIoSlot_t (*cbFileOpenPrevious_t)(uint8_t *fileName, uint32_t *fileSize);
+typedef int (*cbFileDiscard_t)(thermitIoSlot_t slot);
 
 typedef uint32_t (*cbSystemGetMilliseconds_t)(uint32_t *maxMs);
 typedef int (*cbSystemDebugPrintf_t)(const char *restrict format, ...);
 typedef uint16_t (*cbSystemCrc16_t)(const uint8_t *data, uint16_t size);
+typedef uint32_t (*cbSystemCrc32c_t)(const uint8_t *data, uint16_t size);
+typedef void (*cbSystemGf256MulAdd_t)(uint8_t *dst, const uint8_t *src, uint8_t coef, uint16_t size);
+typedef const uint8_t *(*cbSystemDictionary_t)(uint16_t *len);
 
 typedef struct
 {
@@ -132,6 +273,17 @@ typedef struct
   cbSystemGetMilliseconds_t sysGetMs;
   cbSystemDebugPrintf_t sysPrintf;
   cbSystemCrc16_t sysCrc16;
+  cbDeviceReadChecked_t devReadChecked;   /*optional: used instead of devRead when the device checks the CRC itself*/
+  cbSystemCrc32c_t sysCrc32c;             /*optional: enables negotiating CRC-32C frame check*/
+  cbDeviceWriteBatch_t devWriteBatch;     /*optional: sends several frames in one call*/
+  cbDeviceTxPending_t devTxPending;       /*optional: bytes waiting in the device TX queue, used for burst adaptation*/
+  cbFileOpen32_t fileOpen32;              /*optional: 32 bit file size, used instead of fileOpen. Needed for files over 64k.*/
+  cbFileRead32_t fileRead32;              /*optional: 32 bit offset, used instead of fileRead*/
+  cbFileWrite32_t fileWrite32;            /*optional: 32 bit offset, used instead of fileWrite*/
+  cbSystemGf256MulAdd_t sysGf256MulAdd;   /*optional: accelerated gf256MulAdd for the erasure code*/
+  cbSystemDictionary_t sysDictionary;     /*optional: compression dictionary trained with dictTrain, used when THERMIT_COMPRESSION has THERMIT_CODEC_LZ_DICT. The index is built into the instance only then.*/
+  cbFileOpenPrevious_t fileOpenPrevious;  /*optional: opens the existing copy of an incoming file for reading, enables THERMIT_DELTA. The copy must stay readable while the new file is written, which is read back with fileRead to check it.*/
+  cbFileDiscard_t fileDiscard;            /*optional: closes an incoming file that is not complete and drops it, instead of fileClose*/
 } thermitTargetAdaptationInterface_t;
 
 
@@ -139,6 +291,7 @@ struct thermitMethodTable_t
 {
   thermitState_t (*step)(thermit_t *inst);
   int (*reset)(thermit_t *inst);
+  int (*getDiagnostics)(thermit_t *inst, thermitDiagnostics_t *diagnostics);
 } thermitMethodTable_t;
 
 thermit_t *thermitNew(uint8_t *linkName, bool isMaster, thermitTargetAdaptationInterface_t *targetIf);